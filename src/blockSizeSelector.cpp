@@ -0,0 +1,198 @@
+#include "blockSizeSelector.h"
+#include "method.h"
+#include "profiler.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <unordered_set>
+
+using namespace thundercat;
+using namespace std;
+
+extern bool __DEBUG__;
+extern bool DUMP_OBJECT;
+
+// Size of the dense matrix used for the profile. Its nonzeros (12MB)
+// should not fit in the caches, as in the case of real matrices.
+#define PROFILE_MATRIX_DIM 1000
+#define PROFILE_ITERS 20
+// Fraction of the block rows that are sampled to estimate the fill ratio
+#define SAMPLED_BLOCK_ROW_FRACTION 0.02
+// Matrices with fewer block rows than this are analyzed completely
+#define MIN_SAMPLED_BLOCK_ROWS 100
+// Block sizes that produce more patterns than this in the sample are not
+// considered; each pattern is a separate loop in the generated code.
+#define MAX_SAMPLED_PATTERNS 2000
+
+///
+/// BlockingProfile
+///
+BlockingProfile::BlockingProfile() {
+  for (unsigned int r = 0; r <= MAX_BLOCK_DIM; r++)
+    for (unsigned int c = 0; c <= MAX_BLOCK_DIM; c++)
+      speed[r][c] = 0.0;
+}
+
+BlockingProfile* BlockingProfile::loadOrMeasure(string fileName) {
+  BlockingProfile *profile = new BlockingProfile();
+  if (!profile->read(fileName)) {
+    if (!__DEBUG__ && !DUMP_OBJECT)
+      cout << "Blocking profile " << fileName << " not found, measuring it.\n";
+    profile->measure();
+    profile->write(fileName);
+  }
+  return profile;
+}
+
+double BlockingProfile::getSpeed(unsigned int b_r, unsigned int b_c) {
+  return speed[b_r][b_c];
+}
+
+// The file has a line "b_r b_c mflops" per block size.
+bool BlockingProfile::read(string fileName) {
+  ifstream profileFile(fileName.c_str());
+  if (!profileFile.is_open())
+    return false;
+  
+  unsigned int b_r, b_c;
+  double mflops;
+  while (profileFile >> b_r >> b_c >> mflops) {
+    if (b_r >= 1 && b_r <= MAX_BLOCK_DIM && b_c >= 1 && b_c <= MAX_BLOCK_DIM)
+      speed[b_r][b_c] = mflops;
+  }
+  profileFile.close();
+  return true;
+}
+
+void BlockingProfile::write(string fileName) {
+  ofstream profileFile(fileName.c_str());
+  if (!profileFile.is_open()) {
+    std::cerr << "Could not write the blocking profile to " << fileName << ".\n";
+    return;
+  }
+  for (unsigned int r = 1; r <= MAX_BLOCK_DIM; r++)
+    for (unsigned int c = 1; c <= MAX_BLOCK_DIM; c++)
+      if (r * c <= MAX_BLOCK_CELLS)
+        profileFile << r << " " << c << " " << speed[r][c] << "\n";
+  profileFile.close();
+}
+
+void BlockingProfile::measure() {
+  const unsigned long n = PROFILE_MATRIX_DIM;
+  const unsigned long nz = n * n;
+  double *v = new double[n];
+  double *w = new double[n];
+  for (unsigned long i = 0; i < n; i++) {
+    v[i] = 1.0;
+    w[i] = 0.0;
+  }
+  
+  // The timings of the profile runs should not show up in the report.
+  Profiler::disable();
+  for (unsigned int r = 1; r <= MAX_BLOCK_DIM; r++) {
+    for (unsigned int c = 1; c <= MAX_BLOCK_DIM; c++) {
+      if (r * c > MAX_BLOCK_CELLS)
+        continue;
+      
+      int *rows = new int[n + 1];
+      int *cols = new int[nz];
+      double *vals = new double[nz];
+      for (unsigned long i = 0; i <= n; i++)
+        rows[i] = i * n;
+      for (unsigned long k = 0; k < nz; k++) {
+        cols[k] = k % n;
+        vals[k] = 1.0;
+      }
+      Matrix denseMatrix(rows, cols, vals, n, n, nz);
+      
+      GenOSKI genOSKI(r, c);
+      genOSKI.init(&denseMatrix, 1);
+      genOSKI.processMatrix();
+      genOSKI.emitCode();
+      
+      genOSKI.spmv(v, w); // warmup
+      auto start = std::chrono::high_resolution_clock::now();
+      for (unsigned int i = 0; i < PROFILE_ITERS; i++)
+        genOSKI.spmv(v, w);
+      auto end = std::chrono::high_resolution_clock::now();
+      double seconds = std::chrono::duration<double>(end - start).count();
+      speed[r][c] = 2.0 * nz * PROFILE_ITERS / seconds / 1e6;
+      
+      delete genOSKI.getMethodSpecificMatrix();
+    }
+  }
+  Profiler::enable();
+  
+  delete[] v;
+  delete[] w;
+}
+
+///
+/// BlockSizeSelector
+///
+BlockSizeSelector::BlockSizeSelector(Matrix *csrMatrix, BlockingProfile *profile) {
+  this->csrMatrix = csrMatrix;
+  this->profile = profile;
+}
+
+// As in OSKI, the block size that minimizes fill ratio / dense speed is picked.
+void BlockSizeSelector::selectBlockSize(unsigned int &b_r, unsigned int &b_c) {
+  double bestCost = -1.0;
+  b_r = 1;
+  b_c = 1;
+  for (unsigned int r = 1; r <= MAX_BLOCK_DIM; r++) {
+    for (unsigned int c = 1; c <= MAX_BLOCK_DIM; c++) {
+      if (r * c > MAX_BLOCK_CELLS)
+        continue;
+      double speed = profile->getSpeed(r, c);
+      if (speed <= 0.0)
+        continue;
+      
+      double fillRatio;
+      unsigned long numPatterns;
+      estimate(r, c, fillRatio, numPatterns);
+      if (numPatterns > MAX_SAMPLED_PATTERNS)
+        continue;
+      
+      double cost = fillRatio / speed;
+      if (bestCost < 0.0 || cost < bestCost) {
+        bestCost = cost;
+        b_r = r;
+        b_c = c;
+      }
+    }
+  }
+}
+
+void BlockSizeSelector::estimate(unsigned int b_r, unsigned int b_c,
+                                 double &fillRatio, unsigned long &numPatterns) {
+  unsigned long numBlockRows = (csrMatrix->n + b_r - 1) / b_r;
+  unsigned long stride = (unsigned long)(1.0 / SAMPLED_BLOCK_ROW_FRACTION);
+  if (numBlockRows / stride < MIN_SAMPLED_BLOCK_ROWS)
+    stride = std::max(1UL, numBlockRows / MIN_SAMPLED_BLOCK_ROWS);
+  
+  unsigned long numSampledElements = 0;
+  unsigned long numSampledBlocks = 0;
+  unordered_set<unsigned long long> patterns;
+  map<int, BlockPattern> blocks;
+  for (unsigned long blockRow = 0; blockRow < numBlockRows; blockRow += stride) {
+    unsigned long rowEnd = std::min((blockRow + 1) * b_r, csrMatrix->n);
+    for (unsigned long row = blockRow * b_r; row < rowEnd; row++) {
+      for (int k = csrMatrix->rows[row]; k < csrMatrix->rows[row + 1]; k++) {
+        int col = csrMatrix->cols[k];
+        blocks[col / b_c].set((row % b_r) * b_c + (col % b_c));
+      }
+      numSampledElements += csrMatrix->rows[row + 1] - csrMatrix->rows[row];
+    }
+    numSampledBlocks += blocks.size();
+    for (auto &block : blocks) {
+      if (patterns.size() <= MAX_SAMPLED_PATTERNS)
+        patterns.insert(block.second.to_ullong());
+    }
+    blocks.clear();
+  }
+  
+  fillRatio = numSampledElements == 0 ? 1.0 : (numSampledBlocks * b_r * b_c) / (double)numSampledElements;
+  numPatterns = patterns.size();
+}
@@ -0,0 +1,56 @@
+#ifndef _BLOCK_SIZE_SELECTOR_H_
+#define _BLOCK_SIZE_SELECTOR_H_
+
+#include "matrix.h"
+#include <string>
+
+// Block sizes from 1x1 up to MAX_BLOCK_DIM x MAX_BLOCK_DIM are considered.
+#define MAX_BLOCK_DIM 8
+
+namespace thundercat {
+  ///
+  /// Register blocking speed of GenOSKI on this machine,
+  /// measured once on a dense matrix stored in sparse format (OSKI-style).
+  ///
+  class BlockingProfile {
+  public:
+    // Read the profile from the given file. If the file does not exist,
+    // measure the profile and save it to the file for later runs.
+    static BlockingProfile* loadOrMeasure(std::string fileName);
+    
+    // Mflop/s of a dense matrix blocked as b_r x b_c
+    double getSpeed(unsigned int b_r, unsigned int b_c);
+    
+  private:
+    BlockingProfile();
+    
+    bool read(std::string fileName);
+    void write(std::string fileName);
+    void measure();
+    
+    double speed[MAX_BLOCK_DIM + 1][MAX_BLOCK_DIM + 1];
+  };
+  
+  ///
+  /// Picks the GenOSKI block size for a matrix: the fill ratio and the number
+  /// of distinct block patterns of each block size are estimated from a
+  /// sample of block rows, and combined with the blocking profile.
+  ///
+  class BlockSizeSelector {
+  public:
+    BlockSizeSelector(Matrix *csrMatrix, BlockingProfile *profile);
+    
+    void selectBlockSize(unsigned int &b_r, unsigned int &b_c);
+    
+  private:
+    // Estimate the fill ratio (stored cells / nonzeros) and the number
+    // of distinct patterns of b_r x b_c blocks
+    void estimate(unsigned int b_r, unsigned int b_c,
+                  double &fillRatio, unsigned long &numPatterns);
+    
+    Matrix *csrMatrix;
+    BlockingProfile *profile;
+  };
+}
+
+#endif
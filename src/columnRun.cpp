@@ -0,0 +1,372 @@
+#include "method.h"
+#include "emitterUtils.h"
+#include <iostream>
+
+using namespace thundercat;
+using namespace std;
+using namespace asmjit;
+using namespace x86;
+
+// Number of elements of a run multiplied in one iteration of the unrolled loop
+#define COLUMN_RUN_UNROLLING 4
+
+///
+/// Analysis
+///
+void ColumnRun::analyzeMatrix() {
+  ColumnRunAnalyzer analyzer;
+  useRuns = analyzer.analyzeMatrix(csrMatrix, stripeInfos, numRowRuns, maxRunLengths);
+}
+
+///
+/// ColumnRun
+///
+void ColumnRun::convertMatrix() {
+  if (useRuns) {
+    ColumnRunAnalyzer analyzer;
+    matrix = analyzer.convertMatrix(csrMatrix, numRowRuns);
+  } else {
+    // The runs are too short; we use the original CSR format
+    matrix = csrMatrix;
+  }
+}
+
+///
+/// ColumnRunCodeEmitter:
+/// Helper class to avoid having to pass several parameters
+///
+class ColumnRunCodeEmitter {
+public:
+  ColumnRunCodeEmitter(X86Assembler *assembler,
+                       bool useRuns,
+                       unsigned long maxRunLength,
+                       unsigned long baseValsIndex,
+                       unsigned long baseRowsIndex,
+                       int N) {
+    this->assembler = assembler;
+    this->useRuns = useRuns;
+    this->maxRunLength = maxRunLength;
+    this->baseValsIndex = baseValsIndex;
+    this->baseRowsIndex = baseRowsIndex;
+    this->N = N;
+    this->fusedOp = NO_FUSED_OP;
+  }
+
+  void emit();
+
+  // Makes emit generate w = alpha·A·v + beta·w instead of w += A·v
+  void setOutputScaling(double alpha, double beta) {
+    scaling.alpha = alpha;
+    scaling.beta = beta;
+    scaling.constants = assembler->newLabel();
+  }
+
+  // Makes emit generate the code of spmvDot or spmvAxpy (see MultByMDotFun and MultByMAxpyFun)
+  void setFusedOp(FusedOp fusedOp) {
+    this->fusedOp = fusedOp;
+  }
+
+private:
+  X86Assembler *assembler;
+  bool useRuns;
+  unsigned long maxRunLength;
+  unsigned long baseValsIndex;
+  unsigned long baseRowsIndex;
+  int N;
+  OutputScaling scaling;
+  FusedOp fusedOp;
+
+  void emitHeader();
+
+  // The row update, whose row index relative to the stripe is in %rax
+  void emitUpdate();
+
+  void emitFooter();
+
+  void emitRunLoop();
+
+  void emitCSRLoop();
+};
+
+void ColumnRun::emitMultByMFunction(unsigned int index) {
+  X86Assembler assembler(codeHolders[index]);
+  auto &stripeInfo = stripeInfos->at(index);
+  ColumnRunCodeEmitter emitter(&assembler,
+                               useRuns,
+                               maxRunLengths.at(index),
+                               stripeInfo.valIndexBegin,
+                               stripeInfo.rowIndexBegin,
+                               stripeInfo.rowIndexEnd - stripeInfo.rowIndexBegin);
+  emitter.emit();
+}
+
+bool ColumnRun::supportsScaling() {
+  return true;
+}
+
+void ColumnRun::emitScaledFunction(unsigned int index) {
+  X86Assembler assembler(scaledCodeHolders[index]);
+  auto &stripeInfo = stripeInfos->at(index);
+  ColumnRunCodeEmitter emitter(&assembler,
+                               useRuns,
+                               maxRunLengths.at(index),
+                               stripeInfo.valIndexBegin,
+                               stripeInfo.rowIndexBegin,
+                               stripeInfo.rowIndexEnd - stripeInfo.rowIndexBegin);
+  emitter.setOutputScaling(kernelOptions.alpha, kernelOptions.beta);
+  emitter.emit();
+}
+
+bool ColumnRun::supportsFusedOps() {
+  return true;
+}
+
+void ColumnRun::emitDotFunction(unsigned int index) {
+  X86Assembler assembler(dotCodeHolders[index]);
+  auto &stripeInfo = stripeInfos->at(index);
+  ColumnRunCodeEmitter emitter(&assembler,
+                               useRuns,
+                               maxRunLengths.at(index),
+                               stripeInfo.valIndexBegin,
+                               stripeInfo.rowIndexBegin,
+                               stripeInfo.rowIndexEnd - stripeInfo.rowIndexBegin);
+  emitter.setFusedOp(FUSED_DOT);
+  emitter.emit();
+}
+
+void ColumnRun::emitAxpyFunction(unsigned int index) {
+  X86Assembler assembler(axpyCodeHolders[index]);
+  auto &stripeInfo = stripeInfos->at(index);
+  ColumnRunCodeEmitter emitter(&assembler,
+                               useRuns,
+                               maxRunLengths.at(index),
+                               stripeInfo.valIndexBegin,
+                               stripeInfo.rowIndexBegin,
+                               stripeInfo.rowIndexEnd - stripeInfo.rowIndexBegin);
+  emitter.setFusedOp(FUSED_AXPY);
+  emitter.emit();
+}
+
+// The row loop goes over all rows of the stripe
+bool ColumnRun::visitsEmptyRows() {
+  return true;
+}
+
+void ColumnRunCodeEmitter::emit() {
+  emitHeader();
+  if (useRuns)
+    emitRunLoop();
+  else
+    emitCSRLoop();
+  emitFooter();
+  emitScalingConstants(assembler, scaling);
+}
+
+void ColumnRunCodeEmitter::emitHeader() {
+  // rows is in %rdx, cols is in %rcx, vals is in %r8
+  assembler->push(rbx);
+
+  assembler->lea(rdx, ptr(rdx, (int)baseRowsIndex * sizeof(int)));
+  assembler->lea(rsi, ptr(rsi, (int)baseRowsIndex * sizeof(double)));
+  // In the run format, %r8 walks over vals; the runs do not store val indices.
+  if (useRuns)
+    assembler->lea(r8, ptr(r8, (int)baseValsIndex * sizeof(double)));
+  if (fusedOp == FUSED_AXPY) {
+    // y is the 6th argument; %r9 walks over the row.
+    assembler->push(r12);
+    assembler->lea(r12, ptr(r9, (int)baseRowsIndex * sizeof(double)));
+  }
+  emitFusedOpInit(assembler, fusedOp);
+}
+
+void ColumnRunCodeEmitter::emitFooter() {
+  if (fusedOp == FUSED_AXPY)
+    assembler->pop(r12);
+  assembler->pop(rbx);
+  emitFusedOpResult(assembler, fusedOp);
+  assembler->ret();
+}
+
+// v is not shifted to the stripe, since the columns are global.
+void ColumnRunCodeEmitter::emitUpdate() {
+  X86Mem fusedEntry = fusedOp == FUSED_DOT ? ptr(rdi, rax, 3, (int)baseRowsIndex * sizeof(double))
+                                           : ptr(r12, rax, 3);
+  // addsd (%rsi,%rax,8), %xmm0 ; movsd %xmm0, (%rsi,%rax,8)
+  emitRowUpdate(assembler, scaling, ptr(rsi, rax, 3), xmm0, xmm1, fusedOp, fusedEntry);
+}
+
+// Row counter is %rax. The runs of the row are %r9 up to %r10.
+// For each run, %r11 points to v[start] and %rbx is the remaining length.
+void ColumnRunCodeEmitter::emitRunLoop() {
+  Label rowLoop = assembler->newLabel();
+  Label rowLoopEnd = assembler->newLabel();
+  Label runLoop = assembler->newLabel();
+  Label runLoopEnd = assembler->newLabel();
+  Label pairLoop = assembler->newLabel();
+  Label pairLoopEnd = assembler->newLabel();
+  Label nextRun = assembler->newLabel();
+
+  // xorl %eax, %eax
+  assembler->xor_(eax, eax);
+  assembler->bind(rowLoop);
+  // cmpq $N, %rax
+  assembler->cmp(rax, N);
+  // jge rowLoopEnd
+  assembler->jge(rowLoopEnd);
+  // movslq (%rdx,%rax,4), %r9
+  assembler->movsxd(r9, ptr(rdx, rax, 2));
+  // movslq 4(%rdx,%rax,4), %r10
+  assembler->movsxd(r10, ptr(rdx, rax, 2, 4));
+  // xorps %xmm0, %xmm0 ; xorps %xmm3, %xmm3
+  assembler->xorps(xmm0, xmm0);
+  assembler->xorps(xmm3, xmm3);
+
+  assembler->bind(runLoop);
+  // cmpq %r10, %r9
+  assembler->cmp(r9, r10);
+  // jge runLoopEnd
+  assembler->jge(runLoopEnd);
+  // movslq (%rcx,%r9,8), %r11 ## start column
+  assembler->movsxd(r11, ptr(rcx, r9, 3));
+  // leaq (%rdi,%r11,8), %r11 ## &v[start]
+  assembler->lea(r11, ptr(rdi, r11, 3));
+  // movslq 4(%rcx,%r9,8), %rbx ## run length
+  assembler->movsxd(rbx, ptr(rcx, r9, 3, 4));
+
+  // The unrolled loop is needed only if the stripe has long enough runs
+  if (maxRunLength >= COLUMN_RUN_UNROLLING) {
+    Label unrolledLoop = assembler->newLabel();
+    assembler->bind(unrolledLoop);
+    // cmpq $COLUMN_RUN_UNROLLING, %rbx
+    assembler->cmp(rbx, COLUMN_RUN_UNROLLING);
+    // jl pairLoop
+    assembler->jl(pairLoop);
+    // movupd (%r8), %xmm1
+    assembler->movupd(xmm1, ptr(r8));
+    // movupd (%r11), %xmm4
+    assembler->movupd(xmm4, ptr(r11));
+    // mulpd %xmm4, %xmm1
+    assembler->mulpd(xmm1, xmm4);
+    // addpd %xmm1, %xmm0
+    assembler->addpd(xmm0, xmm1);
+    // movupd 16(%r8), %xmm2
+    assembler->movupd(xmm2, ptr(r8, 16));
+    // movupd 16(%r11), %xmm5
+    assembler->movupd(xmm5, ptr(r11, 16));
+    // mulpd %xmm5, %xmm2
+    assembler->mulpd(xmm2, xmm5);
+    // addpd %xmm2, %xmm3
+    assembler->addpd(xmm3, xmm2);
+    // addq $32, %r8 ; addq $32, %r11
+    assembler->add(r8, COLUMN_RUN_UNROLLING * sizeof(double));
+    assembler->add(r11, COLUMN_RUN_UNROLLING * sizeof(double));
+    // subq $COLUMN_RUN_UNROLLING, %rbx
+    assembler->sub(rbx, COLUMN_RUN_UNROLLING);
+    // jmp unrolledLoop
+    assembler->jmp(unrolledLoop);
+  }
+
+  assembler->bind(pairLoop);
+  if (maxRunLength >= 2) {
+    // cmpq $2, %rbx
+    assembler->cmp(rbx, 2);
+    // jl pairLoopEnd
+    assembler->jl(pairLoopEnd);
+    // movupd (%r8), %xmm1
+    assembler->movupd(xmm1, ptr(r8));
+    // movupd (%r11), %xmm4
+    assembler->movupd(xmm4, ptr(r11));
+    // mulpd %xmm4, %xmm1
+    assembler->mulpd(xmm1, xmm4);
+    // addpd %xmm1, %xmm0
+    assembler->addpd(xmm0, xmm1);
+    // addq $16, %r8 ; addq $16, %r11
+    assembler->add(r8, 2 * sizeof(double));
+    assembler->add(r11, 2 * sizeof(double));
+    // subq $2, %rbx
+    assembler->sub(rbx, 2);
+    // jmp pairLoop
+    assembler->jmp(pairLoop);
+  }
+  assembler->bind(pairLoopEnd);
+
+  // The last element of an odd-length run
+  // testq %rbx, %rbx
+  assembler->test(rbx, rbx);
+  // jz nextRun
+  assembler->jz(nextRun);
+  // movsd (%r8), %xmm1
+  assembler->movsd(xmm1, ptr(r8));
+  // mulsd (%r11), %xmm1
+  assembler->mulsd(xmm1, ptr(r11));
+  // addsd %xmm1, %xmm3
+  assembler->addsd(xmm3, xmm1);
+  // addq $8, %r8
+  assembler->add(r8, sizeof(double));
+
+  assembler->bind(nextRun);
+  // incq %r9
+  assembler->inc(r9);
+  // jmp runLoop
+  assembler->jmp(runLoop);
+
+  assembler->bind(runLoopEnd);
+  // addpd %xmm3, %xmm0
+  assembler->addpd(xmm0, xmm3);
+  // haddpd %xmm0, %xmm0
+  assembler->haddpd(xmm0, xmm0);
+  emitUpdate();
+  // incq %rax
+  assembler->inc(rax);
+  // jmp rowLoop
+  assembler->jmp(rowLoop);
+  assembler->bind(rowLoopEnd);
+}
+
+// Row counter is %rax. The elements of the row are %r9 up to %r10.
+void ColumnRunCodeEmitter::emitCSRLoop() {
+  Label rowLoop = assembler->newLabel();
+  Label rowLoopEnd = assembler->newLabel();
+  Label elementLoop = assembler->newLabel();
+  Label elementLoopEnd = assembler->newLabel();
+
+  // xorl %eax, %eax
+  assembler->xor_(eax, eax);
+  assembler->bind(rowLoop);
+  // cmpq $N, %rax
+  assembler->cmp(rax, N);
+  // jge rowLoopEnd
+  assembler->jge(rowLoopEnd);
+  // movslq (%rdx,%rax,4), %r9
+  assembler->movsxd(r9, ptr(rdx, rax, 2));
+  // movslq 4(%rdx,%rax,4), %r10
+  assembler->movsxd(r10, ptr(rdx, rax, 2, 4));
+  // xorps %xmm0, %xmm0
+  assembler->xorps(xmm0, xmm0);
+
+  assembler->bind(elementLoop);
+  // cmpq %r10, %r9
+  assembler->cmp(r9, r10);
+  // jge elementLoopEnd
+  assembler->jge(elementLoopEnd);
+  // movslq (%rcx,%r9,4), %r11 ## cols[k]
+  assembler->movsxd(r11, ptr(rcx, r9, 2));
+  // movsd (%r8,%r9,8), %xmm1 ## vals[k]
+  assembler->movsd(xmm1, ptr(r8, r9, 3));
+  // mulsd (%rdi,%r11,8), %xmm1 ## v[cols[k]]
+  assembler->mulsd(xmm1, ptr(rdi, r11, 3));
+  // addsd %xmm1, %xmm0
+  assembler->addsd(xmm0, xmm1);
+  // incq %r9
+  assembler->inc(r9);
+  // jmp elementLoop
+  assembler->jmp(elementLoop);
+
+  assembler->bind(elementLoopEnd);
+  emitUpdate();
+  // incq %rax
+  assembler->inc(rax);
+  // jmp rowLoop
+  assembler->jmp(rowLoop);
+  assembler->bind(rowLoopEnd);
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "method.h"
+#include <emmintrin.h>
+#include <iostream>
+
+using namespace thundercat;
+using namespace std;
+
+///
+/// Column-run CSR: each row is a list of runs of consecutive columns.
+/// The v elements of a run are contiguous, so they are read with
+/// packed loads, UnrollingFactor elements per iteration.
+///
+template <unsigned int UnrollingFactor>
+class ColumnRunCSR: public SpMVMethod {
+public:
+  virtual void spmv(double* __restrict v, double* __restrict w) final;
+
+protected:
+  virtual void analyzeMatrix() final;
+  virtual void convertMatrix() final;
+
+private:
+  void spmvRuns(double* __restrict v, double* __restrict w);
+  void spmvCSR(double* __restrict v, double* __restrict w);
+
+  bool useRuns;
+  std::vector<int> numRowRuns;
+  std::vector<unsigned long> maxRunLengths;
+};
+
+template <unsigned int UnrollingFactor>
+void ColumnRunCSR<UnrollingFactor>::analyzeMatrix() {
+  ColumnRunAnalyzer analyzer;
+  useRuns = analyzer.analyzeMatrix(csrMatrix, stripeInfos, numRowRuns, maxRunLengths);
+}
+
+template <unsigned int UnrollingFactor>
+void ColumnRunCSR<UnrollingFactor>::convertMatrix() {
+  if (useRuns) {
+    ColumnRunAnalyzer analyzer;
+    matrix = analyzer.convertMatrix(csrMatrix, numRowRuns);
+  } else {
+    matrix = csrMatrix;
+  }
+}
+
+template <unsigned int UnrollingFactor>
+void ColumnRunCSR<UnrollingFactor>::spmv(double* __restrict v, double* __restrict w) {
+  if (useRuns)
+    spmvRuns(v, w);
+  else
+    spmvCSR(v, w);
+}
+
+template <unsigned int UnrollingFactor>
+void ColumnRunCSR<UnrollingFactor>::spmvRuns(double* __restrict v, double* __restrict w) {
+  static_assert(UnrollingFactor % 2 == 0, "Runs are read in pairs of doubles.");
+  const int *rows = matrix->rows;
+  const int *runs = matrix->cols;
+#pragma omp parallel for
+  for (unsigned int t = 0; t < stripeInfos->size(); t++) {
+    int rowIndexBegin = stripeInfos->at(t).rowIndexBegin;
+    int rowIndexEnd = stripeInfos->at(t).rowIndexEnd;
+    const double *vals = matrix->vals + stripeInfos->at(t).valIndexBegin;
+
+    for (int i = rowIndexBegin; i < rowIndexEnd; i++) {
+      __m128d sums[UnrollingFactor / 2];
+      for (unsigned int u = 0; u < UnrollingFactor / 2; u++)
+        sums[u] = _mm_setzero_pd();
+      double sum = 0.0;
+      for (int r = rows[i]; r < rows[i + 1]; r++) {
+        const double *vv = v + runs[2 * r];
+        const int length = runs[2 * r + 1];
+        int j = 0;
+        for (; j + (int)UnrollingFactor <= length; j += UnrollingFactor) {
+          for (unsigned int u = 0; u < UnrollingFactor / 2; u++) {
+            __m128d product = _mm_mul_pd(_mm_loadu_pd(vals + j + 2 * u), _mm_loadu_pd(vv + j + 2 * u));
+            sums[u] = _mm_add_pd(sums[u], product);
+          }
+        }
+        for (; j + 2 <= length; j += 2) {
+          sums[0] = _mm_add_pd(sums[0], _mm_mul_pd(_mm_loadu_pd(vals + j), _mm_loadu_pd(vv + j)));
+        }
+        if (j < length) {
+          sum += vals[j] * vv[j];
+        }
+        vals += length;
+      }
+      for (unsigned int u = 1; u < UnrollingFactor / 2; u++)
+        sums[0] = _mm_add_pd(sums[0], sums[u]);
+      double pair[2];
+      _mm_storeu_pd(pair, sums[0]);
+      w[i] += sum + pair[0] + pair[1];
+    }
+  }
+}
+
+template <unsigned int UnrollingFactor>
+void ColumnRunCSR<UnrollingFactor>::spmvCSR(double* __restrict v, double* __restrict w) {
+  const int *rows = matrix->rows;
+  const int *cols = matrix->cols;
+  const double *vals = matrix->vals;
+#pragma omp parallel for
+  for (unsigned int t = 0; t < stripeInfos->size(); t++) {
+    int rowIndexBegin = stripeInfos->at(t).rowIndexBegin;
+    int rowIndexEnd = stripeInfos->at(t).rowIndexEnd;
+    for (int i = rowIndexBegin; i < rowIndexEnd; i++) {
+      double sum = 0.0;
+      for (int k = rows[i]; k < rows[i + 1]; k++) {
+        sum += vals[k] * v[cols[k]];
+      }
+      w[i] += sum;
+    }
+  }
+}
@@ -1,5 +1,7 @@
 #include "method.h"
 #include "profiler.h"
+#include "emitterUtils.h"
+#include "csrByNZCodeEmitter.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -29,8 +31,13 @@ void CSRbyNZ::analyzeMatrix() {
 //       sorted according to the order used in rows array
 void CSRbyNZ::convertMatrix() {
   int *rows = new int[csrMatrix->n];
-  int *cols = new int[csrMatrix->nz];
+  // cols is padded so that the indirect prefetches of the last elements
+  // do not read past the end of the array.
+  int *cols = new int[csrMatrix->nz + kernelOptions.getPrefetchDistance()];
   double *vals = new double[csrMatrix->nz];
+  for (unsigned int i = 0; i < kernelOptions.getPrefetchDistance(); i++) {
+    cols[csrMatrix->nz + i] = 0;
+  }
 
 #pragma omp parallel for
   for (int t = 0; t < rowByNZLists.size(); ++t) {
@@ -55,47 +62,96 @@ void CSRbyNZ::convertMatrix() {
   matrix = new Matrix(rows, cols, vals, csrMatrix->n, csrMatrix->m, csrMatrix->nz);
 }
 
-///
-/// CSRbyNZCodeEmitter:
-/// Helper class to avoid having to pass several parameters
-///
-class CSRbyNZCodeEmitter {
-public:
-  CSRbyNZCodeEmitter(X86Assembler *assembler,
-                     NZtoRowMap *rowByNZs,
-                     unsigned long baseValsIndex,
-                     unsigned long baseRowsIndex) {
-    this->assembler = assembler;
-    this->rowByNZs = rowByNZs;
-    this->baseValsIndex = baseValsIndex;
-    this->baseRowsIndex = baseRowsIndex;
-  }
-
-  void emit();
-  
-private:
-  X86Assembler *assembler;
-  NZtoRowMap *rowByNZs;
-  unsigned long baseValsIndex;
-  unsigned long baseRowsIndex;
-  
-  void emitHeader();
-  
-  void emitFooter();
-  
-  void emitSingleLoop(unsigned long numRows, unsigned long rowLength);
-};
-
 void CSRbyNZ::emitMultByMFunction(unsigned int index) {
   X86Assembler assembler(codeHolders[index]);
   NZtoRowMap &rowByNZs = rowByNZLists.at(index);
   CSRbyNZCodeEmitter emitter(&assembler,
                              &rowByNZs,
                              stripeInfos->at(index).valIndexBegin,
-                             stripeInfos->at(index).rowIndexBegin);
+                             stripeInfos->at(index).rowIndexBegin,
+                             kernelOptions);
+  emitter.emit();
+}
+
+
+bool CSRbyNZ::supportsSpMM() {
+  return true;
+}
+
+void CSRbyNZ::emitSpMMFunction(unsigned int index) {
+  X86Assembler assembler(spmmCodeHolders[index]);
+  NZtoRowMap &rowByNZs = rowByNZLists.at(index);
+  CSRbyNZCodeEmitter emitter(&assembler,
+                             &rowByNZs,
+                             stripeInfos->at(index).valIndexBegin,
+                             stripeInfos->at(index).rowIndexBegin,
+                             kernelOptions);
+  emitter.emitSpMM();
+}
+
+bool CSRbyNZ::supportsScaling() {
+  return true;
+}
+
+void CSRbyNZ::emitScaledFunction(unsigned int index) {
+  X86Assembler assembler(scaledCodeHolders[index]);
+  NZtoRowMap &rowByNZs = rowByNZLists.at(index);
+  CSRbyNZCodeEmitter emitter(&assembler,
+                             &rowByNZs,
+                             stripeInfos->at(index).valIndexBegin,
+                             stripeInfos->at(index).rowIndexBegin,
+                             kernelOptions);
+  emitter.setOutputScaling(kernelOptions.alpha, kernelOptions.beta);
+  emitter.emit();
+}
+
+bool CSRbyNZ::supportsFusedOps() {
+  return true;
+}
+
+void CSRbyNZ::emitDotFunction(unsigned int index) {
+  X86Assembler assembler(dotCodeHolders[index]);
+  NZtoRowMap &rowByNZs = rowByNZLists.at(index);
+  CSRbyNZCodeEmitter emitter(&assembler,
+                             &rowByNZs,
+                             stripeInfos->at(index).valIndexBegin,
+                             stripeInfos->at(index).rowIndexBegin,
+                             kernelOptions);
+  emitter.setFusedOp(FUSED_DOT);
   emitter.emit();
 }
 
+void CSRbyNZ::emitAxpyFunction(unsigned int index) {
+  X86Assembler assembler(axpyCodeHolders[index]);
+  NZtoRowMap &rowByNZs = rowByNZLists.at(index);
+  CSRbyNZCodeEmitter emitter(&assembler,
+                             &rowByNZs,
+                             stripeInfos->at(index).valIndexBegin,
+                             stripeInfos->at(index).rowIndexBegin,
+                             kernelOptions);
+  emitter.setFusedOp(FUSED_AXPY);
+  emitter.emit();
+}
+
+bool CSRbyNZ::supportsSemiring() {
+  return true;
+}
+
+void CSRbyNZ::emitSemiringFunction(unsigned int index) {
+  X86Assembler assembler(semiringCodeHolders[index]);
+  NZtoRowMap &rowByNZs = rowByNZLists.at(index);
+  CSRbyNZCodeEmitter emitter(&assembler,
+                             &rowByNZs,
+                             stripeInfos->at(index).valIndexBegin,
+                             stripeInfos->at(index).rowIndexBegin,
+                             kernelOptions);
+  emitter.setSemiring(kernelOptions.semiring);
+  emitter.emit();
+}
+
+bool CSRbyNZ::supportsMatrixPowers() {
+  return true;
+}
 
 void CSRbyNZCodeEmitter::emit() {
   emitHeader();
@@ -105,6 +161,18 @@ void CSRbyNZCodeEmitter::emit() {
     emitSingleLoop(rowByNZ.second.getRowIndices()->size(), rowLength);
   }
   
+  emitFooter();
+  emitScalingConstants(assembler, scaling);
+}
+
+void CSRbyNZCodeEmitter::emitSpMM() {
+  emitHeader();
+  
+  for (auto &rowByNZ : *rowByNZs) {
+    unsigned long rowLength = rowByNZ.first;
+    emitSpMMLoop(rowByNZ.second.getRowIndices()->size(), rowLength);
+  }
+  
   emitFooter();
 }
   
@@ -122,6 +190,13 @@ void CSRbyNZCodeEmitter::emitHeader() {
   assembler->lea(rdx, ptr(rdx, (int)(sizeof(int) * baseRowsIndex)));
   assembler->lea(rcx, ptr(rcx, (int)(sizeof(int) * baseValsIndex)));
   assembler->lea(r8, ptr(r8, (int)(sizeof(double) * baseValsIndex)));
+  
+  if (fusedOp == FUSED_AXPY) {
+    // y is the 6th argument.
+    //movq %r9, %r11
+    assembler->mov(r11, r9);
+  }
+  emitFusedOpInit(assembler, fusedOp);
 }
 
 void CSRbyNZCodeEmitter::emitFooter() {
@@ -133,6 +208,7 @@ void CSRbyNZCodeEmitter::emitFooter() {
   assembler->pop(r10);
   assembler->pop(r9);
   assembler->pop(r8);
+  emitFusedOpResult(assembler, fusedOp);
   assembler->ret();
 }
 
@@ -145,33 +221,93 @@ void CSRbyNZCodeEmitter::emitSingleLoop(unsigned long numRows,
   Label loopBegin = assembler->newLabel();
   assembler->bind(loopBegin);
   
-  //xorps %xmm0, %xmm0
-  assembler->xorps(xmm0, xmm0);
+  // Products are spread round-robin over independent accumulators
+  // so that the additions of a long row do not form a single dependency chain.
+  unsigned int numAccumulators = numAccumulatorsForRow(rowLength, options.maxAccumulators);
+  X86Xmm temp = xmm(numAccumulators);
   
   // done for a single row
+  for(int i = 0 ; i < rowLength ; i++){
+    X86Xmm acc = xmm(i % numAccumulators);
+    emitPrefetches(i);
+    //movslq "i*4"(%rcx,%r9,4), %rax
+    assembler->movsxd(rax, ptr(rcx, r9, 2, i * sizeof(int)));
+    if (i < numAccumulators) {
+      // The first product of an accumulator initializes it.
+      emitProduct(acc, i);
+    } else {
+      emitProduct(temp, i);
+      //addsd %xmm"temp", %xmm"acc"
+      emitSemiringAdd(assembler, semiring, acc, temp);
+    }
+  }
+  emitAccumulatorReduce(assembler, numAccumulators, semiring);
+  
+  // movslq (%rdx,%rbx,4), %rax
+  assembler->movsxd(rax, ptr(rdx, rbx, 2));
+  //addq $rowLength, %r9
+  assembler->add(r9, (unsigned int)rowLength);
+  //addq $1, %rbx
+  assembler->inc(rbx);
+  //cmpl numRows, %ebx
+  assembler->cmp(ebx, (unsigned int)numRows);
+  // The update and the fused operation do not change the flags.
+  //addsd (%rsi,%rax,8), %xmm0 ; movsd %xmm0, (%rsi,%rax,8)
+  if (semiring == SEMIRING_PLUS_TIMES)
+    emitRowUpdate(assembler, scaling, ptr(rsi, rax, 3), xmm0, xmm1,
+                  fusedOp, ptr(fusedOp == FUSED_DOT ? rdi : r11, rax, 3));
+  else
+    emitSemiringRowUpdate(assembler, semiring, ptr(rsi, rax, 3), xmm0, xmm1);
+  //jne .LBB0_1
+  assembler->jne(loopBegin);
+  
+  //addq $numRows*4, %rdx
+  assembler->add(rdx, (unsigned int)(numRows * sizeof(int)));
+  //addq $numRows*rowLength*4, %rcx
+  assembler->add(rcx, (unsigned int)(numRows * rowLength * sizeof(int)));
+  //addq $numRows*rowLength*8, %r8
+  assembler->add(r8, (unsigned int)(numRows * rowLength * sizeof(double)));
+}
+
+// Same loop structure as emitSingleLoop, but each value is loaded once
+// and applied to the k entries of a row of V, which are contiguous.
+// The entries of row r start at byte offset r*k*8, kept in %rax.
+void CSRbyNZCodeEmitter::emitSpMMLoop(unsigned long numRows,
+                                      unsigned long rowLength) {
+  unsigned int numVectors = options.numVectors;
+  int rowBlockSize = numVectors * sizeof(double);
+  X86Xmm value = spmmValueRegister(numVectors);
+  
+  assembler->xor_(r9d, r9d);
+  assembler->xor_(ebx, ebx);
+
+  assembler->align(kAlignCode, 16);
+  Label loopBegin = assembler->newLabel();
+  assembler->bind(loopBegin);
+  
   for(int i = 0 ; i < rowLength ; i++){
     //movslq "i*4"(%rcx,%r9,4), %rax
     assembler->movsxd(rax, ptr(rcx, r9, 2, i * sizeof(int)));
-    //movsd "i*8"(%r8,%r9,8), %xmm1
-    assembler->movsd(xmm1, ptr(r8, r9, 3, i * sizeof(double)));
-    //mulsd (%rdi,%rax,8), %xmm1
-    assembler->mulsd(xmm1, ptr(rdi, rax, 3));
-    //addsd %xmm1, %xmm0
-    assembler->addsd(xmm0, xmm1);
+    //imulq $"k*8", %rax
+    assembler->imul(rax, rowBlockSize);
+    //movddup "i*8"(%r8,%r9,8), %xmm"value"
+    assembler->movddup(value, ptr(r8, r9, 3, i * sizeof(double)));
+    emitMultiVectorProduct(assembler, [](int offset) { return ptr(rdi, rax, 0, offset); },
+                           numVectors, i == 0);
   }
   
   // movslq (%rdx,%rbx,4), %rax
   assembler->movsxd(rax, ptr(rdx, rbx, 2));
+  //imulq $"k*8", %rax
+  assembler->imul(rax, rowBlockSize);
+  emitMultiVectorUpdate(assembler, [](int offset) { return ptr(rsi, rax, 0, offset); },
+                        numVectors);
   //addq $rowLength, %r9
   assembler->add(r9, (unsigned int)rowLength);
   //addq $1, %rbx
   assembler->inc(rbx);
-  //addsd (%rsi,%rax,8), %xmm0
-  assembler->addsd(xmm0, ptr(rsi, rax, 3));
   //cmpl numRows, %ebx
   assembler->cmp(ebx, (unsigned int)numRows);
-  //movsd %xmm0, (%rsi,%rax,8)
-  assembler->movsd(ptr(rsi, rax, 3), xmm0);
   //jne .LBB0_1
   assembler->jne(loopBegin);
   
@@ -182,3 +318,43 @@ void CSRbyNZCodeEmitter::emitSingleLoop(unsigned long numRows,
   //addq $numRows*rowLength*8, %r8
   assembler->add(r8, (unsigned int)(numRows * rowLength * sizeof(double)));
 }
+
+void CSRbyNZCodeEmitter::emitProduct(X86Xmm dest, unsigned long elementIndex) {
+  if (semiring == SEMIRING_OR_AND) {
+    // Every stored element is true, so the product is the v element and vals is not read.
+    //movsd (%rdi,%rax,8), %xmm"dest"
+    assembler->movsd(dest, ptr(rdi, rax, 3));
+    return;
+  }
+  //movsd "i*8"(%r8,%r9,8), %xmm"dest"
+  assembler->movsd(dest, ptr(r8, r9, 3, elementIndex * sizeof(double)));
+  if (semiring == SEMIRING_MIN_PLUS) {
+    //addsd (%rdi,%rax,8), %xmm"dest"
+    assembler->addsd(dest, ptr(rdi, rax, 3));
+  } else {
+    //mulsd (%rdi,%rax,8), %xmm"dest"
+    assembler->mulsd(dest, ptr(rdi, rax, 3));
+  }
+}
+
+void CSRbyNZCodeEmitter::emitPrefetches(unsigned long elementIndex) {
+  unsigned int distance = options.getPrefetchDistance();
+  if (distance == 0)
+    return;
+  
+  unsigned long ahead = elementIndex + distance;
+  if (startsCacheLine(elementIndex, sizeof(double))) {
+    //prefetch{t0|nta} "ahead*8"(%r8,%r9,8)
+    emitPrefetch(assembler, ptr(r8, r9, 3, ahead * sizeof(double)), options.nonTemporal);
+  }
+  if (startsCacheLine(elementIndex, sizeof(int))) {
+    //prefetch{t0|nta} "ahead*4"(%rcx,%r9,4)
+    emitPrefetch(assembler, ptr(rcx, r9, 2, ahead * sizeof(int)), options.nonTemporal);
+  }
+  if (options.prefetchIndirect) {
+    //movslq "ahead*4"(%rcx,%r9,4), %r10
+    assembler->movsxd(r10, ptr(rcx, r9, 2, ahead * sizeof(int)));
+    //prefetcht0 (%rdi,%r10,8)
+    emitPrefetch(assembler, ptr(rdi, r10, 3));
+  }
+}
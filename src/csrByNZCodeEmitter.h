@@ -0,0 +1,77 @@
+#ifndef _CSR_BY_NZ_CODE_EMITTER_H_
+#define _CSR_BY_NZ_CODE_EMITTER_H_
+
+#include "method.h"
+#include "emitterUtils.h"
+
+namespace thundercat {
+  ///
+  /// CSRbyNZCodeEmitter:
+  /// Helper class to avoid having to pass several parameters.
+  /// Also used by Unfolding for the rows that do not fit its code budget.
+  ///
+  class CSRbyNZCodeEmitter {
+  public:
+    CSRbyNZCodeEmitter(asmjit::X86Assembler *assembler,
+                       NZtoRowMap *rowByNZs,
+                       unsigned long baseValsIndex,
+                       unsigned long baseRowsIndex,
+                       const KernelOptions &options) {
+      this->assembler = assembler;
+      this->rowByNZs = rowByNZs;
+      this->baseValsIndex = baseValsIndex;
+      this->baseRowsIndex = baseRowsIndex;
+      this->options = options;
+      this->fusedOp = NO_FUSED_OP;
+      this->semiring = SEMIRING_PLUS_TIMES;
+    }
+    
+    void emit();
+    
+    // SpMM code for options.numVectors vectors in row-major blocks
+    void emitSpMM();
+    
+    // Makes emit generate w = alpha·A·v + beta·w instead of w += A·v
+    void setOutputScaling(double alpha, double beta) {
+      scaling.alpha = alpha;
+      scaling.beta = beta;
+      scaling.constants = assembler->newLabel();
+    }
+    
+    // Makes emit generate the code of spmvDot or spmvAxpy (see MultByMDotFun and MultByMAxpyFun)
+    void setFusedOp(FusedOp fusedOp) {
+      this->fusedOp = fusedOp;
+    }
+    
+    // Makes emit generate w = w ⊕ (A ⊗ v) over the given semiring (see SpMVMethod::spmvSemiring)
+    void setSemiring(SemiringKind semiring) {
+      this->semiring = semiring;
+    }
+    
+  private:
+    asmjit::X86Assembler *assembler;
+    NZtoRowMap *rowByNZs;
+    unsigned long baseValsIndex;
+    unsigned long baseRowsIndex;
+    KernelOptions options;
+    OutputScaling scaling;
+    FusedOp fusedOp;
+    SemiringKind semiring;
+    
+    void emitHeader();
+    
+    void emitFooter();
+    
+    void emitSingleLoop(unsigned long numRows, unsigned long rowLength);
+    
+    void emitSpMMLoop(unsigned long numRows, unsigned long rowLength);
+    
+    void emitPrefetches(unsigned long elementIndex);
+    
+    // The product of the element at the given position of the row, whose column is in %rax
+    void emitProduct(asmjit::X86Xmm dest, unsigned long elementIndex);
+    
+  };
+}
+
+#endif
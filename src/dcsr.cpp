@@ -0,0 +1,74 @@
+#include "method.h"
+#include <iostream>
+#include <algorithm>
+
+using namespace thundercat;
+using namespace std;
+
+extern bool __DEBUG__;
+extern bool DUMP_OBJECT;
+
+///
+/// Analysis
+///
+void DCSR::analyzeMatrix() {
+  unsigned long numRows = 0;
+#pragma omp parallel for reduction(+:numRows)
+  for (int rowIndex = 0; rowIndex < csrMatrix->n; ++rowIndex) {
+    if (csrMatrix->rows[rowIndex + 1] > csrMatrix->rows[rowIndex])
+      numRows++;
+  }
+  numNonEmptyRows = numRows;
+
+  if (!__DEBUG__ && !DUMP_OBJECT) {
+    cout << "DCSR: " << numNonEmptyRows << " of " << csrMatrix->n << " rows are non-empty\n";
+  }
+}
+
+///
+/// DCSR
+///
+void DCSR::convertMatrix() {
+  int *rows = new int[2 * numNonEmptyRows + 1];
+  int *offsets = rows;
+  int *rowIndices = rows + numNonEmptyRows + 1;
+
+  unsigned long j = 0;
+  for (unsigned long rowIndex = 0; rowIndex < csrMatrix->n; ++rowIndex) {
+    if (csrMatrix->rows[rowIndex + 1] > csrMatrix->rows[rowIndex]) {
+      offsets[j] = csrMatrix->rows[rowIndex];
+      rowIndices[j] = rowIndex;
+      j++;
+    }
+  }
+  offsets[numNonEmptyRows] = csrMatrix->nz;
+
+  // Split the non-empty rows into partitions of about nz / numPartitions
+  // nonzeros each, independently of where the empty rows are.
+  partitionBegins.resize(numPartitions + 1);
+  for (unsigned int t = 0; t < numPartitions; ++t) {
+    unsigned long valIndex = csrMatrix->nz * t / numPartitions;
+    partitionBegins[t] = lower_bound(offsets, offsets + numNonEmptyRows, (int)valIndex) - offsets;
+  }
+  partitionBegins[numPartitions] = numNonEmptyRows;
+
+  matrix = new Matrix(rows, csrMatrix->cols, csrMatrix->vals, csrMatrix->n, csrMatrix->m, csrMatrix->nz);
+  matrix->numRows = 2 * numNonEmptyRows + 1;
+}
+
+void DCSR::spmv(double* __restrict v, double* __restrict w) {
+  const int *offsets = matrix->rows;
+  const int *rowIndices = matrix->rows + numNonEmptyRows + 1;
+  const int *cols = matrix->cols;
+  const double *vals = matrix->vals;
+#pragma omp parallel for
+  for (unsigned int t = 0; t < numPartitions; t++) {
+    for (unsigned long j = partitionBegins[t]; j < partitionBegins[t + 1]; j++) {
+      double ww = 0.0;
+      for (int k = offsets[j]; k < offsets[j + 1]; k++) {
+        ww += vals[k] * v[cols[k]];
+      }
+      w[rowIndices[j]] += ww;
+    }
+  }
+}
@@ -0,0 +1,75 @@
+#include "denseBlockDetector.h"
+#include <map>
+#include <cmath>
+
+using namespace thundercat;
+using namespace std;
+
+DenseBlockDetector::DenseBlockDetector(Matrix *csrMatrix, double minDensity) {
+  this->csrMatrix = csrMatrix;
+  this->minDensity = minDensity;
+}
+
+vector<DenseBlock> DenseBlockDetector::detect(const MatrixStripeInfo &stripeInfo) {
+  vector<DenseBlock> blocks;
+  // Blocks that may still grow downwards, keyed by their range of tile columns
+  map<pair<unsigned long, unsigned long>, DenseBlock> openBlocks;
+  // Rounded up, so that a tile is dense only at or above the density
+  unsigned long minElementsPerTile = (unsigned long)ceil(minDensity * DENSE_TILE_SIZE * DENSE_TILE_SIZE);
+  
+  for (unsigned long tileRowBegin = stripeInfo.rowIndexBegin;
+       tileRowBegin + DENSE_TILE_SIZE <= stripeInfo.rowIndexEnd;
+       tileRowBegin += DENSE_TILE_SIZE) {
+    // Number of elements of each tile in this tile row
+    map<unsigned long, unsigned long> tileCounts;
+    for (unsigned long rowIndex = tileRowBegin; rowIndex < tileRowBegin + DENSE_TILE_SIZE; ++rowIndex) {
+      for (int k = csrMatrix->rows[rowIndex]; k < csrMatrix->rows[rowIndex+1]; ++k) {
+        tileCounts[csrMatrix->cols[k] / DENSE_TILE_SIZE]++;
+      }
+    }
+    
+    // Segments of consecutive dense tiles; partial tiles at the right edge are never dense
+    map<pair<unsigned long, unsigned long>, DenseBlock> segments;
+    unsigned long numFullTileCols = csrMatrix->m / DENSE_TILE_SIZE;
+    auto it = tileCounts.begin();
+    while (it != tileCounts.end()) {
+      if (it->first >= numFullTileCols || it->second < minElementsPerTile) {
+        it++;
+        continue;
+      }
+      unsigned long segmentBegin = it->first;
+      unsigned long segmentEnd = segmentBegin;
+      while (it != tileCounts.end() && it->first == segmentEnd &&
+             it->first < numFullTileCols && it->second >= minElementsPerTile) {
+        segmentEnd++;
+        it++;
+      }
+      auto key = make_pair(segmentBegin, segmentEnd);
+      auto openIt = openBlocks.find(key);
+      if (openIt != openBlocks.end()) {
+        segments[key] = openIt->second;
+        segments[key].numRows += DENSE_TILE_SIZE;
+        openBlocks.erase(openIt);
+      } else {
+        DenseBlock block;
+        block.rowBegin = tileRowBegin;
+        block.numRows = DENSE_TILE_SIZE;
+        block.colBegin = segmentBegin * DENSE_TILE_SIZE;
+        block.numCols = (segmentEnd - segmentBegin) * DENSE_TILE_SIZE;
+        block.valIndex = 0;
+        segments[key] = block;
+      }
+    }
+    
+    // Blocks that did not continue in this tile row are complete
+    for (auto &openBlock : openBlocks) {
+      blocks.push_back(openBlock.second);
+    }
+    openBlocks.swap(segments);
+  }
+  for (auto &openBlock : openBlocks) {
+    blocks.push_back(openBlock.second);
+  }
+  
+  return blocks;
+}
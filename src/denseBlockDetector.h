@@ -0,0 +1,39 @@
+#ifndef _DENSE_BLOCK_DETECTOR_H_
+#define _DENSE_BLOCK_DETECTOR_H_
+
+#include "matrix.h"
+#include <vector>
+
+// Dense blocks are made of square tiles of this size, which is also their min size.
+#define DENSE_TILE_SIZE 8
+
+namespace thundercat {
+  struct DenseBlock {
+    unsigned long rowBegin;
+    unsigned long numRows;
+    unsigned long colBegin;
+    unsigned long numCols;
+    // Index of the block's values (row-major, with explicit zeros) in the dense values array
+    unsigned long valIndex;
+  };
+  
+  ///
+  /// Finds dense rectangular sub-blocks of a matrix stripe.
+  /// The rows of the stripe are cut into tiles of DENSE_TILE_SIZE x DENSE_TILE_SIZE;
+  /// tiles whose density is at least the threshold are dense. Consecutive dense tiles of
+  /// a tile row form a segment, and identical segments of consecutive tile rows are
+  /// merged into a single block. Blocks do not overlap and do not cross stripe boundaries.
+  ///
+  class DenseBlockDetector {
+  public:
+    DenseBlockDetector(Matrix *csrMatrix, double minDensity);
+    
+    std::vector<DenseBlock> detect(const MatrixStripeInfo &stripeInfo);
+    
+  private:
+    Matrix *csrMatrix;
+    double minDensity;
+  };
+}
+
+#endif
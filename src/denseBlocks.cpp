@@ -0,0 +1,172 @@
+#include "method.h"
+#include "profiler.h"
+#include <emmintrin.h>
+#include <iostream>
+
+using namespace thundercat;
+using namespace std;
+
+extern bool __DEBUG__;
+extern bool DUMP_OBJECT;
+
+DenseBlockSpMV::DenseBlockSpMV(SpMVMethod *method) {
+  this->method = method;
+}
+
+DenseBlockSpMV::~DenseBlockSpMV() {
+  delete[] denseVals;
+  delete method;
+}
+
+///
+/// Analysis
+///
+void DenseBlockSpMV::analyzeMatrix() {
+  denseBlocks.resize(stripeInfos->size());
+  DenseBlockDetector detector(csrMatrix, kernelOptions.denseBlockDensity);
+  
+#pragma omp parallel for
+  for (int threadIndex = 0; threadIndex < stripeInfos->size(); ++threadIndex) {
+    denseBlocks[threadIndex] = detector.detect(stripeInfos->at(threadIndex));
+  }
+}
+
+///
+/// DenseBlockSpMV
+///
+
+// Dense blocks get their values, with explicit zeros; the remaining
+// elements form a CSR matrix that is handed to the wrapped method.
+void DenseBlockSpMV::convertMatrix() {
+  unsigned long n = csrMatrix->n;
+  unsigned long numDenseVals = 0;
+  unsigned long numBlocks = 0;
+  for (auto &blocks : denseBlocks) {
+    for (auto &block : blocks) {
+      block.valIndex = numDenseVals;
+      numDenseVals += block.numRows * block.numCols;
+      numBlocks++;
+    }
+  }
+  denseVals = new double[numDenseVals]();
+  
+  // Column ranges of the blocks that cover each row
+  vector<vector<pair<unsigned long, unsigned long> > > blockColumns(n);
+  for (auto &blocks : denseBlocks) {
+    for (auto &block : blocks) {
+      for (unsigned long r = block.rowBegin; r < block.rowBegin + block.numRows; ++r) {
+        blockColumns[r].push_back(make_pair(block.colBegin, block.colBegin + block.numCols));
+      }
+    }
+  }
+  auto isInDenseBlock = [&blockColumns](int rowIndex, int col) {
+    for (auto &columns : blockColumns[rowIndex]) {
+      if (col >= columns.first && col < columns.second)
+        return true;
+    }
+    return false;
+  };
+  
+  int *rows = new int[n + 1];
+  rows[0] = 0;
+#pragma omp parallel for
+  for (int rowIndex = 0; rowIndex < n; ++rowIndex) {
+    int rowLength = 0;
+    for (int k = csrMatrix->rows[rowIndex]; k < csrMatrix->rows[rowIndex+1]; ++k) {
+      if (!isInDenseBlock(rowIndex, csrMatrix->cols[k]))
+        rowLength++;
+    }
+    rows[rowIndex + 1] = rowLength;
+  }
+  for (unsigned long rowIndex = 0; rowIndex < n; ++rowIndex) {
+    rows[rowIndex + 1] += rows[rowIndex];
+  }
+  
+  unsigned long numRemainderElements = rows[n];
+  int *cols = new int[numRemainderElements];
+  double *vals = new double[numRemainderElements];
+#pragma omp parallel for
+  for (int rowIndex = 0; rowIndex < n; ++rowIndex) {
+    int remainderIndex = rows[rowIndex];
+    for (int k = csrMatrix->rows[rowIndex]; k < csrMatrix->rows[rowIndex+1]; ++k) {
+      if (!isInDenseBlock(rowIndex, csrMatrix->cols[k])) {
+        cols[remainderIndex] = csrMatrix->cols[k];
+        vals[remainderIndex] = csrMatrix->vals[k];
+        remainderIndex++;
+      }
+    }
+  }
+  
+#pragma omp parallel for
+  for (int t = 0; t < denseBlocks.size(); ++t) {
+    for (auto &block : denseBlocks[t]) {
+      for (unsigned long r = 0; r < block.numRows; ++r) {
+        unsigned long rowIndex = block.rowBegin + r;
+        double *blockRow = denseVals + block.valIndex + r * block.numCols;
+        for (int k = csrMatrix->rows[rowIndex]; k < csrMatrix->rows[rowIndex+1]; ++k) {
+          unsigned long col = csrMatrix->cols[k];
+          if (col >= block.colBegin && col < block.colBegin + block.numCols)
+            blockRow[col - block.colBegin] += csrMatrix->vals[k];
+        }
+      }
+    }
+  }
+  
+  if (!__DEBUG__ && !DUMP_OBJECT) {
+    unsigned long numDenseElements = csrMatrix->nz - numRemainderElements;
+    cout << "Dense blocks: " << numBlocks << " blocks hold " << numDenseElements << " of "
+         << csrMatrix->nz << " nonzeros, fill " << (numDenseVals - numDenseElements) * sizeof(double) << " bytes\n";
+  }
+  
+  Matrix *remainder = new Matrix(rows, cols, vals, n, csrMatrix->m, numRemainderElements);
+  KernelOptions remainderOptions = kernelOptions;
+  // The transpose, if specialized, and the CSC copy are built for the whole matrix by this method
+  remainderOptions.specializeTranspose = false;
+  remainderOptions.sparseInput = false;
+  // spmvScaled, the fused operations, spmvPowers and spmvSemiring work on the whole matrix
+  remainderOptions.alpha = 1.0;
+  remainderOptions.beta = 1.0;
+  remainderOptions.fusedOps = false;
+  remainderOptions.matrixPowers = 1;
+  remainderOptions.semiring = SEMIRING_PLUS_TIMES;
+  method->setKernelOptions(remainderOptions);
+  method->init(remainder, numPartitions);
+  method->processMatrix();
+  matrix = method->getMethodSpecificMatrix();
+}
+
+bool DenseBlockSpMV::isSpecializer() {
+  return method->isSpecializer();
+}
+
+void DenseBlockSpMV::emitCode() {
+  method->emitCode();
+}
+
+std::vector<asmjit::CodeHolder*> *DenseBlockSpMV::getCodeHolders() {
+  return method->getCodeHolders();
+}
+
+void DenseBlockSpMV::spmv(double* __restrict v, double* __restrict w) {
+  method->spmv(v, w);
+  
+#pragma omp parallel for
+  for (unsigned int t = 0; t < denseBlocks.size(); t++) {
+    for (auto &block : denseBlocks[t]) {
+      const double *x = v + block.colBegin;
+      for (unsigned long r = 0; r < block.numRows; r++) {
+        const double *blockRow = denseVals + block.valIndex + r * block.numCols;
+        // Two accumulators, each holding two partial sums;
+        // the number of columns is a multiple of the tile size.
+        __m128d sum0 = _mm_setzero_pd();
+        __m128d sum1 = _mm_setzero_pd();
+        for (unsigned long c = 0; c < block.numCols; c += 4) {
+          sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(blockRow + c), _mm_loadu_pd(x + c)));
+          sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(blockRow + c + 2), _mm_loadu_pd(x + c + 2)));
+        }
+        sum0 = _mm_add_pd(sum0, sum1);
+        w[block.rowBegin + r] += _mm_cvtsd_f64(sum0) + _mm_cvtsd_f64(_mm_unpackhi_pd(sum0, sum0));
+      }
+    }
+  }
+}
@@ -0,0 +1,169 @@
+#include "method.h"
+#include <emmintrin.h>
+#include <iostream>
+#include <algorithm>
+
+using namespace thundercat;
+using namespace std;
+
+// A diagonal is stored densely if at least this fraction of its cells are nonzero
+#define DIA_MIN_DIAGONAL_DENSITY 0.5
+#define DIA_MAX_DIAGONALS 64
+// Rows are processed in blocks so that the block of w stays in the cache
+// while all the diagonals are applied to it.
+#define DIA_BLOCK_ROWS 1024
+
+extern bool __DEBUG__;
+extern bool DUMP_OBJECT;
+
+DIA::~DIA() {
+  delete[] diagonals;
+}
+
+///
+/// Analysis
+///
+void DIA::analyzeMatrix() {
+  // Number of nonzeros on each diagonal, i.e. for each offset of the row stencils
+  vector<map<int, unsigned long> > stripeDiagonalCounts(stripeInfos->size());
+
+#pragma omp parallel for
+  for (int threadIndex = 0; threadIndex < stripeInfos->size(); ++threadIndex) {
+    auto &stripeInfo = stripeInfos->at(threadIndex);
+    for (unsigned long rowIndex = stripeInfo.rowIndexBegin; rowIndex < stripeInfo.rowIndexEnd; ++rowIndex) {
+      for (int k = csrMatrix->rows[rowIndex]; k < csrMatrix->rows[rowIndex+1]; ++k) {
+        stripeDiagonalCounts[threadIndex][csrMatrix->cols[k] - (int)rowIndex]++;
+      }
+    }
+  }
+  map<int, unsigned long> diagonalCounts;
+  for (auto &counts : stripeDiagonalCounts) {
+    for (auto &count : counts) {
+      diagonalCounts[count.first] += count.second;
+    }
+  }
+
+  vector<pair<unsigned long, int> > denseDiagonals;
+  for (auto &count : diagonalCounts) {
+    long offset = count.first;
+    long diagonalLength = min((long)csrMatrix->n, (long)csrMatrix->m - offset) - max(0L, -offset);
+    if (count.second >= DIA_MIN_DIAGONAL_DENSITY * diagonalLength) {
+      denseDiagonals.push_back(make_pair(count.second, count.first));
+    }
+  }
+  sort(denseDiagonals.begin(), denseDiagonals.end(), greater<pair<unsigned long, int> >());
+  if (denseDiagonals.size() > DIA_MAX_DIAGONALS) {
+    denseDiagonals.resize(DIA_MAX_DIAGONALS);
+  }
+
+  unsigned long numCoveredElements = 0;
+  diagonalOffsets.clear();
+  for (auto &diagonal : denseDiagonals) {
+    numCoveredElements += diagonal.first;
+    diagonalOffsets.push_back(diagonal.second);
+  }
+  sort(diagonalOffsets.begin(), diagonalOffsets.end());
+
+  double coverage = csrMatrix->nz > 0 ? numCoveredElements / (double)csrMatrix->nz : 0.0;
+  bool useDiagonals = coverage >= kernelOptions.diaCoverageThreshold;
+  if (!__DEBUG__ && !DUMP_OBJECT) {
+    cout << "DIA: " << diagonalOffsets.size() << " dense diagonals cover "
+         << coverage * 100 << "% of the nonzeros";
+    if (!useDiagonals)
+      cout << ", below the threshold; all nonzeros are kept in CSR";
+    cout << "\n";
+  }
+  if (!useDiagonals) {
+    diagonalOffsets.clear();
+  }
+}
+
+///
+/// DIA
+///
+void DIA::convertMatrix() {
+  unsigned long n = csrMatrix->n;
+  unsigned long numDiagonals = diagonalOffsets.size();
+  diagonals = new double[numDiagonals * n]();
+
+  // Index of the stored diagonal of an element, -1 if it is in the CSR remainder
+  auto getDiagonalIndex = [this](int offset) {
+    auto it = lower_bound(diagonalOffsets.begin(), diagonalOffsets.end(), offset);
+    if (it != diagonalOffsets.end() && *it == offset)
+      return (int)(it - diagonalOffsets.begin());
+    return -1;
+  };
+
+  int *rows = new int[n + 1];
+  rows[0] = 0;
+#pragma omp parallel for
+  for (int rowIndex = 0; rowIndex < n; ++rowIndex) {
+    int rowLength = 0;
+    for (int k = csrMatrix->rows[rowIndex]; k < csrMatrix->rows[rowIndex+1]; ++k) {
+      if (getDiagonalIndex(csrMatrix->cols[k] - rowIndex) == -1)
+        rowLength++;
+    }
+    rows[rowIndex + 1] = rowLength;
+  }
+  for (unsigned long rowIndex = 0; rowIndex < n; ++rowIndex) {
+    rows[rowIndex + 1] += rows[rowIndex];
+  }
+
+  unsigned long numRemainderElements = rows[n];
+  int *cols = new int[numRemainderElements];
+  double *vals = new double[numRemainderElements];
+#pragma omp parallel for
+  for (int rowIndex = 0; rowIndex < n; ++rowIndex) {
+    int remainderIndex = rows[rowIndex];
+    for (int k = csrMatrix->rows[rowIndex]; k < csrMatrix->rows[rowIndex+1]; ++k) {
+      int d = getDiagonalIndex(csrMatrix->cols[k] - rowIndex);
+      if (d == -1) {
+        cols[remainderIndex] = csrMatrix->cols[k];
+        vals[remainderIndex] = csrMatrix->vals[k];
+        remainderIndex++;
+      } else {
+        diagonals[d * n + rowIndex] += csrMatrix->vals[k];
+      }
+    }
+  }
+
+  matrix = new Matrix(rows, cols, vals, n, csrMatrix->m, numRemainderElements);
+}
+
+void DIA::spmv(double* __restrict v, double* __restrict w) {
+  const long n = csrMatrix->n;
+  const long m = csrMatrix->m;
+#pragma omp parallel for
+  for (unsigned int t = 0; t < stripeInfos->size(); t++) {
+    long rowIndexBegin = stripeInfos->at(t).rowIndexBegin;
+    long rowIndexEnd = stripeInfos->at(t).rowIndexEnd;
+    for (long blockBegin = rowIndexBegin; blockBegin < rowIndexEnd; blockBegin += DIA_BLOCK_ROWS) {
+      long blockEnd = min(blockBegin + DIA_BLOCK_ROWS, rowIndexEnd);
+
+      // w[i] += d[i] * v[i + offset], with unit stride in all three arrays
+      for (unsigned int d = 0; d < diagonalOffsets.size(); d++) {
+        long offset = diagonalOffsets[d];
+        const double * __restrict diagonal = diagonals + d * n;
+        // Rows whose element on this diagonal is inside the matrix
+        long i = max(blockBegin, -offset);
+        long end = min(blockEnd, m - offset);
+        for (; i + 1 < end; i += 2) {
+          __m128d product = _mm_mul_pd(_mm_loadu_pd(diagonal + i), _mm_loadu_pd(v + i + offset));
+          _mm_storeu_pd(w + i, _mm_add_pd(_mm_loadu_pd(w + i), product));
+        }
+        for (; i < end; i++) {
+          w[i] += diagonal[i] * v[i + offset];
+        }
+      }
+
+      // CSR remainder
+      for (long i = blockBegin; i < blockEnd; i++) {
+        double ww = 0.0;
+        for (int k = matrix->rows[i]; k < matrix->rows[i + 1]; k++) {
+          ww += matrix->vals[k] * v[matrix->cols[k]];
+        }
+        w[i] += ww;
+      }
+    }
+  }
+}
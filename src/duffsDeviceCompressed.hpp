@@ -1,6 +1,7 @@
 #pragma once
 
 #include "method.h"
+#include "streamPrefetcher.h"
 #include <iostream>
 
 using namespace thundercat;
@@ -17,13 +18,23 @@ public:
   DuffsDeviceCompressed();
   
   virtual void spmv(double* __restrict v, double* __restrict w) final;
+  
+  virtual void spmvDot(double* __restrict v, double* __restrict w, double *vDotW) final;
+  
+  virtual void spmvAxpy(double* __restrict v, double* __restrict w, double a, double* __restrict y) final;
+  
+  virtual void spmvSemiring(double* __restrict v, double* __restrict w, SemiringKind semiring) final;
 
 protected:
   virtual void convertMatrix() final;
   
 private:
-  template <typename T>
-  void spmvDD(double* __restrict v, double* __restrict w, T* __restrict rows);
+  // The row loop, for any of the semirings and row updates of method.h
+  template <typename Semiring, typename RowUpdate>
+  void spmvRows(double* __restrict v, RowUpdate update, double *partials);
+  
+  template <typename Semiring, typename T, typename RowUpdate>
+  void spmvDD(double* __restrict v, RowUpdate update, double *partials, T* __restrict rows);
   
 protected:
   int sizeOfRowItem;
@@ -83,30 +94,65 @@ void DuffsDeviceCompressed<UnrollingFactor>::convertMatrix() {
 
 template <unsigned int UnrollingFactor>
 void DuffsDeviceCompressed<UnrollingFactor>::spmv(double* __restrict v, double* __restrict w) {
+  spmvRows<PlusTimesSemiring>(v, AddRowUpdate{w}, NULL);
+}
+
+template <unsigned int UnrollingFactor>
+void DuffsDeviceCompressed<UnrollingFactor>::spmvDot(double* __restrict v, double* __restrict w, double *vDotW) {
+  stripePartials.resize(stripeInfos->size());
+  spmvRows<PlusTimesSemiring>(v, DotRowUpdate{w, v}, stripePartials.data());
+  *vDotW = sumStripePartials();
+}
+
+template <unsigned int UnrollingFactor>
+void DuffsDeviceCompressed<UnrollingFactor>::spmvAxpy(double* __restrict v, double* __restrict w, double a, double* __restrict y) {
+  spmvRows<PlusTimesSemiring>(v, AxpyRowUpdate{w, a, y}, NULL);
+}
+
+template <unsigned int UnrollingFactor>
+void DuffsDeviceCompressed<UnrollingFactor>::spmvSemiring(double* __restrict v, double* __restrict w, SemiringKind semiring) {
+  dispatchSemiring(semiring, [&](auto semiringOps) {
+    typedef decltype(semiringOps) Semiring;
+    spmvRows<Semiring>(v, SemiringRowUpdate<Semiring>{w}, NULL);
+  });
+}
+
+template <unsigned int UnrollingFactor>
+template <typename Semiring, typename RowUpdate>
+void DuffsDeviceCompressed<UnrollingFactor>::spmvRows(double* __restrict v, RowUpdate update, double *partials) {
   const int *rows = matrix->rows;
   switch(sizeOfRowItem) {
   case 1:
-    spmvDD(v, w, (unsigned char *)rows); break;
+    spmvDD<Semiring>(v, update, partials, (unsigned char *)rows); break;
   case 2:
-    spmvDD(v, w, (unsigned short *)rows); break;
+    spmvDD<Semiring>(v, update, partials, (unsigned short *)rows); break;
   default:
-    spmvDD(v, w, (unsigned int *)rows); break;
+    spmvDD<Semiring>(v, update, partials, (unsigned int *)rows); break;
   }
 }
 
 template <>
-template <typename T>
-void DuffsDeviceCompressed<4>::spmvDD(double* __restrict v, double* __restrict w, T* __restrict rows) {
+template <typename Semiring, typename T, typename RowUpdate>
+void DuffsDeviceCompressed<4>::spmvDD(double* __restrict v, RowUpdate update, double *partials, T* __restrict rows) {
+  const bool nonTemporal = kernelOptions.nonTemporal;
+  const unsigned int prefetchDistance = kernelOptions.getPrefetchDistance();
 #pragma omp parallel for
   for (unsigned int t = 0; t < stripeInfos->size(); t++) {
     int rowIndexBegin = stripeInfos->at(t).rowIndexBegin;
     int rowIndexEnd = stripeInfos->at(t).rowIndexEnd;
+    double partial = 0.0;
     int *cols = matrix->cols + stripeInfos->at(t).valIndexBegin;
     double *vals = matrix->vals + stripeInfos->at(t).valIndexBegin;
-    T *rowPtr = rows;
+    T *rowPtr = rows + 2 * rowIndexBegin;
+    StreamPrefetcher<double> valsPrefetcher(vals, prefetchDistance);
+    StreamPrefetcher<int> colsPrefetcher(cols, prefetchDistance);
     
     for (int i = rowIndexBegin; i < rowIndexEnd; i++) {
-      double sum = 0.0;
+      if (nonTemporal) {
+        valsPrefetcher.advance(vals);
+        colsPrefetcher.advance(cols);
+      }
+      double sum = Semiring::zero();
       T n = *rowPtr;
       rowPtr++;
       const T entrancePoint = *rowPtr;
@@ -118,36 +164,47 @@ void DuffsDeviceCompressed<4>::spmvDD(double* __restrict v, double* __restrict w
       switch (entrancePoint) {
           do {
             vals += 4; cols += 4;
-            sum += vals[-4] * v[cols[-4]];
+            sum = Semiring::addProduct(sum, vals[-4], v[cols[-4]]);
           case 3:
-            sum += vals[-3] * v[cols[-3]];
+            sum = Semiring::addProduct(sum, vals[-3], v[cols[-3]]);
           case 2:
-            sum += vals[-2] * v[cols[-2]];
+            sum = Semiring::addProduct(sum, vals[-2], v[cols[-2]]);
           case 1:
-            sum += vals[-1] * v[cols[-1]];
+            sum = Semiring::addProduct(sum, vals[-1], v[cols[-1]]);
           case 0:
             ;
           }
           while (n-- > 0);
       }
-      w[i] += sum;
+      partial += update(i, sum);
     }
+    if (partials)
+      partials[t] = partial;
   }
 }
 
 template <>
-template <typename T>
-void DuffsDeviceCompressed<8>::spmvDD(double* __restrict v, double* __restrict w, T* __restrict rows) {
+template <typename Semiring, typename T, typename RowUpdate>
+void DuffsDeviceCompressed<8>::spmvDD(double* __restrict v, RowUpdate update, double *partials, T* __restrict rows) {
+  const bool nonTemporal = kernelOptions.nonTemporal;
+  const unsigned int prefetchDistance = kernelOptions.getPrefetchDistance();
 #pragma omp parallel for
   for (unsigned int t = 0; t < stripeInfos->size(); t++) {
     int rowIndexBegin = stripeInfos->at(t).rowIndexBegin;
     int rowIndexEnd = stripeInfos->at(t).rowIndexEnd;
+    double partial = 0.0;
     int *cols = matrix->cols + stripeInfos->at(t).valIndexBegin;
     double *vals = matrix->vals + stripeInfos->at(t).valIndexBegin;
-    T *rowPtr = rows;
+    T *rowPtr = rows + 2 * rowIndexBegin;
+    StreamPrefetcher<double> valsPrefetcher(vals, prefetchDistance);
+    StreamPrefetcher<int> colsPrefetcher(cols, prefetchDistance);
     
     for (int i = rowIndexBegin; i < rowIndexEnd; i++) {
-      double sum = 0.0;
+      if (nonTemporal) {
+        valsPrefetcher.advance(vals);
+        colsPrefetcher.advance(cols);
+      }
+      double sum = Semiring::zero();
       T n = *rowPtr;
       rowPtr++;
       const T entrancePoint = *rowPtr;
@@ -159,44 +216,55 @@ void DuffsDeviceCompressed<8>::spmvDD(double* __restrict v, double* __restrict w
       switch (entrancePoint) {
           do {
             vals += 8; cols += 8;
-            sum += vals[-8] * v[cols[-8]];
+            sum = Semiring::addProduct(sum, vals[-8], v[cols[-8]]);
           case 7:
-            sum += vals[-7] * v[cols[-7]];
+            sum = Semiring::addProduct(sum, vals[-7], v[cols[-7]]);
           case 6:
-            sum += vals[-6] * v[cols[-6]];
+            sum = Semiring::addProduct(sum, vals[-6], v[cols[-6]]);
           case 5:
-            sum += vals[-5] * v[cols[-5]];
+            sum = Semiring::addProduct(sum, vals[-5], v[cols[-5]]);
           case 4:
-            sum += vals[-4] * v[cols[-4]];
+            sum = Semiring::addProduct(sum, vals[-4], v[cols[-4]]);
           case 3:
-            sum += vals[-3] * v[cols[-3]];
+            sum = Semiring::addProduct(sum, vals[-3], v[cols[-3]]);
           case 2:
-            sum += vals[-2] * v[cols[-2]];
+            sum = Semiring::addProduct(sum, vals[-2], v[cols[-2]]);
           case 1:
-            sum += vals[-1] * v[cols[-1]];
+            sum = Semiring::addProduct(sum, vals[-1], v[cols[-1]]);
           case 0:
             ;
           }
           while (n-- > 0);
       }
-      w[i] += sum;
+      partial += update(i, sum);
     }
+    if (partials)
+      partials[t] = partial;
   }
 }
 
 template <>
-template <typename T>
-void DuffsDeviceCompressed<16>::spmvDD(double* __restrict v, double* __restrict w, T* __restrict rows) {
+template <typename Semiring, typename T, typename RowUpdate>
+void DuffsDeviceCompressed<16>::spmvDD(double* __restrict v, RowUpdate update, double *partials, T* __restrict rows) {
+  const bool nonTemporal = kernelOptions.nonTemporal;
+  const unsigned int prefetchDistance = kernelOptions.getPrefetchDistance();
 #pragma omp parallel for
   for (unsigned int t = 0; t < stripeInfos->size(); t++) {
     int rowIndexBegin = stripeInfos->at(t).rowIndexBegin;
     int rowIndexEnd = stripeInfos->at(t).rowIndexEnd;
+    double partial = 0.0;
     int *cols = matrix->cols + stripeInfos->at(t).valIndexBegin;
     double *vals = matrix->vals + stripeInfos->at(t).valIndexBegin;
-    T *rowPtr = rows;
+    T *rowPtr = rows + 2 * rowIndexBegin;
+    StreamPrefetcher<double> valsPrefetcher(vals, prefetchDistance);
+    StreamPrefetcher<int> colsPrefetcher(cols, prefetchDistance);
     
     for (int i = rowIndexBegin; i < rowIndexEnd; i++) {
-      double sum = 0.0;
+      if (nonTemporal) {
+        valsPrefetcher.advance(vals);
+        colsPrefetcher.advance(cols);
+      }
+      double sum = Semiring::zero();
       T n = *rowPtr;
       rowPtr++;
       const T entrancePoint = *rowPtr;
@@ -208,60 +276,71 @@ void DuffsDeviceCompressed<16>::spmvDD(double* __restrict v, double* __restrict
       switch (entrancePoint) {
           do {
             vals += 16; cols += 16;
-            sum += vals[-16] * v[cols[-16]];
+            sum = Semiring::addProduct(sum, vals[-16], v[cols[-16]]);
           case 15:
-            sum += vals[-15] * v[cols[-15]];
+            sum = Semiring::addProduct(sum, vals[-15], v[cols[-15]]);
           case 14:
-            sum += vals[-14] * v[cols[-14]];
+            sum = Semiring::addProduct(sum, vals[-14], v[cols[-14]]);
           case 13:
-            sum += vals[-13] * v[cols[-13]];
+            sum = Semiring::addProduct(sum, vals[-13], v[cols[-13]]);
           case 12:
-            sum += vals[-12] * v[cols[-12]];
+            sum = Semiring::addProduct(sum, vals[-12], v[cols[-12]]);
           case 11:
-            sum += vals[-11] * v[cols[-11]];
+            sum = Semiring::addProduct(sum, vals[-11], v[cols[-11]]);
           case 10:
-            sum += vals[-10] * v[cols[-10]];
+            sum = Semiring::addProduct(sum, vals[-10], v[cols[-10]]);
           case 9:
-            sum += vals[-9] * v[cols[-9]];
+            sum = Semiring::addProduct(sum, vals[-9], v[cols[-9]]);
           case 8:
-            sum += vals[-8] * v[cols[-8]];
+            sum = Semiring::addProduct(sum, vals[-8], v[cols[-8]]);
           case 7:
-            sum += vals[-7] * v[cols[-7]];
+            sum = Semiring::addProduct(sum, vals[-7], v[cols[-7]]);
           case 6:
-            sum += vals[-6] * v[cols[-6]];
+            sum = Semiring::addProduct(sum, vals[-6], v[cols[-6]]);
           case 5:
-            sum += vals[-5] * v[cols[-5]];
+            sum = Semiring::addProduct(sum, vals[-5], v[cols[-5]]);
           case 4:
-            sum += vals[-4] * v[cols[-4]];
+            sum = Semiring::addProduct(sum, vals[-4], v[cols[-4]]);
           case 3:
-            sum += vals[-3] * v[cols[-3]];
+            sum = Semiring::addProduct(sum, vals[-3], v[cols[-3]]);
           case 2:
-            sum += vals[-2] * v[cols[-2]];
+            sum = Semiring::addProduct(sum, vals[-2], v[cols[-2]]);
           case 1:
-            sum += vals[-1] * v[cols[-1]];
+            sum = Semiring::addProduct(sum, vals[-1], v[cols[-1]]);
           case 0:
             ;
           }
           while (n-- > 0);
       }
-      w[i] += sum;
+      partial += update(i, sum);
     }
+    if (partials)
+      partials[t] = partial;
   }
 }
 
 template <>
-template <typename T>
-void DuffsDeviceCompressed<32>::spmvDD(double* __restrict v, double* __restrict w, T* __restrict rows) {
+template <typename Semiring, typename T, typename RowUpdate>
+void DuffsDeviceCompressed<32>::spmvDD(double* __restrict v, RowUpdate update, double *partials, T* __restrict rows) {
+  const bool nonTemporal = kernelOptions.nonTemporal;
+  const unsigned int prefetchDistance = kernelOptions.getPrefetchDistance();
 #pragma omp parallel for
   for (unsigned int t = 0; t < stripeInfos->size(); t++) {
     int rowIndexBegin = stripeInfos->at(t).rowIndexBegin;
     int rowIndexEnd = stripeInfos->at(t).rowIndexEnd;
+    double partial = 0.0;
     int *cols = matrix->cols + stripeInfos->at(t).valIndexBegin;
     double *vals = matrix->vals + stripeInfos->at(t).valIndexBegin;
-    T *rowPtr = rows;
+    T *rowPtr = rows + 2 * rowIndexBegin;
+    StreamPrefetcher<double> valsPrefetcher(vals, prefetchDistance);
+    StreamPrefetcher<int> colsPrefetcher(cols, prefetchDistance);
     
     for (int i = rowIndexBegin; i < rowIndexEnd; i++) {
-      double sum = 0.0;
+      if (nonTemporal) {
+        valsPrefetcher.advance(vals);
+        colsPrefetcher.advance(cols);
+      }
+      double sum = Semiring::zero();
       T n = *rowPtr;
       rowPtr++;
       const T entrancePoint = *rowPtr;
@@ -273,75 +352,77 @@ void DuffsDeviceCompressed<32>::spmvDD(double* __restrict v, double* __restrict
       switch (entrancePoint) {
           do {
             vals += 32; cols += 32;
-            sum += vals[-32] * v[cols[-32]];
+            sum = Semiring::addProduct(sum, vals[-32], v[cols[-32]]);
           case 31:
-            sum += vals[-31] * v[cols[-31]];
+            sum = Semiring::addProduct(sum, vals[-31], v[cols[-31]]);
           case 30:
-            sum += vals[-30] * v[cols[-30]];
+            sum = Semiring::addProduct(sum, vals[-30], v[cols[-30]]);
           case 29:
-            sum += vals[-29] * v[cols[-29]];
+            sum = Semiring::addProduct(sum, vals[-29], v[cols[-29]]);
           case 28:
-            sum += vals[-28] * v[cols[-28]];
+            sum = Semiring::addProduct(sum, vals[-28], v[cols[-28]]);
           case 27:
-            sum += vals[-27] * v[cols[-27]];
+            sum = Semiring::addProduct(sum, vals[-27], v[cols[-27]]);
           case 26:
-            sum += vals[-26] * v[cols[-26]];
+            sum = Semiring::addProduct(sum, vals[-26], v[cols[-26]]);
           case 25:
-            sum += vals[-25] * v[cols[-25]];
+            sum = Semiring::addProduct(sum, vals[-25], v[cols[-25]]);
           case 24:
-            sum += vals[-24] * v[cols[-24]];
+            sum = Semiring::addProduct(sum, vals[-24], v[cols[-24]]);
           case 23:
-            sum += vals[-23] * v[cols[-23]];
+            sum = Semiring::addProduct(sum, vals[-23], v[cols[-23]]);
           case 22:
-            sum += vals[-22] * v[cols[-22]];
+            sum = Semiring::addProduct(sum, vals[-22], v[cols[-22]]);
           case 21:
-            sum += vals[-21] * v[cols[-21]];
+            sum = Semiring::addProduct(sum, vals[-21], v[cols[-21]]);
           case 20:
-            sum += vals[-20] * v[cols[-20]];
+            sum = Semiring::addProduct(sum, vals[-20], v[cols[-20]]);
           case 19:
-            sum += vals[-19] * v[cols[-19]];
+            sum = Semiring::addProduct(sum, vals[-19], v[cols[-19]]);
           case 18:
-            sum += vals[-18] * v[cols[-18]];
+            sum = Semiring::addProduct(sum, vals[-18], v[cols[-18]]);
           case 17:
-            sum += vals[-17] * v[cols[-17]];
+            sum = Semiring::addProduct(sum, vals[-17], v[cols[-17]]);
           case 16:
-            sum += vals[-16] * v[cols[-16]];
+            sum = Semiring::addProduct(sum, vals[-16], v[cols[-16]]);
           case 15:
-            sum += vals[-15] * v[cols[-15]];
+            sum = Semiring::addProduct(sum, vals[-15], v[cols[-15]]);
           case 14:
-            sum += vals[-14] * v[cols[-14]];
+            sum = Semiring::addProduct(sum, vals[-14], v[cols[-14]]);
           case 13:
-            sum += vals[-13] * v[cols[-13]];
+            sum = Semiring::addProduct(sum, vals[-13], v[cols[-13]]);
           case 12:
-            sum += vals[-12] * v[cols[-12]];
+            sum = Semiring::addProduct(sum, vals[-12], v[cols[-12]]);
           case 11:
-            sum += vals[-11] * v[cols[-11]];
+            sum = Semiring::addProduct(sum, vals[-11], v[cols[-11]]);
           case 10:
-            sum += vals[-10] * v[cols[-10]];
+            sum = Semiring::addProduct(sum, vals[-10], v[cols[-10]]);
           case 9:
-            sum += vals[-9] * v[cols[-9]];
+            sum = Semiring::addProduct(sum, vals[-9], v[cols[-9]]);
           case 8:
-            sum += vals[-8] * v[cols[-8]];
+            sum = Semiring::addProduct(sum, vals[-8], v[cols[-8]]);
           case 7:
-            sum += vals[-7] * v[cols[-7]];
+            sum = Semiring::addProduct(sum, vals[-7], v[cols[-7]]);
           case 6:
-            sum += vals[-6] * v[cols[-6]];
+            sum = Semiring::addProduct(sum, vals[-6], v[cols[-6]]);
           case 5:
-            sum += vals[-5] * v[cols[-5]];
+            sum = Semiring::addProduct(sum, vals[-5], v[cols[-5]]);
           case 4:
-            sum += vals[-4] * v[cols[-4]];
+            sum = Semiring::addProduct(sum, vals[-4], v[cols[-4]]);
           case 3:
-            sum += vals[-3] * v[cols[-3]];
+            sum = Semiring::addProduct(sum, vals[-3], v[cols[-3]]);
           case 2:
-            sum += vals[-2] * v[cols[-2]];
+            sum = Semiring::addProduct(sum, vals[-2], v[cols[-2]]);
           case 1:
-            sum += vals[-1] * v[cols[-1]];
+            sum = Semiring::addProduct(sum, vals[-1], v[cols[-1]]);
           case 0:
             ;
           }
           while (n-- > 0);
       }
-      w[i] += sum;
+      partial += update(i, sum);
     }
+    if (partials)
+      partials[t] = partial;
   }
 }
@@ -0,0 +1,254 @@
+#include "emitterUtils.h"
+
+using namespace thundercat;
+using namespace asmjit;
+using namespace x86;
+
+unsigned int thundercat::numAccumulatorsForRow(unsigned long rowLength, unsigned int maxAccumulators) {
+  unsigned long numAccumulators = rowLength / MIN_ACCUMULATOR_CHAIN_LENGTH;
+  if (numAccumulators > maxAccumulators)
+    numAccumulators = maxAccumulators;
+  if (numAccumulators > MAX_ACCUMULATORS)
+    numAccumulators = MAX_ACCUMULATORS;
+  if (numAccumulators < 1)
+    numAccumulators = 1;
+  return numAccumulators;
+}
+
+void thundercat::emitAccumulatorReduce(X86Assembler *assembler, unsigned int numAccumulators,
+                                       SemiringKind semiring) {
+  for (unsigned int inc = 1; inc < numAccumulators; inc *= 2) {
+    for (unsigned int i = 0; i + inc < numAccumulators; i += inc * 2) {
+      //  addsd %xmm(i+inc), %xmm(i), or the semiring's addition
+      emitSemiringAdd(assembler, semiring, xmm(i), xmm(i + inc));
+    }
+  }
+}
+
+void thundercat::emitSemiringAdd(X86Assembler *assembler, SemiringKind semiring, X86Xmm dest, X86Xmm src) {
+  switch (semiring) {
+    case SEMIRING_MIN_PLUS:
+      //  minsd %xmm"src", %xmm"dest"
+      assembler->minsd(dest, src);
+      break;
+    case SEMIRING_MAX_TIMES:
+      //  maxsd %xmm"src", %xmm"dest"
+      assembler->maxsd(dest, src);
+      break;
+    case SEMIRING_OR_AND:
+      //  orpd %xmm"src", %xmm"dest"
+      assembler->orpd(dest, src);
+      break;
+    default:
+      //  addsd %xmm"src", %xmm"dest"
+      assembler->addsd(dest, src);
+      break;
+  }
+}
+
+// minsd and maxsd take a memory operand, orpd would read 16 bytes from it.
+void thundercat::emitSemiringRowUpdate(X86Assembler *assembler, SemiringKind semiring,
+                                       const X86Mem &w, X86Xmm sum, X86Xmm temp) {
+  if (semiring == SEMIRING_MIN_PLUS) {
+    //  minsd "w", %xmm"sum"
+    assembler->minsd(sum, w);
+  } else if (semiring == SEMIRING_MAX_TIMES) {
+    //  maxsd "w", %xmm"sum"
+    assembler->maxsd(sum, w);
+  } else if (semiring == SEMIRING_OR_AND) {
+    //  movsd "w", %xmm"temp"
+    assembler->movsd(temp, w);
+    //  orpd %xmm"temp", %xmm"sum"
+    assembler->orpd(sum, temp);
+  } else {
+    //  addsd "w", %xmm"sum"
+    assembler->addsd(sum, w);
+  }
+  //  movsd %xmm"sum", "w"
+  assembler->movsd(w, sum);
+}
+
+bool thundercat::startsCacheLine(unsigned long elementIndex, unsigned int elementSize) {
+  return (elementIndex * elementSize) % CACHE_LINE_SIZE == 0;
+}
+
+void thundercat::emitPrefetch(X86Assembler *assembler, const X86Mem &mem, bool nonTemporal) {
+  if (nonTemporal) {
+    //  prefetchnta "mem"
+    assembler->prefetchnta(mem);
+  } else {
+    //  prefetcht0 "mem"
+    assembler->prefetcht0(mem);
+  }
+}
+
+X86Xmm thundercat::spmmValueRegister(unsigned int numVectors) {
+  return xmm((numVectors + 1) / 2 + 1);
+}
+
+// Entries are processed in pairs with packed instructions;
+// the last entry of an odd k with scalar ones.
+void thundercat::emitMultiVectorProduct(X86Assembler *assembler, RowEntriesFun vEntries,
+                                        unsigned int numVectors, bool first) {
+  unsigned int numPairs = (numVectors + 1) / 2;
+  X86Xmm temp = xmm(numPairs);
+  X86Xmm value = spmmValueRegister(numVectors);
+  for (unsigned int p = 0; p < numPairs; p++) {
+    X86Xmm acc = xmm(p);
+    X86Xmm dest = first ? acc : temp;
+    if (2 * p + 1 < numVectors) {
+      //  movupd "16*p"(V), %xmm"dest"
+      assembler->movupd(dest, vEntries(16 * p));
+      //  mulpd %xmm"value", %xmm"dest"
+      assembler->mulpd(dest, value);
+      if (!first) {
+        //  addpd %xmm"temp", %xmm"acc"
+        assembler->addpd(acc, temp);
+      }
+    } else {
+      //  movsd "16*p"(V), %xmm"dest"
+      assembler->movsd(dest, vEntries(16 * p));
+      //  mulsd %xmm"value", %xmm"dest"
+      assembler->mulsd(dest, value);
+      if (!first) {
+        //  addsd %xmm"temp", %xmm"acc"
+        assembler->addsd(acc, temp);
+      }
+    }
+  }
+}
+
+void thundercat::emitMultiVectorUpdate(X86Assembler *assembler, RowEntriesFun wEntries,
+                                       unsigned int numVectors) {
+  unsigned int numPairs = (numVectors + 1) / 2;
+  X86Xmm temp = xmm(numPairs);
+  for (unsigned int p = 0; p < numPairs; p++) {
+    X86Xmm acc = xmm(p);
+    if (2 * p + 1 < numVectors) {
+      //  movupd "16*p"(W), %xmm"temp"
+      assembler->movupd(temp, wEntries(16 * p));
+      //  addpd %xmm"temp", %xmm"acc"
+      assembler->addpd(acc, temp);
+      //  movupd %xmm"acc", "16*p"(W)
+      assembler->movupd(wEntries(16 * p), acc);
+    } else {
+      //  addsd "16*p"(W), %xmm"acc"
+      assembler->addsd(acc, wEntries(16 * p));
+      //  movsd %xmm"acc", "16*p"(W)
+      assembler->movsd(wEntries(16 * p), acc);
+    }
+  }
+}
+
+bool thundercat::needsScalingConstants(const OutputScaling &scaling) {
+  return scaling.alpha != 1.0 || (scaling.beta != 0.0 && scaling.beta != 1.0);
+}
+
+void thundercat::emitRowUpdate(X86Assembler *assembler, const OutputScaling &scaling,
+                               const X86Mem &w, X86Xmm sum, X86Xmm temp,
+                               FusedOp fusedOp, const X86Mem &fusedEntry) {
+  if (scaling.alpha != 1.0) {
+    //  mulsd ALPHA, %xmm"sum"
+    assembler->mulsd(sum, ptr(scaling.constants));
+  }
+  if (scaling.beta == 1.0) {
+    //  addsd "w", %xmm"sum"
+    assembler->addsd(sum, w);
+  } else if (scaling.beta != 0.0) {
+    //  movsd "w", %xmm"temp"
+    assembler->movsd(temp, w);
+    //  mulsd BETA, %xmm"temp"
+    assembler->mulsd(temp, ptr(scaling.constants, 16));
+    //  addsd %xmm"temp", %xmm"sum"
+    assembler->addsd(sum, temp);
+  }
+  //  movsd %xmm"sum", "w"
+  assembler->movsd(w, sum);
+  if (fusedOp == FUSED_DOT) {
+    //  mulsd "v", %xmm"sum"
+    assembler->mulsd(sum, fusedEntry);
+    //  addsd %xmm"sum", %xmm15
+    assembler->addsd(xmm15, sum);
+  } else if (fusedOp == FUSED_AXPY) {
+    //  mulsd %xmm15, %xmm"sum"
+    assembler->mulsd(sum, xmm15);
+    //  addsd "y", %xmm"sum"
+    assembler->addsd(sum, fusedEntry);
+    //  movsd %xmm"sum", "y"
+    assembler->movsd(fusedEntry, sum);
+  }
+}
+
+void thundercat::emitPackedRowUpdate(X86Assembler *assembler, const OutputScaling &scaling,
+                                     const X86Mem &w, X86Xmm sums, X86Xmm temp,
+                                     FusedOp fusedOp, const X86Mem &fusedEntry) {
+  if (scaling.alpha != 1.0) {
+    //  mulpd ALPHA, %xmm"sums"
+    assembler->mulpd(sums, ptr(scaling.constants));
+  }
+  if (scaling.beta != 0.0) {
+    // w may be unaligned, so it is loaded into a register first.
+    //  movupd "w", %xmm"temp"
+    assembler->movupd(temp, w);
+    if (scaling.beta != 1.0) {
+      //  mulpd BETA, %xmm"temp"
+      assembler->mulpd(temp, ptr(scaling.constants, 16));
+    }
+    //  addpd %xmm"temp", %xmm"sums"
+    assembler->addpd(sums, temp);
+  }
+  //  movupd %xmm"sums", "w"
+  assembler->movupd(w, sums);
+  if (fusedOp == FUSED_DOT) {
+    // The dot product is kept in the low lane of %xmm15 only.
+    //  movupd "v", %xmm"temp"
+    assembler->movupd(temp, fusedEntry);
+    //  mulpd %xmm"sums", %xmm"temp"
+    assembler->mulpd(temp, sums);
+    //  addsd %xmm"temp", %xmm15
+    assembler->addsd(xmm15, temp);
+    //  unpckhpd %xmm"temp", %xmm"temp"
+    assembler->unpckhpd(temp, temp);
+    //  addsd %xmm"temp", %xmm15
+    assembler->addsd(xmm15, temp);
+  } else if (fusedOp == FUSED_AXPY) {
+    //  movddup %xmm15, %xmm"temp"
+    assembler->movddup(temp, xmm15);
+    //  mulpd %xmm"temp", %xmm"sums"
+    assembler->mulpd(sums, temp);
+    //  movupd "y", %xmm"temp"
+    assembler->movupd(temp, fusedEntry);
+    //  addpd %xmm"temp", %xmm"sums"
+    assembler->addpd(sums, temp);
+    //  movupd %xmm"sums", "y"
+    assembler->movupd(fusedEntry, sums);
+  }
+}
+
+void thundercat::emitFusedOpInit(X86Assembler *assembler, FusedOp fusedOp) {
+  if (fusedOp == FUSED_DOT) {
+    //  xorps %xmm15, %xmm15
+    assembler->xorps(xmm15, xmm15);
+  } else if (fusedOp == FUSED_AXPY) {
+    //  movsd %xmm0, %xmm15
+    assembler->movsd(xmm15, xmm0);
+  }
+}
+
+void thundercat::emitFusedOpResult(X86Assembler *assembler, FusedOp fusedOp) {
+  if (fusedOp == FUSED_DOT) {
+    //  movsd %xmm15, %xmm0
+    assembler->movsd(xmm0, xmm15);
+  }
+}
+
+void thundercat::emitScalingConstants(X86Assembler *assembler, const OutputScaling &scaling) {
+  if (!needsScalingConstants(scaling))
+    return;
+  assembler->align(kAlignData, 16);
+  assembler->bind(scaling.constants);
+  assembler->embed(&scaling.alpha, sizeof(double));
+  assembler->embed(&scaling.alpha, sizeof(double));
+  assembler->embed(&scaling.beta, sizeof(double));
+  assembler->embed(&scaling.beta, sizeof(double));
+}
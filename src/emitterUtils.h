@@ -0,0 +1,104 @@
+#ifndef _EMITTER_UTILS_H_
+#define _EMITTER_UTILS_H_
+
+#include "method.h"
+#include "asmjit/asmjit.h"
+#include <functional>
+
+// Accumulators live in %xmm0..%xmm7.
+// The register right after the last accumulator is free to be used as a temporary.
+#define MAX_ACCUMULATORS 8
+// Minimum number of products each accumulator should receive.
+// Shorter chains do not hide the addsd latency and only add to the reduction.
+#define MIN_ACCUMULATOR_CHAIN_LENGTH 3
+// Prefetches are issued once per cache line of a stream.
+#define CACHE_LINE_SIZE 64
+// SpMM code keeps the k entries of a row of W in pairs in %xmm0..%xmm7,
+// followed by a temporary and the broadcast matrix value.
+#define MAX_SPMM_VECTORS 16
+
+namespace thundercat {
+  ///
+  /// Helpers shared by the code emitters of the specializers.
+  ///
+  
+  // Number of accumulators to split a row of the given length into
+  unsigned int numAccumulatorsForRow(unsigned long rowLength, unsigned int maxAccumulators);
+  
+  // Sum %xmm0..%xmm"numAccumulators-1" into %xmm0 using a reduction tree,
+  // with the addition of the given semiring
+  void emitAccumulatorReduce(asmjit::X86Assembler *assembler, unsigned int numAccumulators,
+                             SemiringKind semiring = SEMIRING_PLUS_TIMES);
+  
+  // dest = dest ⊕ src: addsd, minsd, maxsd, or orpd, which is exact on 0 and 1
+  void emitSemiringAdd(asmjit::X86Assembler *assembler, SemiringKind semiring,
+                       asmjit::X86Xmm dest, asmjit::X86Xmm src);
+  
+  // w = w ⊕ sum for the row at w. temp is clobbered.
+  void emitSemiringRowUpdate(asmjit::X86Assembler *assembler, SemiringKind semiring,
+                             const asmjit::X86Mem &w, asmjit::X86Xmm sum, asmjit::X86Xmm temp);
+  
+  // Whether the element at the given position of an unrolled body
+  // is the first one of its cache line
+  bool startsCacheLine(unsigned long elementIndex, unsigned int elementSize);
+  
+  // Prefetch the cache line that contains the given address.
+  // Non-temporal prefetches are meant for data that is read only once.
+  void emitPrefetch(asmjit::X86Assembler *assembler, const asmjit::X86Mem &mem, bool nonTemporal = false);
+  
+  // Memory operand of the entries of a row of a row-major vector block, at the given byte offset
+  typedef std::function<asmjit::X86Mem(int)> RowEntriesFun;
+  
+  // Register that holds the matrix value broadcast to both lanes in SpMM code
+  asmjit::X86Xmm spmmValueRegister(unsigned int numVectors);
+  
+  // Multiply the k entries of a row of V by the broadcast value and add them to the
+  // accumulators of the k entries of a row of W. The first product initializes them.
+  void emitMultiVectorProduct(asmjit::X86Assembler *assembler, RowEntriesFun vEntries,
+                              unsigned int numVectors, bool first);
+  
+  // Add the accumulators to the k entries of a row of W
+  void emitMultiVectorUpdate(asmjit::X86Assembler *assembler, RowEntriesFun wEntries,
+                             unsigned int numVectors);
+  
+  // Vector operation fused into the update of w (see SpMVMethod::spmvDot and spmvAxpy).
+  // The generated code keeps the dot product, or a, in %xmm15.
+  enum FusedOp { NO_FUSED_OP, FUSED_DOT, FUSED_AXPY };
+  
+  // Scaling of the output of generated SpMV code, w = alpha·A·v + beta·w.
+  // alpha = beta = 1 is the usual w += A·v. Other values are read from
+  // constants embedded after the function (see emitScalingConstants).
+  struct OutputScaling {
+    double alpha = 1.0;
+    double beta = 1.0;
+    asmjit::Label constants;
+  };
+  
+  // Whether the updates read alpha or beta from the constants
+  bool needsScalingConstants(const OutputScaling &scaling);
+  
+  // w = alpha * sum + beta * w for the row at w. With beta = 0, w is stored
+  // without being read; with alpha = 1, the sum is not multiplied. temp is clobbered.
+  // A fused operation then uses the new w and fusedEntry, the row's entry of v for
+  // FUSED_DOT and of y for FUSED_AXPY; sum is clobbered too. The flags are kept.
+  void emitRowUpdate(asmjit::X86Assembler *assembler, const OutputScaling &scaling,
+                     const asmjit::X86Mem &w, asmjit::X86Xmm sum, asmjit::X86Xmm temp,
+                     FusedOp fusedOp = NO_FUSED_OP, const asmjit::X86Mem &fusedEntry = asmjit::X86Mem());
+  
+  // The same for two consecutive rows, whose sums are the lanes of sums
+  void emitPackedRowUpdate(asmjit::X86Assembler *assembler, const OutputScaling &scaling,
+                           const asmjit::X86Mem &w, asmjit::X86Xmm sums, asmjit::X86Xmm temp,
+                           FusedOp fusedOp = NO_FUSED_OP, const asmjit::X86Mem &fusedEntry = asmjit::X86Mem());
+  
+  // Clears %xmm15 for FUSED_DOT, or copies a, the first FP argument, into it for FUSED_AXPY
+  void emitFusedOpInit(asmjit::X86Assembler *assembler, FusedOp fusedOp);
+  
+  // Moves the partial dot product of FUSED_DOT into %xmm0, the return value
+  void emitFusedOpResult(asmjit::X86Assembler *assembler, FusedOp fusedOp);
+  
+  // alpha and beta, each stored twice in a 16-byte aligned slot so that packed
+  // instructions can use them as memory operands. Emits nothing if they are not used.
+  void emitScalingConstants(asmjit::X86Assembler *assembler, const OutputScaling &scaling);
+}
+
+#endif
@@ -1,4 +1,7 @@
 #include "method.h"
+#include "emitterUtils.h"
+#include "blockSizeSelector.h"
+#include "patternMerger.h"
 #include <iostream>
 #include <bitset>
 
@@ -7,25 +10,37 @@ using namespace std;
 using namespace asmjit;
 using namespace x86;
 
+extern bool __DEBUG__;
+extern bool DUMP_OBJECT;
+extern std::string BLOCKING_PROFILE_FILE;
+
 ///
 /// Analysis
 ///
 struct BlockInfo {
-  bitset<32> pattern;
+  BlockPattern pattern;
   vector<double> vals;
 };
 
 void GenOSKI::analyzeMatrix() {
+  if (b_r == 0) {
+    BlockingProfile *profile = BlockingProfile::loadOrMeasure(BLOCKING_PROFILE_FILE);
+    BlockSizeSelector selector(csrMatrix, profile);
+    selector.selectBlockSize(b_r, b_c);
+    delete profile;
+    if (!__DEBUG__ && !DUMP_OBJECT)
+      cout << "GenOSKIAuto block size = " << b_r << "x" << b_c << "\n";
+  }
+  
   groupByBlockPatternMaps.resize(stripeInfos->size());
   numBlocks.resize(stripeInfos->size());
   
 #pragma omp parallel for
   for (int threadIndex = 0; threadIndex < stripeInfos->size(); ++threadIndex) {
     auto &stripeInfo = stripeInfos->at(threadIndex);
+    // Blocks of the current block row, by block column. Only the blocks that
+    // have elements are kept, so memory does not grow with the number of columns.
     map<int, BlockInfo> currentBlockRowPatternsAndElements;
-    vector<BlockInfo> blockPatterns;
-    blockPatterns.resize(csrMatrix->m / b_c + 1);
-    vector<int> indicesOfDetectedBlockColumns;
     
     for (unsigned long rowIndex = stripeInfo.rowIndexBegin; rowIndex < stripeInfo.rowIndexEnd; ++rowIndex) {
       int rowStart = csrMatrix->rows[rowIndex];
@@ -36,28 +51,101 @@ void GenOSKI::analyzeMatrix() {
         int row = rowIndex;
         int blockCol = col/b_c;
         unsigned int elementPosition = (row % b_r) * b_c + (col % b_c);
-        blockPatterns[blockCol].pattern.set(elementPosition);
-        blockPatterns[blockCol].vals.reserve(b_r * b_c);
-        blockPatterns[blockCol].vals.push_back(csrMatrix->vals[k]);
-        indicesOfDetectedBlockColumns.push_back(blockCol);
+        BlockInfo &block = currentBlockRowPatternsAndElements[blockCol];
+        block.pattern.set(elementPosition);
+        block.vals.push_back(csrMatrix->vals[k]);
       }
       if ((rowIndex % b_r) == b_r - 1 || rowIndex == stripeInfo.rowIndexEnd - 1) {
-        for (auto &blockIndex : indicesOfDetectedBlockColumns) {
-          if (blockPatterns[blockIndex].pattern.count() > 0) {
-            auto patternInfo = &(groupByBlockPatternMaps[threadIndex][blockPatterns[blockIndex].pattern.to_ulong()]);
-            blockPatterns[blockIndex].pattern.reset();
-            
-            patternInfo->first.push_back(pair<int,int>(rowIndex/b_r, blockIndex));
-            vector<double> &vals = patternInfo->second;
-            vals.insert(vals.end(), blockPatterns[blockIndex].vals.begin(), blockPatterns[blockIndex].vals.end());
-            blockPatterns[blockIndex].vals.clear();
-            numBlocks[threadIndex] += 1;
+        for (auto &blockInfo : currentBlockRowPatternsAndElements) {
+          auto patternInfo = &(groupByBlockPatternMaps[threadIndex][blockInfo.second.pattern.to_ullong()]);
+          
+          patternInfo->first.push_back(pair<int,int>(rowIndex/b_r, blockInfo.first));
+          vector<double> &vals = patternInfo->second;
+          vals.insert(vals.end(), blockInfo.second.vals.begin(), blockInfo.second.vals.end());
+          numBlocks[threadIndex] += 1;
+        }
+        currentBlockRowPatternsAndElements.clear();
+      }
+    }
+  }
+  
+  if (kernelOptions.mergeTargetLoopCount > 0)
+    mergePatterns();
+}
+
+// Cells of a block pattern, in the order the block values are stored
+static vector<int> getCells(const BlockPattern &pattern) {
+  vector<int> cells;
+  for (int i = 0; i < MAX_BLOCK_CELLS; ++i)
+    if (pattern[i])
+      cells.push_back(i);
+  return cells;
+}
+
+void GenOSKI::mergePatterns() {
+  vector<PatternMergeStats> stats(stripeInfos->size());
+  
+#pragma omp parallel for
+  for (int threadIndex = 0; threadIndex < stripeInfos->size(); ++threadIndex) {
+    auto &stripeInfo = stripeInfos->at(threadIndex);
+    GroupByBlockPatternMap &patternMap = groupByBlockPatternMaps[threadIndex];
+    PatternMerger merger(kernelOptions.mergeTargetLoopCount, kernelOptions.mergeFillBudget);
+    for (auto &patternInfo : patternMap) {
+      // A merged pattern must not reach the rows of another stripe
+      // or the columns past the end of the matrix.
+      BlockPattern allowedCells;
+      allowedCells.set();
+      for (auto &blockIdx : patternInfo.second.first) {
+        for (unsigned int cell = 0; cell < b_r * b_c; ++cell) {
+          unsigned long row = blockIdx.first * b_r + cell / b_c;
+          unsigned long col = blockIdx.second * b_c + cell % b_c;
+          if (row < stripeInfo.rowIndexBegin || row >= stripeInfo.rowIndexEnd || col >= csrMatrix->m)
+            allowedCells.reset(cell);
+        }
+      }
+      merger.addPattern(getCells(BlockPattern(patternInfo.first)), patternInfo.second.first.size(),
+                        [allowedCells](const vector<int> &cells) {
+        for (int cell : cells)
+          if (!allowedCells[cell])
+            return false;
+        return true;
+      });
+    }
+    vector<vector<int> > mergedPatterns = merger.merge(stripeInfo.valIndexEnd - stripeInfo.valIndexBegin);
+    
+    GroupByBlockPatternMap mergedPatternMap;
+    unsigned int i = 0;
+    for (auto &patternInfo : patternMap) {
+      vector<int> cells = getCells(BlockPattern(patternInfo.first));
+      vector<int> &mergedCells = mergedPatterns[i++];
+      BlockPattern mergedPattern;
+      for (int cell : mergedCells)
+        mergedPattern.set(cell);
+      
+      auto &mergedInfo = mergedPatternMap[mergedPattern.to_ullong()];
+      auto &blocks = patternInfo.second.first;
+      mergedInfo.first.insert(mergedInfo.first.end(), blocks.begin(), blocks.end());
+      // Expand the values of each block to the merged pattern, with zeros for the new cells
+      vector<double> &vals = patternInfo.second.second;
+      for (unsigned long b = 0; b < blocks.size(); ++b) {
+        auto valIt = vals.begin() + b * cells.size();
+        auto cellIt = cells.begin();
+        for (int cell : mergedCells) {
+          if (cellIt != cells.end() && *cellIt == cell) {
+            mergedInfo.second.push_back(*valIt++);
+            cellIt++;
+          } else {
+            mergedInfo.second.push_back(0.0);
           }
         }
-        indicesOfDetectedBlockColumns.clear();
       }
     }
+    patternMap.swap(mergedPatternMap);
+    stats[threadIndex] = merger.getStats();
   }
+  
+  if (!__DEBUG__ && !DUMP_OBJECT)
+    PatternMerger::printReport(stats);
 }
 
 
@@ -66,10 +154,20 @@ void GenOSKI::analyzeMatrix() {
 ///
 
 GenOSKI::GenOSKI(unsigned int b_r, unsigned int b_c) {
+  if (b_r < 1 || b_c < 1 || b_r * b_c > MAX_BLOCK_CELLS) {
+    std::cerr << "GenOSKI block size " << b_r << "x" << b_c << " is not supported; "
+              << "a block can have at most " << MAX_BLOCK_CELLS << " cells.\n";
+    exit(1);
+  }
   this->b_r = b_r;
   this->b_c = b_c;
 }
 
+GenOSKI::GenOSKI() {
+  this->b_r = 0;
+  this->b_c = 0;
+}
+
 void GenOSKI::convertMatrix() {
   unsigned int numTotalBlocks = 0;
   vector<unsigned int> blockBaseIndices;
@@ -78,16 +176,32 @@ void GenOSKI::convertMatrix() {
     numTotalBlocks += n;
   }
   
+  // Merged patterns store explicit zeros, so the stripes
+  // may not start at their CSR indices in the vals array.
+  unsigned long numVals = 0;
+  valBaseIndices.clear();
+  for (auto &blockPatterns : groupByBlockPatternMaps) {
+    valBaseIndices.push_back(numVals);
+    for (auto &patternInfo : blockPatterns) {
+      numVals += patternInfo.second.second.size();
+    }
+  }
+  
   int *rows = new int[numTotalBlocks];
-  int *cols = new int[numTotalBlocks];
-  double *vals = new double[csrMatrix->nz];
+  // cols is padded so that the indirect prefetches of the last blocks
+  // do not read past the end of the array.
+  int *cols = new int[numTotalBlocks + kernelOptions.getPrefetchDistance()];
+  double *vals = new double[numVals];
+  for (unsigned int i = 0; i < kernelOptions.getPrefetchDistance(); i++) {
+    cols[numTotalBlocks + i] = 0;
+  }
   
 #pragma omp parallel for
   for (int t = 0; t < stripeInfos->size(); ++t) {
     auto &blockPatterns = groupByBlockPatternMaps.at(t);
     int *rowsPtr = rows + blockBaseIndices[t];
     int *colsPtr = cols + blockBaseIndices[t];
-    double *valsPtr = vals + stripeInfos->at(t).valIndexBegin;
+    double *valsPtr = vals + valBaseIndices[t];
     
     //Build rows cols vals for the new Matrix
     for (auto &patternInfo : blockPatterns) {
@@ -104,7 +218,7 @@ void GenOSKI::convertMatrix() {
   matrix = new Matrix(rows, cols, vals, csrMatrix->n, csrMatrix->m, csrMatrix->nz);
   matrix->numRows = numTotalBlocks;
   matrix->numCols = numTotalBlocks;
-  matrix->numVals = csrMatrix->nz;
+  matrix->numVals = numVals;
 }
 
 ///
@@ -118,17 +232,22 @@ public:
                      unsigned long baseValsIndex,
                      unsigned long baseBlockIndex,
                      unsigned int b_r,
-                     unsigned int b_c) {
+                     unsigned int b_c,
+                     const KernelOptions &options) {
     this->assembler = assembler;
     this->patternMap = patternMap;
     this->baseValsIndex = baseValsIndex;
     this->baseBlockIndex = baseBlockIndex;
     this->b_r = b_r;
     this->b_c = b_c;
+    this->options = options;
   }
   
   void emit();
   
+  // SpMM code for options.numVectors vectors in row-major blocks
+  void emitSpMM();
+  
 private:
   X86Assembler *assembler;
   GroupByBlockPatternMap *patternMap;
@@ -136,12 +255,27 @@ private:
   unsigned long baseBlockIndex;
   unsigned int b_r;
   unsigned int b_c;
+  KernelOptions options;
   
   void emitHeader();
   
   void emitFooter();
   
-  void emitSingleLoop(bitset<32> &patternBits, unsigned int numBlocks);
+  void emitSingleLoop(BlockPattern &patternBits, unsigned int numBlocks);
+  
+  // The SpMM counterpart of emitSingleLoop
+  void emitSpMMLoop(BlockPattern &patternBits, unsigned int numBlocks);
+  
+  // Returns the number of values of the block
+  int emitPackedBlockRows(map<int, vector<int> > &patternLocs);
+  
+  void emitPackedBlockRow(vector<int> &cols, int valIndex, X86Xmm acc);
+  
+  void emitBlockRowStore(int row, X86Xmm acc);
+  
+  void emitBlockRowPairStore(int row, X86Xmm acc, X86Xmm nextAcc);
+  
+  void emitValsPrefetches(int valIndex, int count);
 };
 
 void GenOSKI::emitMultByMFunction(unsigned int index) {
@@ -156,18 +290,43 @@ void GenOSKI::emitMultByMFunction(unsigned int index) {
   GroupByBlockPatternMap &patternMap = groupByBlockPatternMaps.at(index);
   GenOSKICodeEmitter emitter(&assembler,
                              &patternMap,
-                             stripeInfos->at(index).valIndexBegin,
+                             valBaseIndices[index],
                              blockBaseIndices[index],
                              b_r,
-                             b_c);
+                             b_c,
+                             kernelOptions);
   emitter.emit();
 }
 
+bool GenOSKI::supportsSpMM() {
+  return true;
+}
+
+void GenOSKI::emitSpMMFunction(unsigned int index) {
+  unsigned int numTotalBlocks = 0;
+  vector<unsigned int> blockBaseIndices;
+  for (auto n : numBlocks) {
+    blockBaseIndices.push_back(numTotalBlocks);
+    numTotalBlocks += n;
+  }
+  
+  X86Assembler assembler(spmmCodeHolders[index]);
+  GroupByBlockPatternMap &patternMap = groupByBlockPatternMaps.at(index);
+  GenOSKICodeEmitter emitter(&assembler,
+                             &patternMap,
+                             valBaseIndices[index],
+                             blockBaseIndices[index],
+                             b_r,
+                             b_c,
+                             kernelOptions);
+  emitter.emitSpMM();
+}
+
 void GenOSKICodeEmitter::emit() {
   emitHeader();
   
   for (auto &pattern : *patternMap) {
-    bitset<32> patternBits(pattern.first);
+    BlockPattern patternBits(pattern.first);
     unsigned int numBlocks = pattern.second.first.size();
     emitSingleLoop(patternBits, numBlocks);
   }
@@ -175,6 +334,18 @@ void GenOSKICodeEmitter::emit() {
   emitFooter();
 }
 
+void GenOSKICodeEmitter::emitSpMM() {
+  emitHeader();
+  
+  for (auto &pattern : *patternMap) {
+    BlockPattern patternBits(pattern.first);
+    unsigned int numBlocks = pattern.second.first.size();
+    emitSpMMLoop(patternBits, numBlocks);
+  }
+  
+  emitFooter();
+}
+
 void GenOSKICodeEmitter::emitHeader() {
   // rows is in %rdx, cols is in %rcx, vals is in %r8
   assembler->push(r11);
@@ -204,7 +375,7 @@ void GenOSKICodeEmitter::emitFooter() {
   assembler->ret();
 }
 
-void GenOSKICodeEmitter::emitSingleLoop(bitset<32> &patternBits, unsigned int numBlocks) {
+void GenOSKICodeEmitter::emitSingleLoop(BlockPattern &patternBits, unsigned int numBlocks) {
   int size = b_r * b_c;
   // xorl %eax, %eax
   assembler->xor_(eax, eax);
@@ -225,6 +396,20 @@ void GenOSKICodeEmitter::emitSingleLoop(bitset<32> &patternBits, unsigned int nu
   assembler->movsxd(rdx, ptr(r8, rax, 2));
   
   int nz = patternBits.count(); // nz elements per pattern
+  
+  if (options.getPrefetchDistance() > 0) {
+    // The distance is given in nonzeros; convert it to blocks of this pattern.
+    int blocksAhead = (options.getPrefetchDistance() + nz - 1) / nz;
+    // prefetch{t0|nta} "blocksAhead*4"(%r9,%rax,4) ## cols1[a + blocksAhead]
+    emitPrefetch(assembler, ptr(r9, rax, 2, blocksAhead * sizeof(int)), options.nonTemporal);
+    if (options.prefetchIndirect) {
+      // movslq "blocksAhead*4"(%r9,%rax,4), %rbx
+      assembler->movsxd(rbx, ptr(r9, rax, 2, blocksAhead * sizeof(int)));
+      // prefetcht0 (%rdi,%rbx,8) ## v + cols1[a + blocksAhead]
+      emitPrefetch(assembler, ptr(rdi, rbx, 3));
+    }
+  }
+  
   //startingMMElements simulation <row, Cols>
   map<int, vector<int> > patternLocs;
   for (int j = 0; j < size; ++j)
@@ -232,30 +417,94 @@ void GenOSKICodeEmitter::emitSingleLoop(bitset<32> &patternBits, unsigned int nu
       patternLocs[j / b_c].push_back(j % b_c);
   
   int bb = 0;
-  for (auto &nz : patternLocs) {
-    int row = nz.first;
-    vector<int> cols = nz.second;
-    vector<int>::iterator colsIt = cols.begin(), colsEnd = cols.end();
-    // movsd "col*8"(%rdi,%rcx,8), %xmm0 ## v + cols1[a] + col = vv[col]
-    assembler->movsd(xmm0, ptr(rdi, rcx, 3, (*colsIt++) * sizeof(double)));
-    // mulsd "b*8"(%r11,%rbx,8), %xmm0      ## vv[col] * mvalues1[b + some k]
-    assembler->mulsd(xmm0, ptr(r11, (bb++) * sizeof(double)));
+  if (options.packedBlocks) {
+    bb = emitPackedBlockRows(patternLocs);
+  } else {
+    for (auto &nz : patternLocs) {
+      int row = nz.first;
+      vector<int> cols = nz.second;
+      vector<int>::iterator colsIt = cols.begin(), colsEnd = cols.end();
+      emitValsPrefetches(bb, cols.size());
+      // movsd "col*8"(%rdi,%rcx,8), %xmm0 ## v + cols1[a] + col = vv[col]
+      assembler->movsd(xmm0, ptr(rdi, rcx, 3, (*colsIt++) * sizeof(double)));
+      // mulsd "b*8"(%r11,%rbx,8), %xmm0      ## vv[col] * mvalues1[b + some k]
+      assembler->mulsd(xmm0, ptr(r11, (bb++) * sizeof(double)));
       
-    if (cols.size() > 1) {
-      for (; colsIt != colsEnd; ++colsIt) {
-        // movsd "col*8"(%rdi,%rcx,8), %xmm1 ## v + cols1[a] + col = vv[col]
-        assembler->movsd(xmm1, ptr(rdi, rcx, 3, (*colsIt) * sizeof(double)));
-        // mulsd "b*8"(%r11,%rbx, 8), %xmm1      ## vv[col] * mvalues1[b + some k]
-        assembler->mulsd(xmm1, ptr(r11, (bb++) * sizeof(double)));
-        // addsd %xmm1, %xmm0
-        assembler->addsd(xmm0, xmm1);
+      if (cols.size() > 1) {
+        for (; colsIt != colsEnd; ++colsIt) {
+          // movsd "col*8"(%rdi,%rcx,8), %xmm1 ## v + cols1[a] + col = vv[col]
+          assembler->movsd(xmm1, ptr(rdi, rcx, 3, (*colsIt) * sizeof(double)));
+          // mulsd "b*8"(%r11,%rbx, 8), %xmm1      ## vv[col] * mvalues1[b + some k]
+          assembler->mulsd(xmm1, ptr(r11, (bb++) * sizeof(double)));
+          // addsd %xmm1, %xmm0
+          assembler->addsd(xmm0, xmm1);
+        }
       }
-    }
       
-    // addsd "row*8"(%rsi,%rdx,8), %xmm0
-    assembler->addsd(xmm0, ptr(rsi, rdx, 3, row * 8));
-    // movsd %xmm0, "row*8"(%rsi, %rdx, 8)
-    assembler->movsd(ptr(rsi, rdx, 3, row * 8), xmm0);
+      // addsd "row*8"(%rsi,%rdx,8), %xmm0
+      assembler->addsd(xmm0, ptr(rsi, rdx, 3, row * 8));
+      // movsd %xmm0, "row*8"(%rsi, %rdx, 8)
+      assembler->movsd(ptr(rsi, rdx, 3, row * 8), xmm0);
+    }
+  }
+  assembler->lea(r11, ptr(r11, sizeof(double) * bb));
+  // addq $1, %rax
+  assembler->inc(rax);
+  // cmpl $"numBlocks", %eax
+  assembler->cmp(eax, numBlocks);
+  // jne LBB*_*
+  assembler->jne(loopStart);
+  
+  assembler->lea(r8, ptr(r8, sizeof(int) * numBlocks));
+  assembler->lea(r9, ptr(r9, sizeof(int) * numBlocks));
+}
+
+
+// Same loop structure as emitSingleLoop, but each value is broadcast once
+// and applied to the k entries of a row of V, which are contiguous.
+// %rcx and %rdx hold the byte offsets of the first column and row of the block.
+void GenOSKICodeEmitter::emitSpMMLoop(BlockPattern &patternBits, unsigned int numBlocks) {
+  unsigned int numVectors = options.numVectors;
+  int rowBlockSize = numVectors * sizeof(double);
+  X86Xmm value = spmmValueRegister(numVectors);
+  int size = b_r * b_c;
+  // xorl %eax, %eax
+  assembler->xor_(eax, eax);
+  //.align 16, 0x90
+  assembler->align(kAlignCode, 16);
+  
+  Label loopStart = assembler->newLabel();
+  assembler->bind(loopStart);
+  
+  // movslq (%r9,%rax,4), %rcx ## cols1[a]
+  assembler->movsxd(rcx, ptr(r9, rax, 2));
+  // imulq $"k*8", %rcx
+  assembler->imul(rcx, rowBlockSize);
+  // movslq (%r8,%rax,4), %rdx ## rows1[a]
+  assembler->movsxd(rdx, ptr(r8, rax, 2));
+  // imulq $"k*8", %rdx
+  assembler->imul(rdx, rowBlockSize);
+  
+  map<int, vector<int> > patternLocs;
+  for (int j = 0; j < size; ++j)
+    if (patternBits[j] == 1)
+      patternLocs[j / b_c].push_back(j % b_c);
+  
+  int bb = 0;
+  for (auto &nz : patternLocs) {
+    int row = nz.first;
+    vector<int> &cols = nz.second;
+    emitValsPrefetches(bb, cols.size());
+    for (unsigned int i = 0; i < cols.size(); ++i) {
+      int colOffset = cols[i] * rowBlockSize;
+      // movddup "b*8"(%r11), %xmm"value"
+      assembler->movddup(value, ptr(r11, (bb++) * sizeof(double)));
+      emitMultiVectorProduct(assembler, [colOffset](int offset) { return ptr(rdi, rcx, 0, colOffset + offset); },
+                             numVectors, i == 0);
+    }
+    int rowOffset = row * rowBlockSize;
+    emitMultiVectorUpdate(assembler, [rowOffset](int offset) { return ptr(rsi, rdx, 0, rowOffset + offset); },
+                          numVectors);
   }
   assembler->lea(r11, ptr(r11, sizeof(double) * bb));
   // addq $1, %rax
@@ -269,3 +518,108 @@ void GenOSKICodeEmitter::emitSingleLoop(bitset<32> &patternBits, unsigned int nu
   assembler->lea(r9, ptr(r9, sizeof(int) * numBlocks));
 }
 
+
+///
+/// Packed blocks:
+/// Adjacent columns of a block row are multiplied two at a time with
+/// mulpd. Each block row is summed in a packed accumulator that is reduced
+/// only at the end of the block row; consecutive block rows are reduced
+/// together with haddpd and written to w with a single packed store.
+///
+int GenOSKICodeEmitter::emitPackedBlockRows(map<int, vector<int> > &patternLocs) {
+  int bb = 0;
+  // A block row waiting for its successor, so that both are stored together
+  bool hasPendingRow = false;
+  int pendingRow = 0;
+  int pendingAccIndex = 0;
+  
+  for (auto &nz : patternLocs) {
+    int row = nz.first;
+    vector<int> &cols = nz.second;
+    // %xmm0 and %xmm1 alternate so that the pending accumulator is kept
+    int accIndex = hasPendingRow ? 1 - pendingAccIndex : 0;
+    
+    emitValsPrefetches(bb, cols.size());
+    emitPackedBlockRow(cols, bb, xmm(accIndex));
+    bb += cols.size();
+    
+    if (hasPendingRow && pendingRow + 1 == row) {
+      emitBlockRowPairStore(pendingRow, xmm(pendingAccIndex), xmm(accIndex));
+      hasPendingRow = false;
+    } else {
+      if (hasPendingRow)
+        emitBlockRowStore(pendingRow, xmm(pendingAccIndex));
+      hasPendingRow = true;
+      pendingRow = row;
+      pendingAccIndex = accIndex;
+    }
+  }
+  if (hasPendingRow)
+    emitBlockRowStore(pendingRow, xmm(pendingAccIndex));
+  
+  return bb;
+}
+
+void GenOSKICodeEmitter::emitPackedBlockRow(vector<int> &cols, int valIndex, X86Xmm acc) {
+  bool first = true;
+  for (unsigned int i = 0; i < cols.size(); ) {
+    // The first product goes directly into the accumulator.
+    X86Xmm product = first ? acc : xmm2;
+    if (i + 1 < cols.size() && cols[i + 1] == cols[i] + 1) {
+      // movupd "col*8"(%rdi,%rcx,8), %xmm"product" ## vv[col], vv[col+1]
+      assembler->movupd(product, ptr(rdi, rcx, 3, cols[i] * sizeof(double)));
+      // movupd "b*8"(%r11), %xmm3
+      assembler->movupd(xmm3, ptr(r11, valIndex * sizeof(double)));
+      // mulpd %xmm3, %xmm"product"
+      assembler->mulpd(product, xmm3);
+      i += 2;
+      valIndex += 2;
+    } else {
+      // Loading with movsd clears the upper lane, so the product can be added as a pair.
+      // movsd "col*8"(%rdi,%rcx,8), %xmm"product" ## vv[col]
+      assembler->movsd(product, ptr(rdi, rcx, 3, cols[i] * sizeof(double)));
+      // mulsd "b*8"(%r11), %xmm"product"
+      assembler->mulsd(product, ptr(r11, valIndex * sizeof(double)));
+      i += 1;
+      valIndex += 1;
+    }
+    if (!first) {
+      // addpd %xmm2, %xmm"acc"
+      assembler->addpd(acc, xmm2);
+    }
+    first = false;
+  }
+}
+
+void GenOSKICodeEmitter::emitBlockRowStore(int row, X86Xmm acc) {
+  // haddpd %xmm"acc", %xmm"acc"
+  assembler->haddpd(acc, acc);
+  // addsd "row*8"(%rsi,%rdx,8), %xmm"acc"
+  assembler->addsd(acc, ptr(rsi, rdx, 3, row * sizeof(double)));
+  // movsd %xmm"acc", "row*8"(%rsi,%rdx,8)
+  assembler->movsd(ptr(rsi, rdx, 3, row * sizeof(double)), acc);
+}
+
+void GenOSKICodeEmitter::emitBlockRowPairStore(int row, X86Xmm acc, X86Xmm nextAcc) {
+  // haddpd %xmm"nextAcc", %xmm"acc" ## sum(row), sum(row+1)
+  assembler->haddpd(acc, nextAcc);
+  // movupd "row*8"(%rsi,%rdx,8), %xmm2
+  assembler->movupd(xmm2, ptr(rsi, rdx, 3, row * sizeof(double)));
+  // addpd %xmm"acc", %xmm2
+  assembler->addpd(xmm2, acc);
+  // movupd %xmm2, "row*8"(%rsi,%rdx,8)
+  assembler->movupd(ptr(rsi, rdx, 3, row * sizeof(double)), xmm2);
+}
+
+void GenOSKICodeEmitter::emitValsPrefetches(int valIndex, int count) {
+  if (options.getPrefetchDistance() == 0)
+    return;
+  
+  // Prefetch the vals lines that a block row crosses into
+  for (int b = valIndex; b < valIndex + count; ++b) {
+    if (startsCacheLine(b, sizeof(double))) {
+      // prefetch{t0|nta} "(b+distance)*8"(%r11)
+      emitPrefetch(assembler, ptr(r11, (b + options.getPrefetchDistance()) * sizeof(double)), options.nonTemporal);
+    }
+  }
+}
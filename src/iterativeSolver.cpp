@@ -0,0 +1,259 @@
+#include "iterativeSolver.h"
+#include <chrono>
+#include <cmath>
+
+using namespace thundercat;
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static long long microsecondsSince(Clock::time_point start) {
+  return chrono::duration_cast<chrono::microseconds>(Clock::now() - start).count();
+}
+
+IterativeSolver::IterativeSolver(SpMVMethod *method, unsigned long n, double tolerance, unsigned int maxIters) {
+  this->method = method;
+  this->n = n;
+  this->tolerance = tolerance;
+  this->maxIters = maxIters;
+  r = new double[n];
+  p = new double[n];
+  q = new double[n];
+  s = new double[n];
+  t = new double[n];
+  rHat = new double[n];
+}
+
+IterativeSolver::~IterativeSolver() {
+  delete[] r;
+  delete[] p;
+  delete[] q;
+  delete[] s;
+  delete[] t;
+  delete[] rHat;
+}
+
+///
+/// Operator and vector operations
+///
+
+// The methods compute w += A·v. The ones with a beta = 0 kernel (see main) store
+// w = A·v directly; for the others, w is cleared first, which is timed separately.
+void IterativeSolver::multiply(double *v, double *w) {
+  if (method->hasScaledKernel(1.0, 0.0)) {
+    auto start = Clock::now();
+    method->spmvScaled(v, w, 1.0, 0.0);
+    spmvTime += microsecondsSince(start);
+    return;
+  }
+  clear(w);
+  auto start = Clock::now();
+  method->spmv(v, w);
+  spmvTime += microsecondsSince(start);
+}
+
+double IterativeSolver::multiplyDot(double *v, double *w) {
+  clear(w);
+  auto start = Clock::now();
+  double vDotW;
+  method->spmvDot(v, w, &vDotW);
+  spmvTime += microsecondsSince(start);
+  return vDotW;
+}
+
+void IterativeSolver::clear(double *w) {
+  auto start = Clock::now();
+#pragma omp parallel for
+  for (long i = 0; i < n; i++) {
+    w[i] = 0.0;
+  }
+  clearTime += microsecondsSince(start);
+}
+
+double IterativeSolver::dot(const double *x, const double *y) {
+  double sum = 0.0;
+#pragma omp parallel for reduction(+:sum)
+  for (long i = 0; i < n; i++) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+void IterativeSolver::computeResidual(const double *b, double *x, double *r) {
+  multiply(x, q);
+#pragma omp parallel for
+  for (long i = 0; i < n; i++) {
+    r[i] = b[i] - q[i];
+  }
+}
+
+///
+/// Conjugate gradient
+///
+SolverStats IterativeSolver::conjugateGradient(const double *b, double *x) {
+  SolverStats stats;
+  spmvTime = 0;
+  clearTime = 0;
+  auto start = Clock::now();
+
+  double bNorm = sqrt(dot(b, b));
+  computeResidual(b, x, r);
+#pragma omp parallel for
+  for (long i = 0; i < n; i++) {
+    p[i] = r[i];
+  }
+  double rr = dot(r, r);
+
+  unsigned int k = 0;
+  for (; k < maxIters; k++) {
+    if (sqrt(rr) <= tolerance * bNorm) {
+      stats.converged = true;
+      break;
+    }
+    double pq = multiplyDot(p, q);
+    double alpha = rr / pq;
+#pragma omp parallel for
+    for (long i = 0; i < n; i++) {
+      x[i] += alpha * p[i];
+      r[i] -= alpha * q[i];
+    }
+    double rrNew = dot(r, r);
+    double beta = rrNew / rr;
+#pragma omp parallel for
+    for (long i = 0; i < n; i++) {
+      p[i] = r[i] + beta * p[i];
+    }
+    rr = rrNew;
+  }
+  if (!stats.converged)
+    stats.converged = sqrt(rr) <= tolerance * bNorm;
+
+  stats.iterations = k;
+  stats.residual = bNorm == 0.0 ? sqrt(rr) : sqrt(rr) / bNorm;
+  stats.solveTime = microsecondsSince(start);
+  stats.spmvTime = spmvTime;
+  stats.clearTime = clearTime;
+  return stats;
+}
+
+///
+/// BiCGStab
+///
+SolverStats IterativeSolver::biCGStab(const double *b, double *x) {
+  SolverStats stats;
+  spmvTime = 0;
+  clearTime = 0;
+  auto start = Clock::now();
+
+  double bNorm = sqrt(dot(b, b));
+  computeResidual(b, x, r);
+#pragma omp parallel for
+  for (long i = 0; i < n; i++) {
+    rHat[i] = r[i];
+    p[i] = 0.0;
+    q[i] = 0.0;
+  }
+  double rho = 1.0, alpha = 1.0, omega = 1.0;
+  double rNorm = sqrt(dot(r, r));
+
+  // q holds A·p; s and t = A·s are the intermediate residual and its product.
+  unsigned int k = 0;
+  for (; k < maxIters; k++) {
+    if (rNorm <= tolerance * bNorm) {
+      stats.converged = true;
+      break;
+    }
+    double rhoNew = dot(rHat, r);
+    if (rhoNew == 0.0 || omega == 0.0)
+      break; // Breakdown
+    double beta = (rhoNew / rho) * (alpha / omega);
+#pragma omp parallel for
+    for (long i = 0; i < n; i++) {
+      p[i] = r[i] + beta * (p[i] - omega * q[i]);
+    }
+    multiply(p, q);
+    alpha = rhoNew / dot(rHat, q);
+#pragma omp parallel for
+    for (long i = 0; i < n; i++) {
+      s[i] = r[i] - alpha * q[i];
+    }
+    double sNorm = sqrt(dot(s, s));
+    if (sNorm <= tolerance * bNorm) {
+#pragma omp parallel for
+      for (long i = 0; i < n; i++) {
+        x[i] += alpha * p[i];
+        r[i] = s[i];
+      }
+      rNorm = sNorm;
+      stats.converged = true;
+      k++;
+      break;
+    }
+    double st = multiplyDot(s, t);
+    omega = st / dot(t, t);
+#pragma omp parallel for
+    for (long i = 0; i < n; i++) {
+      x[i] += alpha * p[i] + omega * s[i];
+      r[i] = s[i] - omega * t[i];
+    }
+    rNorm = sqrt(dot(r, r));
+    rho = rhoNew;
+  }
+  if (!stats.converged)
+    stats.converged = rNorm <= tolerance * bNorm;
+
+  stats.iterations = k;
+  stats.residual = bNorm == 0.0 ? rNorm : rNorm / bNorm;
+  stats.solveTime = microsecondsSince(start);
+  stats.spmvTime = spmvTime;
+  stats.clearTime = clearTime;
+  return stats;
+}
+
+///
+/// Power iteration
+///
+SolverStats IterativeSolver::powerIteration(double *x) {
+  SolverStats stats;
+  spmvTime = 0;
+  clearTime = 0;
+  auto start = Clock::now();
+
+  double xNorm = sqrt(dot(x, x));
+#pragma omp parallel for
+  for (long i = 0; i < n; i++) {
+    x[i] /= xNorm;
+  }
+
+  // Since x is normalized, x·A·x is the Rayleigh quotient.
+  double lambda = 0.0;
+  double change = 1.0;
+  unsigned int k = 0;
+  while (k < maxIters) {
+    double lambdaNew = multiplyDot(x, q);
+    k++;
+    double qNorm = sqrt(dot(q, q));
+    if (qNorm == 0.0) {
+      lambda = 0.0;
+      change = 0.0;
+      break; // x is in the null space
+    }
+#pragma omp parallel for
+    for (long i = 0; i < n; i++) {
+      x[i] = q[i] / qNorm;
+    }
+    change = lambdaNew == 0.0 ? fabs(lambdaNew - lambda) : fabs((lambdaNew - lambda) / lambdaNew);
+    lambda = lambdaNew;
+    if (change <= tolerance)
+      break;
+  }
+
+  stats.iterations = k;
+  stats.converged = change <= tolerance;
+  stats.residual = change;
+  stats.eigenvalue = lambda;
+  stats.solveTime = microsecondsSince(start);
+  stats.spmvTime = spmvTime;
+  stats.clearTime = clearTime;
+  return stats;
+}
@@ -0,0 +1,74 @@
+#ifndef _ITERATIVE_SOLVER_H_
+#define _ITERATIVE_SOLVER_H_
+
+#include "method.h"
+
+namespace thundercat {
+  enum SolverKind { NO_SOLVER, SOLVER_CG, SOLVER_BICGSTAB, SOLVER_POWER };
+
+  struct SolverStats {
+    unsigned int iterations = 0;
+    bool converged = false;
+    // Relative residual norm ||b - A·x|| / ||b||; for the power iteration,
+    // the relative change of the eigenvalue estimate in the last iteration.
+    double residual = 0.0;
+    // Dominant eigenvalue estimate of the power iteration
+    double eigenvalue = 0.0;
+    // Time to solution, the part of it spent in the SpMV, and the part spent
+    // clearing the output of the methods without a beta = 0 kernel, in usec.
+    long long solveTime = 0;
+    long long spmvTime = 0;
+    long long clearTime = 0;
+  };
+
+  ///
+  /// Runs an iterative method on a square matrix, with an SpMVMethod as the operator.
+  /// The method must have been initialized and its code generated. The products
+  /// whose result is immediately dotted with the input vector use spmvDot, so that
+  /// methods that fuse the dot product into the SpMV get the benefit.
+  /// The vector operations are parallelized with OpenMP over the whole vectors.
+  ///
+  class IterativeSolver {
+  public:
+    IterativeSolver(SpMVMethod *method, unsigned long n, double tolerance, unsigned int maxIters);
+
+    ~IterativeSolver();
+
+    // Solves A·x = b with the conjugate gradient method; A must be symmetric positive definite.
+    // x holds the initial guess and is overwritten with the solution.
+    SolverStats conjugateGradient(const double *b, double *x);
+
+    // Solves A·x = b with BiCGStab; x holds the initial guess and is overwritten with the solution.
+    SolverStats biCGStab(const double *b, double *x);
+
+    // Estimates the dominant eigenvalue of A; x holds the start vector
+    // and is overwritten with the normalized eigenvector estimate.
+    SolverStats powerIteration(double *x);
+
+  private:
+    SpMVMethod *method;
+    unsigned long n;
+    double tolerance;
+    unsigned int maxIters;
+    long long spmvTime;
+    long long clearTime;
+    // Work vectors, of n elements each
+    double *r, *p, *q, *s, *t, *rHat;
+
+    // w = A·v
+    void multiply(double *v, double *w);
+
+    // w = A·v, returns v·w
+    double multiplyDot(double *v, double *w);
+
+    // w = 0
+    void clear(double *w);
+
+    double dot(const double *x, const double *y);
+
+    // r = b - A·x
+    void computeResidual(const double *b, double *x, double *r);
+  };
+}
+
+#endif
@@ -0,0 +1,231 @@
+#include "method.h"
+#include "emitterUtils.h"
+#include <iostream>
+
+using namespace thundercat;
+using namespace std;
+using namespace asmjit;
+using namespace x86;
+
+///
+/// Analysis
+///
+void LCSR::analyzeMatrix() {
+  LCSRAnalyzer analyzer;
+  analyzer.analyzeMatrix(csrMatrix, stripeInfos, rowByNZLists);
+}
+
+///
+/// LCSR
+///
+void LCSR::convertMatrix() {
+  LCSRAnalyzer analyzer;
+  matrix = analyzer.convertMatrix(csrMatrix, stripeInfos, rowByNZLists, lcsrInfos);
+}
+
+///
+/// LCSRCodeEmitter:
+/// Helper class to avoid having to pass several parameters
+///
+class LCSRCodeEmitter {
+public:
+  LCSRCodeEmitter(X86Assembler *assembler,
+                  LCSRInfo *lcsrInfo,
+                  unsigned long baseValsIndex) {
+    this->assembler = assembler;
+    this->lcsrInfo = lcsrInfo;
+    this->baseValsIndex = baseValsIndex;
+    this->fusedOp = NO_FUSED_OP;
+  }
+
+  void emit();
+
+  // Makes emit generate w = alpha·A·v + beta·w instead of w += A·v
+  void setOutputScaling(double alpha, double beta) {
+    scaling.alpha = alpha;
+    scaling.beta = beta;
+    scaling.constants = assembler->newLabel();
+  }
+
+  // Makes emit generate the code of spmvDot or spmvAxpy (see MultByMDotFun and MultByMAxpyFun)
+  void setFusedOp(FusedOp fusedOp) {
+    this->fusedOp = fusedOp;
+  }
+
+private:
+  X86Assembler *assembler;
+  LCSRInfo *lcsrInfo;
+  unsigned long baseValsIndex;
+  OutputScaling scaling;
+  FusedOp fusedOp;
+
+  void emitHeader();
+
+  void emitFooter();
+
+  void emitMainLoop(Label &lengthTable);
+
+  void emitLengthTable(Label &lengthTable);
+};
+
+void LCSR::emitMultByMFunction(unsigned int index) {
+  X86Assembler assembler(codeHolders[index]);
+  LCSRCodeEmitter emitter(&assembler,
+                          lcsrInfos.at(index),
+                          stripeInfos->at(index).valIndexBegin);
+  emitter.emit();
+}
+
+bool LCSR::supportsScaling() {
+  return true;
+}
+
+void LCSR::emitScaledFunction(unsigned int index) {
+  X86Assembler assembler(scaledCodeHolders[index]);
+  LCSRCodeEmitter emitter(&assembler,
+                          lcsrInfos.at(index),
+                          stripeInfos->at(index).valIndexBegin);
+  emitter.setOutputScaling(kernelOptions.alpha, kernelOptions.beta);
+  emitter.emit();
+}
+
+bool LCSR::supportsFusedOps() {
+  return true;
+}
+
+void LCSR::emitDotFunction(unsigned int index) {
+  X86Assembler assembler(dotCodeHolders[index]);
+  LCSRCodeEmitter emitter(&assembler,
+                          lcsrInfos.at(index),
+                          stripeInfos->at(index).valIndexBegin);
+  emitter.setFusedOp(FUSED_DOT);
+  emitter.emit();
+}
+
+void LCSR::emitAxpyFunction(unsigned int index) {
+  X86Assembler assembler(axpyCodeHolders[index]);
+  LCSRCodeEmitter emitter(&assembler,
+                          lcsrInfos.at(index),
+                          stripeInfos->at(index).valIndexBegin);
+  emitter.setFusedOp(FUSED_AXPY);
+  emitter.emit();
+}
+
+void LCSRCodeEmitter::emit() {
+  Label lengthTable = assembler->newLabel();
+  emitHeader();
+  if (lcsrInfo->numLengths > 0)
+    emitMainLoop(lengthTable);
+  emitFooter();
+  emitLengthTable(lengthTable);
+  emitScalingConstants(assembler, scaling);
+}
+
+void LCSRCodeEmitter::emitHeader() {
+  // rows is in %rdx, cols is in %rcx, vals is in %r8
+  assembler->push(rbx);
+  assembler->push(r12);
+  assembler->push(r13);
+
+  assembler->lea(rcx, ptr(rcx, (int)baseValsIndex * sizeof(int)));
+  assembler->lea(r8, ptr(r8, (int)baseValsIndex * sizeof(double)));
+  if (fusedOp == FUSED_AXPY) {
+    // y is the 6th argument; %r9 walks over the length table.
+    assembler->push(r14);
+    // movq %r9, %r14
+    assembler->mov(r14, r9);
+  }
+  emitFusedOpInit(assembler, fusedOp);
+}
+
+void LCSRCodeEmitter::emitFooter() {
+  if (fusedOp == FUSED_AXPY)
+    assembler->pop(r14);
+  assembler->pop(r13);
+  assembler->pop(r12);
+  assembler->pop(rbx);
+  emitFusedOpResult(assembler, fusedOp);
+  assembler->ret();
+}
+
+// The table has a (length, end of the group in rows) pair per length group.
+// %r9 walks over the table, %r10 counts the remaining groups.
+// %rax is the current position in rows, %r11 the end of the group,
+// %rbx the length of the rows of the group, %r12 the remaining elements of a row.
+// cols and vals are walked over by %rcx and %r8.
+void LCSRCodeEmitter::emitMainLoop(Label &lengthTable) {
+  Label groupLoop = assembler->newLabel();
+  Label rowLoop = assembler->newLabel();
+  Label elementLoop = assembler->newLabel();
+  Label nextGroup = assembler->newLabel();
+
+  // leaq lengthTable(%rip), %r9
+  assembler->lea(r9, ptr(lengthTable));
+  // movq $numLengths, %r10
+  assembler->mov(r10, lcsrInfo->numLengths);
+  // movq $lenStart[0], %rax
+  assembler->mov(rax, lcsrInfo->lenStart[0]);
+
+  assembler->bind(groupLoop);
+  // movslq (%r9), %rbx ## length
+  assembler->movsxd(rbx, ptr(r9));
+  // movslq 4(%r9), %r11 ## end of the group
+  assembler->movsxd(r11, ptr(r9, 4));
+
+  assembler->bind(rowLoop);
+  // cmpq %r11, %rax
+  assembler->cmp(rax, r11);
+  // jge nextGroup
+  assembler->jge(nextGroup);
+  // xorps %xmm0, %xmm0
+  assembler->xorps(xmm0, xmm0);
+  // movq %rbx, %r12
+  assembler->mov(r12, rbx);
+
+  assembler->bind(elementLoop);
+  // movslq (%rcx), %r13 ## cols[k]
+  assembler->movsxd(r13, ptr(rcx));
+  // movsd (%r8), %xmm1 ## vals[k]
+  assembler->movsd(xmm1, ptr(r8));
+  // mulsd (%rdi,%r13,8), %xmm1 ## v[cols[k]]
+  assembler->mulsd(xmm1, ptr(rdi, r13, 3));
+  // addsd %xmm1, %xmm0
+  assembler->addsd(xmm0, xmm1);
+  // addq $4, %rcx
+  assembler->add(rcx, sizeof(int));
+  // addq $8, %r8
+  assembler->add(r8, sizeof(double));
+  // decq %r12
+  assembler->dec(r12);
+  // jnz elementLoop
+  assembler->jnz(elementLoop);
+
+  // movslq (%rdx,%rax,4), %r13 ## row index
+  assembler->movsxd(r13, ptr(rdx, rax, 2));
+  // addsd (%rsi,%r13,8), %xmm0 ; movsd %xmm0, (%rsi,%r13,8)
+  emitRowUpdate(assembler, scaling, ptr(rsi, r13, 3), xmm0, xmm1,
+                fusedOp, ptr(fusedOp == FUSED_DOT ? rdi : r14, r13, 3));
+  // incq %rax
+  assembler->inc(rax);
+  // jmp rowLoop
+  assembler->jmp(rowLoop);
+
+  assembler->bind(nextGroup);
+  // addq $8, %r9
+  assembler->add(r9, 2 * sizeof(int));
+  // decq %r10
+  assembler->dec(r10);
+  // jnz groupLoop
+  assembler->jnz(groupLoop);
+}
+
+void LCSRCodeEmitter::emitLengthTable(Label &lengthTable) {
+  assembler->align(kAlignData, 8);
+  assembler->bind(lengthTable);
+  for (int i = 0; i < lcsrInfo->numLengths; i++) {
+    int length = lcsrInfo->length[i];
+    int groupEnd = lcsrInfo->lenStart[i + 1];
+    assembler->embed(&length, sizeof(int));
+    assembler->embed(&groupEnd, sizeof(int));
+  }
+}
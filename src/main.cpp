@@ -1,6 +1,8 @@
 #include "profiler.h"
 #include "svmAnalyzer.h"
 #include "method.h"
+#include "iterativeSolver.h"
+#include "triangularSolver.h"
 #include <iostream>
 #include <iomanip>
 #include <fstream>
@@ -9,6 +11,7 @@
 #include "duffsDeviceCSRDD.hpp"
 #include "duffsDeviceCompressed.hpp"
 #include "incrementalCSR.hpp"
+#include "columnRunCSR.hpp"
 
 using namespace thundercat;
 using namespace std;
@@ -18,13 +21,45 @@ bool __DEBUG__ = false;
 bool DUMP_OBJECT = false;
 bool DUMP_MATRIX = false;
 bool MATRIX_STATS = false;
+bool DENSE_BLOCKS = false;
+bool COLUMN_MAJOR = false;
+bool TRANSPOSE = false;
+bool FUSE_DOT = false;
+bool FUSE_AXPY = false;
+SolverKind SOLVER = NO_SOLVER;
+double SOLVER_TOLERANCE = 1e-8;
+unsigned int SOLVER_MAX_ITERS = 1000;
+bool SPTRSV = false;
+bool SPTRSV_LOWER = true;
+bool SPECIALIZE_SPTRSV = false;
+// Fraction of the entries of v that are nonzero in -sparse_input; 0 if v is dense
+double SPARSE_INPUT_DENSITY = 0.0;
+bool SPARSE_INPUT_BITMAP = false;
+// Fraction of the rows that are active in -mask; 0 if there is no mask
+double MASK_DENSITY = 0.0;
+bool MASK_BITMAP = false;
 unsigned int NUM_OF_THREADS = 1;
 int ITERS = -1;
+KernelOptions KERNEL_OPTIONS;
+std::string BLOCKING_PROFILE_FILE("blocking_profile.txt");
 Matrix *csrMatrix;
 SpMVMethod *method;
 vector<MultByMFun> fptrs;
 double *vVector;
 double *wVector;
+// y of the fused AXPY, y += AXPY_FACTOR * w
+double *yVector;
+const double AXPY_FACTOR = 0.5;
+double vDotW;
+// A·v, ..., A^k·v of -powers, one vector after the other
+double *powersVector;
+// Nonzeros of v in -sparse_input, as index/value lists and as a bitmap
+vector<int> sparseIndices;
+vector<double> sparseValues;
+vector<unsigned long> sparseBitmap;
+// Active rows of -mask, as a list and as a bitmap
+vector<int> maskRows;
+vector<unsigned long> maskBitmap;
 
 
 void parseCommandLineArguments(int argc, const char *argv[]);
@@ -36,24 +71,35 @@ void generateFunctions();
 void dumpObjectIfRequested();
 void populateInputOutputVectors();
 void benchmark();
+void solve();
+void triangularSolve();
 void cleanup();
 
 int main(int argc, const char *argv[]) {
   parseCommandLineArguments(argc, argv);
   setParallelism();
+  method->setKernelOptions(KERNEL_OPTIONS);
   method->init(csrMatrix, NUM_OF_THREADS);
   dumpMatrixIfRequested();
   doSVMAnalysisIfRequested();
-  registerLoggersIfRequested();
+  if (SPTRSV) {
+    // The triangular solve has its own code; the SpMV method is not processed.
+    triangularSolve();
+    cleanup();
+    return 0;
+  }
   generateFunctions();
   populateInputOutputVectors();
-  benchmark();
+  if (SOLVER != NO_SOLVER)
+    solve();
+  else
+    benchmark();
   cleanup();
   return 0;
 }
 
 void parseCommandLineArguments(int argc, const char *argv[]) {
-  // Usage: thundercat <matrixName> <specializerName> {-debug|-dump_object|-dump_matrix|-num_threads|-matrix_stats}
+  // Usage: thundercat <matrixName> <specializerName> {-debug|-dump_object|-dump_matrix|-num_threads|-matrix_stats|-accumulators|-prefetch_distance|-prefetch_indirect|-nontemporal|-packed_blocks|-blocking_profile|-merge_patterns|-merge_fill_budget|-vectorize_row_runs|-constant_coefficients|-unfolding_code_budget|-dia_coverage|-dense_blocks|-dense_block_density|-spmm|-column_major|-transpose|-specialize_transpose|-alpha|-beta|-fused|-solver|-solver_tolerance|-solver_max_iters|-powers|-powers_block_size|-sptrsv|-specialize_sptrsv|-semiring|-sparse_input|-sparse_input_bitmap|-push_threshold|-mask|-mask_bitmap}
   // E.g: thundercat matrices/fidap037 CSRbyNZ
   // E.g: thundercat matrices/fidap037 RowPattern -debug
   // E.g: thundercat matrices/fidap037 GenOSKI44 -dump_object
@@ -62,13 +108,20 @@ void parseCommandLineArguments(int argc, const char *argv[]) {
   string genOSKI33("GenOSKI33");
   string genOSKI44("GenOSKI44");
   string genOSKI55("GenOSKI55");
+  string genOSKI66("GenOSKI66");
+  string genOSKI88("GenOSKI88");
+  string genOSKIAuto("GenOSKIAuto");
   string csrByNZ("CSRbyNZ");
   string unfolding("Unfolding");
   string rowPattern("RowPattern");
   string unrollingWithGOTO("UnrollingWithGOTO");
   string csrWithGOTO("CSRWithGOTO");
   string csrLenWithGOTO("CSRLenWithGOTO");
+  string columnRun("ColumnRun");
+  string lcsr("LCSR");
   string mkl("MKL");
+  string dia("DIA");
+  string dcsr("DCSR");
 
   string plainCSR("PlainCSR");
   string plainCSR4("PlainCSR4");
@@ -97,6 +150,9 @@ void parseCommandLineArguments(int argc, const char *argv[]) {
   string duffsDeviceCompressed8("DuffsDeviceCompressed8");
   string duffsDeviceCompressed16("DuffsDeviceCompressed16");
   string duffsDeviceCompressed32("DuffsDeviceCompressed32");
+
+  string columnRunCSR4("ColumnRunCSR4");
+  string columnRunCSR8("ColumnRunCSR8");
   
   string debugFlag("-debug");
   string dumpObjFlag("-dump_object");
@@ -104,6 +160,40 @@ void parseCommandLineArguments(int argc, const char *argv[]) {
   string numThreadsFlag("-num_threads");
   string matrixStatsFlag("-matrix_stats");
   string itersFlag("-iters");
+  string accumulatorsFlag("-accumulators");
+  string prefetchDistanceFlag("-prefetch_distance");
+  string prefetchIndirectFlag("-prefetch_indirect");
+  string nonTemporalFlag("-nontemporal");
+  string packedBlocksFlag("-packed_blocks");
+  string blockingProfileFlag("-blocking_profile");
+  string mergePatternsFlag("-merge_patterns");
+  string mergeFillBudgetFlag("-merge_fill_budget");
+  string vectorizeRowRunsFlag("-vectorize_row_runs");
+  string constantCoefficientsFlag("-constant_coefficients");
+  string unfoldingCodeBudgetFlag("-unfolding_code_budget");
+  string diaCoverageFlag("-dia_coverage");
+  string denseBlocksFlag("-dense_blocks");
+  string denseBlockDensityFlag("-dense_block_density");
+  string spmmFlag("-spmm");
+  string columnMajorFlag("-column_major");
+  string transposeFlag("-transpose");
+  string specializeTransposeFlag("-specialize_transpose");
+  string alphaFlag("-alpha");
+  string betaFlag("-beta");
+  string fusedFlag("-fused");
+  string solverFlag("-solver");
+  string solverToleranceFlag("-solver_tolerance");
+  string solverMaxItersFlag("-solver_max_iters");
+  string powersFlag("-powers");
+  string powersBlockSizeFlag("-powers_block_size");
+  string sptrsvFlag("-sptrsv");
+  string specializeSptrsvFlag("-specialize_sptrsv");
+  string semiringFlag("-semiring");
+  string sparseInputFlag("-sparse_input");
+  string sparseInputBitmapFlag("-sparse_input_bitmap");
+  string pushThresholdFlag("-push_threshold");
+  string maskFlag("-mask");
+  string maskBitmapFlag("-mask_bitmap");
   
   string matrixName(argv[1]);
   csrMatrix = Matrix::readMatrixFromFile(matrixName + ".mtx");
@@ -121,6 +211,12 @@ void parseCommandLineArguments(int argc, const char *argv[]) {
     method = new GenOSKI(4, 4);
   } else if(genOSKI55.compare(*argptr) == 0) {
     method = new GenOSKI(5, 5);
+  } else if(genOSKI66.compare(*argptr) == 0) {
+    method = new GenOSKI(6, 6);
+  } else if(genOSKI88.compare(*argptr) == 0) {
+    method = new GenOSKI(8, 8);
+  } else if(genOSKIAuto.compare(*argptr) == 0) {
+    method = new GenOSKI();
   } else if(unfolding.compare(*argptr) == 0) {
     method = new Unfolding();
   } else if(csrByNZ.compare(*argptr) == 0) {
@@ -133,8 +229,16 @@ void parseCommandLineArguments(int argc, const char *argv[]) {
     method = new CSRWithGOTO();
   } else if(csrLenWithGOTO.compare(*argptr) == 0) {
     method = new CSRLenWithGOTO();
+  } else if(columnRun.compare(*argptr) == 0) {
+    method = new ColumnRun();
+  } else if(lcsr.compare(*argptr) == 0) {
+    method = new LCSR();
   } else if(mkl.compare(*argptr) == 0) {
     method = new MKL();
+  } else if(dia.compare(*argptr) == 0) {
+    method = new DIA();
+  } else if(dcsr.compare(*argptr) == 0) {
+    method = new DCSR();
   } else if(plainCSR.compare(*argptr) == 0) {
     method = new PlainCSR();
   } else if(plainCSR4.compare(*argptr) == 0) {
@@ -179,6 +283,10 @@ void parseCommandLineArguments(int argc, const char *argv[]) {
     method = new DuffsDeviceCompressed<16>();
   } else if(duffsDeviceCompressed32.compare(*argptr) == 0) {
     method = new DuffsDeviceCompressed<32>();
+  } else if(columnRunCSR4.compare(*argptr) == 0) {
+    method = new ColumnRunCSR<4>();
+  } else if(columnRunCSR8.compare(*argptr) == 0) {
+    method = new ColumnRunCSR<8>();
   } else {
     std::cerr << "Method " << *argptr << " not found.\n";
     exit(1);
@@ -206,12 +314,245 @@ void parseCommandLineArguments(int argc, const char *argv[]) {
         std::cerr << "Number of iterations must be >= 0.\n";
         exit(1);
       }
+    } else if (accumulatorsFlag.compare(*argptr) == 0) {
+      int numAccumulators = atoi(*(++argptr));
+      if (numAccumulators < 1) {
+        std::cerr << "Number of accumulators must be >= 1.\n";
+        exit(1);
+      }
+      KERNEL_OPTIONS.maxAccumulators = numAccumulators;
+    } else if (prefetchDistanceFlag.compare(*argptr) == 0) {
+      int distance = atoi(*(++argptr));
+      if (distance < 0) {
+        std::cerr << "Prefetch distance must be >= 0.\n";
+        exit(1);
+      }
+      KERNEL_OPTIONS.prefetchDistance = distance;
+    } else if (prefetchIndirectFlag.compare(*argptr) == 0) {
+      KERNEL_OPTIONS.prefetchIndirect = true;
+    } else if (nonTemporalFlag.compare(*argptr) == 0) {
+      KERNEL_OPTIONS.nonTemporal = true;
+    } else if (packedBlocksFlag.compare(*argptr) == 0) {
+      KERNEL_OPTIONS.packedBlocks = true;
+    } else if (blockingProfileFlag.compare(*argptr) == 0) {
+      BLOCKING_PROFILE_FILE = *(++argptr);
+    } else if (mergePatternsFlag.compare(*argptr) == 0) {
+      int targetLoopCount = atoi(*(++argptr));
+      if (targetLoopCount < 1) {
+        std::cerr << "Target loop count must be >= 1.\n";
+        exit(1);
+      }
+      KERNEL_OPTIONS.mergeTargetLoopCount = targetLoopCount;
+    } else if (mergeFillBudgetFlag.compare(*argptr) == 0) {
+      double fillBudget = atof(*(++argptr));
+      if (fillBudget < 0.0) {
+        std::cerr << "Fill budget must be >= 0.\n";
+        exit(1);
+      }
+      KERNEL_OPTIONS.mergeFillBudget = fillBudget;
+    } else if (vectorizeRowRunsFlag.compare(*argptr) == 0) {
+      KERNEL_OPTIONS.vectorizeRowRuns = true;
+    } else if (constantCoefficientsFlag.compare(*argptr) == 0) {
+      KERNEL_OPTIONS.constantCoefficients = true;
+    } else if (unfoldingCodeBudgetFlag.compare(*argptr) == 0) {
+      int budgetInKB = atoi(*(++argptr));
+      if (budgetInKB < 1) {
+        std::cerr << "Code budget must be >= 1 KB.\n";
+        exit(1);
+      }
+      KERNEL_OPTIONS.unfoldingCodeBudget = (unsigned long)budgetInKB * 1024;
+    } else if (diaCoverageFlag.compare(*argptr) == 0) {
+      double coverage = atof(*(++argptr));
+      if (coverage < 0.0 || coverage > 1.0) {
+        std::cerr << "DIA coverage must be between 0 and 1.\n";
+        exit(1);
+      }
+      KERNEL_OPTIONS.diaCoverageThreshold = coverage;
+    } else if (denseBlocksFlag.compare(*argptr) == 0) {
+      DENSE_BLOCKS = true;
+    } else if (denseBlockDensityFlag.compare(*argptr) == 0) {
+      double density = atof(*(++argptr));
+      if (density <= 0.0 || density > 1.0) {
+        std::cerr << "Dense block density must be in (0, 1].\n";
+        exit(1);
+      }
+      KERNEL_OPTIONS.denseBlockDensity = density;
+    } else if (spmmFlag.compare(*argptr) == 0) {
+      int numVectors = atoi(*(++argptr));
+      if (numVectors < 1) {
+        std::cerr << "Number of vectors must be >= 1.\n";
+        exit(1);
+      }
+      KERNEL_OPTIONS.numVectors = numVectors;
+    } else if (columnMajorFlag.compare(*argptr) == 0) {
+      COLUMN_MAJOR = true;
+    } else if (transposeFlag.compare(*argptr) == 0) {
+      TRANSPOSE = true;
+    } else if (specializeTransposeFlag.compare(*argptr) == 0) {
+      KERNEL_OPTIONS.specializeTranspose = true;
+    } else if (alphaFlag.compare(*argptr) == 0) {
+      KERNEL_OPTIONS.alpha = atof(*(++argptr));
+    } else if (betaFlag.compare(*argptr) == 0) {
+      KERNEL_OPTIONS.beta = atof(*(++argptr));
+    } else if (fusedFlag.compare(*argptr) == 0) {
+      string fusedOp(*(++argptr));
+      if (fusedOp == "dot") {
+        FUSE_DOT = true;
+      } else if (fusedOp == "axpy") {
+        FUSE_AXPY = true;
+      } else {
+        std::cerr << "Fused operation must be dot or axpy.\n";
+        exit(1);
+      }
+      KERNEL_OPTIONS.fusedOps = true;
+    } else if (solverFlag.compare(*argptr) == 0) {
+      string solverName(*(++argptr));
+      if (solverName == "cg") {
+        SOLVER = SOLVER_CG;
+      } else if (solverName == "bicgstab") {
+        SOLVER = SOLVER_BICGSTAB;
+      } else if (solverName == "power") {
+        SOLVER = SOLVER_POWER;
+      } else {
+        std::cerr << "Solver must be cg, bicgstab or power.\n";
+        exit(1);
+      }
+    } else if (solverToleranceFlag.compare(*argptr) == 0) {
+      SOLVER_TOLERANCE = atof(*(++argptr));
+      if (SOLVER_TOLERANCE <= 0.0) {
+        std::cerr << "Solver tolerance must be > 0.\n";
+        exit(1);
+      }
+    } else if (solverMaxItersFlag.compare(*argptr) == 0) {
+      int maxIters = atoi(*(++argptr));
+      if (maxIters < 1) {
+        std::cerr << "Max number of solver iterations must be >= 1.\n";
+        exit(1);
+      }
+      SOLVER_MAX_ITERS = maxIters;
+    } else if (powersFlag.compare(*argptr) == 0) {
+      int numPowers = atoi(*(++argptr));
+      if (numPowers < 2) {
+        std::cerr << "Number of powers must be at least 2.\n";
+        exit(1);
+      }
+      KERNEL_OPTIONS.matrixPowers = numPowers;
+    } else if (powersBlockSizeFlag.compare(*argptr) == 0) {
+      long blockSize = atol(*(++argptr));
+      if (blockSize < 1) {
+        std::cerr << "Matrix powers block size must be >= 1 KB.\n";
+        exit(1);
+      }
+      KERNEL_OPTIONS.matrixPowersBlockSize = blockSize * 1024;
+    } else if (sptrsvFlag.compare(*argptr) == 0) {
+      string triangle(*(++argptr));
+      if (triangle == "lower") {
+        SPTRSV_LOWER = true;
+      } else if (triangle == "upper") {
+        SPTRSV_LOWER = false;
+      } else {
+        std::cerr << "Triangle must be lower or upper.\n";
+        exit(1);
+      }
+      SPTRSV = true;
+    } else if (specializeSptrsvFlag.compare(*argptr) == 0) {
+      SPECIALIZE_SPTRSV = true;
+    } else if (semiringFlag.compare(*argptr) == 0) {
+      string semiringName(*(++argptr));
+      if (semiringName == "plus_times") {
+        KERNEL_OPTIONS.semiring = SEMIRING_PLUS_TIMES;
+      } else if (semiringName == "min_plus") {
+        KERNEL_OPTIONS.semiring = SEMIRING_MIN_PLUS;
+      } else if (semiringName == "max_times") {
+        KERNEL_OPTIONS.semiring = SEMIRING_MAX_TIMES;
+      } else if (semiringName == "or_and") {
+        KERNEL_OPTIONS.semiring = SEMIRING_OR_AND;
+      } else {
+        std::cerr << "Semiring must be plus_times, min_plus, max_times or or_and.\n";
+        exit(1);
+      }
+    } else if (sparseInputFlag.compare(*argptr) == 0) {
+      SPARSE_INPUT_DENSITY = atof(*(++argptr));
+      if (SPARSE_INPUT_DENSITY <= 0.0 || SPARSE_INPUT_DENSITY > 1.0) {
+        std::cerr << "Density of the sparse input must be in (0, 1].\n";
+        exit(1);
+      }
+      KERNEL_OPTIONS.sparseInput = true;
+    } else if (sparseInputBitmapFlag.compare(*argptr) == 0) {
+      SPARSE_INPUT_BITMAP = true;
+    } else if (pushThresholdFlag.compare(*argptr) == 0) {
+      KERNEL_OPTIONS.pushThreshold = atof(*(++argptr));
+      if (KERNEL_OPTIONS.pushThreshold < 0.0) {
+        std::cerr << "Push threshold must be >= 0.\n";
+        exit(1);
+      }
+    } else if (maskFlag.compare(*argptr) == 0) {
+      MASK_DENSITY = atof(*(++argptr));
+      if (MASK_DENSITY <= 0.0 || MASK_DENSITY > 1.0) {
+        std::cerr << "Fraction of the active rows must be in (0, 1].\n";
+        exit(1);
+      }
+    } else if (maskBitmapFlag.compare(*argptr) == 0) {
+      MASK_BITMAP = true;
     } else {
       std::cerr << "Unrecognized flag: " << *argptr << "\n";
       exit(1);
     }
     argptr++;
   }
+  
+  // Each mode replaces the plain SpMV, so at most one of them can be given.
+  struct Mode {
+    const char *flag;
+    bool isOn;
+    bool needsSquareMatrix;
+  };
+  const Mode modes[] = {
+    {"-alpha or -beta", KERNEL_OPTIONS.alpha != 1.0 || KERNEL_OPTIONS.beta != 1.0, false},
+    {"-transpose", TRANSPOSE, false},
+    {"-spmm", KERNEL_OPTIONS.numVectors > 1, false},
+    {FUSE_DOT ? "-fused dot" : "-fused axpy", KERNEL_OPTIONS.fusedOps, FUSE_DOT},
+    {"-solver", SOLVER != NO_SOLVER, true},
+    {"-powers", KERNEL_OPTIONS.matrixPowers > 1, true},
+    {"-sptrsv", SPTRSV, true},
+    {"-semiring", KERNEL_OPTIONS.semiring != SEMIRING_PLUS_TIMES, false},
+    {"-sparse_input", KERNEL_OPTIONS.sparseInput, false},
+    {"-mask", MASK_DENSITY > 0.0, false},
+  };
+  const Mode *selectedMode = NULL;
+  for (const Mode &mode : modes) {
+    if (!mode.isOn)
+      continue;
+    if (selectedMode) {
+      std::cerr << mode.flag << " cannot be combined with " << selectedMode->flag << ".\n";
+      exit(1);
+    }
+    selectedMode = &mode;
+  }
+  if (selectedMode && selectedMode->needsSquareMatrix && csrMatrix->n != csrMatrix->m) {
+    std::cerr << selectedMode->flag << " needs a square matrix.\n";
+    exit(1);
+  }
+  
+  if (SPARSE_INPUT_BITMAP && !KERNEL_OPTIONS.sparseInput) {
+    std::cerr << "-sparse_input_bitmap needs -sparse_input.\n";
+    exit(1);
+  }
+  
+  if (MASK_BITMAP && MASK_DENSITY == 0.0) {
+    std::cerr << "-mask_bitmap needs -mask.\n";
+    exit(1);
+  }
+  
+  if (SOLVER != NO_SOLVER) {
+    // The solvers use spmvDot, and w = A·v, which the specializers generate code for.
+    KERNEL_OPTIONS.fusedOps = true;
+    KERNEL_OPTIONS.beta = 0.0;
+  }
+  
+  if (DENSE_BLOCKS) {
+    method = new DenseBlockSpMV(method);
+  }
 }
 
 void setParallelism() {
@@ -248,8 +589,7 @@ void doSVMAnalysisIfRequested() {
 
 void registerLoggersIfRequested() {
   if (DUMP_OBJECT && method->isSpecializer()) {
-    Specializer *specializer = (Specializer*)method;
-    auto codeHolders = specializer->getCodeHolders();
+    auto codeHolders = method->getCodeHolders();
     for (int i = 0; i < codeHolders->size(); i++) {
       auto codeHolder = codeHolders->at(i);
       FileLogger *logger = new FileLogger();
@@ -268,26 +608,111 @@ void generateFunctions() {
     Profiler::recordTime("processMatrix", []() {
       method->processMatrix();
     });
+    // A method wrapped by -dense_blocks gets its code holders when the matrix is processed.
+    registerLoggersIfRequested();
     Profiler::recordTime("emitCode", []() {
       method->emitCode();
     });
   });
 }
 
+// Index of the entry of the given row of the given vector in a block of numVectors vectors
+unsigned long blockIndex(unsigned long row, unsigned long vector, unsigned long numRows) {
+  if (COLUMN_MAJOR)
+    return vector * numRows + row;
+  return row * KERNEL_OPTIONS.numVectors + vector;
+}
+
 void populateInputOutputVectors() {
-  unsigned long n = csrMatrix->n;
-  unsigned long m = csrMatrix->m;
+  // The input and output sizes are swapped for the transpose
+  unsigned long n = TRANSPOSE ? csrMatrix->m : csrMatrix->n;
+  unsigned long m = TRANSPOSE ? csrMatrix->n : csrMatrix->m;
   unsigned long nz = csrMatrix->nz;
-  vVector = new double[m];
-  wVector = new double[n];
-  for(int i = 0; i < m; ++i) {
-    vVector[i] = i + 1;
+  unsigned long k = KERNEL_OPTIONS.numVectors;
+  vVector = new double[m * k];
+  wVector = new double[n * k];
+  for (int j = 0; j < k; ++j) {
+    for(int i = 0; i < m; ++i) {
+      vVector[blockIndex(i, j, m)] = i + 1 + j;
+    }
+    for(int i = 0; i < n; ++i) {
+      wVector[blockIndex(i, j, n)] = i + 1 + j;
+    }
+  }
+  if (KERNEL_OPTIONS.semiring == SEMIRING_OR_AND) {
+    // Reachability from every third vertex
+    for(int i = 0; i < m; ++i) {
+      vVector[i] = i % 3 == 0 ? 1.0 : 0.0;
+    }
+    for(int i = 0; i < n; ++i) {
+      wVector[i] = 0.0;
+    }
+  }
+  if (KERNEL_OPTIONS.sparseInput) {
+    // Evenly spaced nonzeros; the other entries of v are zero
+    unsigned long stride = max(1UL, (unsigned long)(1.0 / SPARSE_INPUT_DENSITY + 0.5));
+    sparseBitmap.assign((m + 63) / 64, 0);
+    for(unsigned long i = 0; i < m; ++i) {
+      if (i % stride == 0) {
+        sparseIndices.push_back(i);
+        sparseValues.push_back(vVector[i]);
+        sparseBitmap[i / 64] |= 1UL << (i % 64);
+      } else {
+        vVector[i] = 0.0;
+      }
+    }
+    if (!__DEBUG__ && !DUMP_OBJECT)
+      cout << "Sparse input: " << sparseIndices.size() << " nonzeros of " << m << "\n";
+  }
+  if (MASK_DENSITY > 0.0) {
+    // Evenly spaced active rows
+    unsigned long stride = max(1UL, (unsigned long)(1.0 / MASK_DENSITY + 0.5));
+    maskBitmap.assign((n + 63) / 64, 0);
+    for(unsigned long i = 0; i < n; i += stride) {
+      maskRows.push_back(i);
+      maskBitmap[i / 64] |= 1UL << (i % 64);
+    }
+    if (!__DEBUG__ && !DUMP_OBJECT)
+      cout << "Mask: " << maskRows.size() << " active rows of " << n << "\n";
   }
-  for(int i = 0; i < n; ++i) {
-    wVector[i] = i + 1;
+  if (KERNEL_OPTIONS.matrixPowers > 1) {
+    powersVector = new double[n * KERNEL_OPTIONS.matrixPowers]();
+  }
+  if (FUSE_AXPY) {
+    yVector = new double[n];
+    for(int i = 0; i < n; ++i) {
+      yVector[i] = i + 1;
+    }
   }
 }
 
+void multiply() {
+  if (KERNEL_OPTIONS.matrixPowers > 1)
+    method->spmvPowers(vVector, powersVector, KERNEL_OPTIONS.matrixPowers);
+  else if (KERNEL_OPTIONS.numVectors > 1)
+    method->spmm(vVector, wVector, KERNEL_OPTIONS.numVectors, !COLUMN_MAJOR);
+  else if (TRANSPOSE)
+    method->spmvTranspose(vVector, wVector);
+  else if (KERNEL_OPTIONS.alpha != 1.0 || KERNEL_OPTIONS.beta != 1.0)
+    method->spmvScaled(vVector, wVector, KERNEL_OPTIONS.alpha, KERNEL_OPTIONS.beta);
+  else if (MASK_DENSITY > 0.0 && MASK_BITMAP)
+    method->spmvMasked(vVector, wVector, RowMask{maskBitmap.data(), NULL, 0});
+  else if (MASK_DENSITY > 0.0)
+    method->spmvMasked(vVector, wVector, RowMask{NULL, maskRows.data(), maskRows.size()});
+  else if (KERNEL_OPTIONS.sparseInput && SPARSE_INPUT_BITMAP)
+    method->spmspv(sparseBitmap.data(), vVector, wVector);
+  else if (KERNEL_OPTIONS.sparseInput)
+    method->spmspv(SparseVector{sparseIndices.size(), sparseIndices.data(), sparseValues.data()}, wVector);
+  else if (KERNEL_OPTIONS.semiring != SEMIRING_PLUS_TIMES)
+    method->spmvSemiring(vVector, wVector, KERNEL_OPTIONS.semiring);
+  else if (FUSE_DOT)
+    method->spmvDot(vVector, wVector, &vDotW);
+  else if (FUSE_AXPY)
+    method->spmvAxpy(vVector, wVector, AXPY_FACTOR, yVector);
+  else
+    method->spmv(vVector, wVector);
+}
+
 void setNumIterations() {
   if (__DEBUG__)
     ITERS = 1;
@@ -328,21 +753,31 @@ void setNumIterations() {
 
 void benchmark() {
   setNumIterations();
-  unsigned long n = csrMatrix->n;
+  unsigned long n = TRANSPOSE ? csrMatrix->m : csrMatrix->n;
   
-  if (__DEBUG__) {
-    method->spmv(vVector, wVector);
+  if (__DEBUG__ && KERNEL_OPTIONS.matrixPowers > 1) {
+    multiply();
+    for(unsigned long i = 0; i < n * KERNEL_OPTIONS.matrixPowers; ++i)
+      printf("%g\n", powersVector[i]);
+  } else if (__DEBUG__) {
+    multiply();
     for(int i = 0; i < n; ++i)
-      printf("%g\n", wVector[i]);
+      for (int j = 0; j < KERNEL_OPTIONS.numVectors; ++j)
+        printf("%g\n", wVector[blockIndex(i, j, n)]);
+    if (FUSE_DOT)
+      printf("dot: %g\n", vDotW);
+    if (FUSE_AXPY)
+      for(int i = 0; i < n; ++i)
+        printf("%g\n", yVector[i]);
   } else {
     // Warmup
     for (unsigned i = 0; i < std::min(3, ITERS); i++) {
-      method->spmv(vVector, wVector);
+      multiply();
     }
   
     Profiler::recordTime("multByM", []() {
       for (unsigned i=0; i < ITERS; i++) {
-        method->spmv(vVector, wVector);
+        multiply();
       }
     });
 
@@ -350,6 +785,103 @@ void benchmark() {
   }
 }
 
+// Runs the iterative method on A·x = b with b = 1 and x = 0 initially,
+// or finds the dominant eigenvalue starting from x = 1.
+void solve() {
+  if (DUMP_OBJECT)
+    return;
+  unsigned long n = csrMatrix->n;
+  double *b = new double[n];
+  double *x = new double[n];
+  for (unsigned long i = 0; i < n; ++i) {
+    b[i] = 1.0;
+    x[i] = SOLVER == SOLVER_POWER ? 1.0 : 0.0;
+  }
+  
+  IterativeSolver solver(method, n, SOLVER_TOLERANCE, SOLVER_MAX_ITERS);
+  SolverStats stats;
+  string solverName;
+  if (SOLVER == SOLVER_CG) {
+    stats = solver.conjugateGradient(b, x);
+    solverName = "cg";
+  } else if (SOLVER == SOLVER_BICGSTAB) {
+    stats = solver.biCGStab(b, x);
+    solverName = "bicgstab";
+  } else {
+    stats = solver.powerIteration(x);
+    solverName = "power";
+  }
+  
+  if (__DEBUG__) {
+    for (unsigned long i = 0; i < n; ++i)
+      printf("%g\n", x[i]);
+    if (SOLVER == SOLVER_POWER)
+      printf("eigenvalue: %g\n", stats.eigenvalue);
+  } else {
+    cout << "Solver: " << solverName << (stats.converged ? " converged" : " did not converge")
+         << " in " << stats.iterations << " iterations";
+    if (SOLVER == SOLVER_POWER)
+      cout << ", eigenvalue " << stats.eigenvalue << ", relative change " << stats.residual << "\n";
+    else
+      cout << ", relative residual " << stats.residual << "\n";
+    double spmvShare = stats.solveTime == 0 ? 0.0 : 100.0 * stats.spmvTime / stats.solveTime;
+    cout << "0 " << std::setw(10) << stats.solveTime << " usec.    timeToSolution\n";
+    cout << "0 " << std::setw(10) << stats.spmvTime << " usec.    spmv (" << std::fixed << std::setprecision(1)
+         << spmvShare << "% of the time)\n";
+    cout << "0 " << std::setw(10) << stats.clearTime << " usec.    clearOutput\n";
+    cout << "0 " << std::setw(10) << stats.iterations << " times    iterated\n";
+  }
+  delete[] b;
+  delete[] x;
+}
+
+// Solves T·x = b with b = 1, where T is the lower or upper triangle of the matrix.
+// With -specialize_sptrsv, the code of the solve is generated; otherwise it runs in C++.
+void triangularSolve() {
+  TriangularSolver solver(csrMatrix, SPTRSV_LOWER, NUM_OF_THREADS);
+  Profiler::recordTime("analyzeTriangle", [&solver]() {
+    solver.analyzeMatrix();
+  });
+  if (SPECIALIZE_SPTRSV) {
+    Profiler::recordTime("emitTriangleCode", [&solver]() {
+      solver.emitCode(KERNEL_OPTIONS);
+    });
+  }
+  if (DUMP_OBJECT)
+    return;
+  
+  unsigned long n = csrMatrix->n;
+  double *b = new double[n];
+  double *x = new double[n];
+  for (unsigned long i = 0; i < n; ++i) {
+    b[i] = 1.0;
+    x[i] = 0.0;
+  }
+  
+  setNumIterations();
+  if (__DEBUG__) {
+    solver.solve(b, x);
+    for (unsigned long i = 0; i < n; ++i)
+      printf("%g\n", x[i]);
+  } else {
+    cout << "Triangular solve: " << solver.getNumLevels() << " levels\n";
+    // Warmup
+    for (unsigned i = 0; i < std::min(3, ITERS); i++) {
+      solver.solve(b, x);
+    }
+    
+    Profiler::recordTime("triangularSolve", [&solver, b, x]() {
+      for (unsigned i = 0; i < ITERS; i++) {
+        solver.solve(b, x);
+      }
+    });
+    
+    Profiler::print(ITERS);
+  }
+  delete[] b;
+  delete[] x;
+}
+
 void cleanup() {
   /* Normally, a cleanup as follows is the client's responsibility.
      Because we're aliasing some pointers in the returned matrices
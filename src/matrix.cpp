@@ -100,6 +100,31 @@ vector<MatrixStripeInfo> *Matrix::getStripeInfos(unsigned int numPartitions) {
   return &stripeInfos;
 }
 
+Matrix* Matrix::transpose() {
+  int *tRows = new int[m + 1]();
+  int *tCols = new int[nz];
+  double *tVals = new double[nz];
+  
+  // Count the elements of each column, then place the elements row by row,
+  // so that the columns of each row of the transpose stay sorted.
+  for (unsigned long k = 0; k < nz; ++k) {
+    tRows[cols[k] + 1]++;
+  }
+  for (unsigned long col = 0; col < m; ++col) {
+    tRows[col + 1] += tRows[col];
+  }
+  vector<int> positions(tRows, tRows + m);
+  for (unsigned long row = 0; row < n; ++row) {
+    for (int k = rows[row]; k < rows[row + 1]; ++k) {
+      int position = positions[cols[k]]++;
+      tCols[position] = row;
+      tVals[position] = vals[k];
+    }
+  }
+  
+  return new Matrix(tRows, tCols, tVals, m, n, nz);
+}
+
 void Matrix::print() {
   cout << "int numMatrixRows = " << n << ";\n";
   cout << "int numMatrixCols = " << m << ";\n";
@@ -34,6 +34,10 @@ namespace thundercat {
     
     std::vector<MatrixStripeInfo> *getStripeInfos(unsigned int numPartitions);
     
+    // Returns the transpose of the matrix in CSR format.
+    // Caller is responsible for destructing the returned matrix.
+    Matrix* transpose();
+    
     void print();
       
     static Matrix* readMatrixFromFile(std::string fileName);
@@ -0,0 +1,297 @@
+#include "matrixPowers.h"
+#include "csrByNZCodeEmitter.h"
+#include <algorithm>
+#include <unordered_map>
+#include <iostream>
+
+using namespace thundercat;
+using namespace asmjit;
+using namespace std;
+
+extern bool __DEBUG__;
+extern bool DUMP_OBJECT;
+
+// Max extra multiplications of the ghost rows of a stripe, in multiples of
+// its nonzeros, for the blocked kernel to be used instead of k SpMVs
+#define MAX_GHOST_WORK 1
+
+MatrixPowers::MatrixPowers(Matrix *csrMatrix, unsigned int k, unsigned long blockSize) {
+  this->csrMatrix = csrMatrix;
+  this->k = k;
+  this->blockSize = blockSize;
+}
+
+MatrixPowers::~MatrixPowers() {
+  for (auto holder : codeHolders) {
+    delete holder;
+  }
+}
+
+///
+/// Analysis
+///
+bool MatrixPowers::analyzeMatrix(std::vector<MatrixStripeInfo> *stripeInfos) {
+  blocks.resize(stripeInfos->size());
+  workVectors.resize(stripeInfos->size());
+  // A nonzero takes its value and its column index
+  const long maxBlockElements = max(1UL, blockSize / (sizeof(double) + sizeof(int)));
+  const int *rows = csrMatrix->rows;
+  vector<unsigned long> stripeProducts(stripeInfos->size(), 0);
+  vector<char> isStripeProfitable(stripeInfos->size(), true);
+
+#pragma omp parallel for
+  for (int t = 0; t < stripeInfos->size(); ++t) {
+    auto &stripeInfo = stripeInfos->at(t);
+    const unsigned long stripeNZ = rows[stripeInfo.rowIndexEnd] - rows[stripeInfo.rowIndexBegin];
+    unsigned long rowIndex = stripeInfo.rowIndexBegin;
+    while (rowIndex < stripeInfo.rowIndexEnd) {
+      blocks[t].push_back(PowersBlock());
+      PowersBlock &block = blocks[t].back();
+      // A block has at least one row, even if the row alone exceeds the budget.
+      block.rowIndexBegin = rowIndex;
+      do {
+        rowIndex++;
+      } while (rowIndex < stripeInfo.rowIndexEnd &&
+               rows[rowIndex + 1] - rows[block.rowIndexBegin] <= maxBlockElements);
+      block.rowIndexEnd = rowIndex;
+      stripeProducts[t] += findGhostRows(block);
+      // The stripes run in parallel, so a stripe that does more ghost work than
+      // MAX_GHOST_WORK times its nonzeros is slower than k SpMVs on its own.
+      if (stripeProducts[t] > (k + MAX_GHOST_WORK) * stripeNZ) {
+        isStripeProfitable[t] = false;
+        break;
+      }
+    }
+  }
+
+  if (find(isStripeProfitable.begin(), isStripeProfitable.end(), false) != isStripeProfitable.end()) {
+    blocks.clear();
+    workVectors.clear();
+    if (!__DEBUG__ && !DUMP_OBJECT) {
+      cout << "Matrix powers: ghost rows would add more than " << 100.0 * MAX_GHOST_WORK / k
+           << "% to the multiplications of the " << k << " powers of a thread, calling spmv "
+           << k << " times instead\n";
+    }
+    return false;
+  }
+
+#pragma omp parallel for
+  for (int t = 0; t < blocks.size(); ++t) {
+    unsigned long maxLevelSize = 0;
+    for (auto &block : blocks[t]) {
+      buildLocalMatrix(block);
+      maxLevelSize = max(maxLevelSize, block.levelSizes[0]);
+    }
+    workVectors[t].resize(2 * maxLevelSize);
+  }
+
+  if (!__DEBUG__ && !DUMP_OBJECT) {
+    unsigned long numBlocks = 0;
+    unsigned long numProducts = 0;
+    for (unsigned int t = 0; t < blocks.size(); t++) {
+      numBlocks += blocks[t].size();
+      numProducts += stripeProducts[t];
+    }
+    double overhead = csrMatrix->nz == 0 ? 0.0 : 100.0 * numProducts / ((double)k * csrMatrix->nz) - 100.0;
+    cout << "Matrix powers: " << numBlocks << " blocks, ghost rows add "
+         << overhead << "% to the multiplications of the " << k << " powers\n";
+  }
+  return true;
+}
+
+// The local rows are added level by level: the rows of level j - 1 are those
+// of level j and the columns they read. The rows a level adds are sorted, so
+// that the ghost rows are read from v in ascending order.
+unsigned long MatrixPowers::findGhostRows(PowersBlock &block) {
+  const int *rows = csrMatrix->rows;
+  const int *cols = csrMatrix->cols;
+  unordered_map<int, int> localIndices;
+  vector<int> &localRows = block.localRows;
+  for (int rowIndex = block.rowIndexBegin; rowIndex < block.rowIndexEnd; rowIndex++) {
+    localIndices[rowIndex] = localRows.size();
+    localRows.push_back(rowIndex);
+  }
+  block.levelSizes.assign(k + 1, 0);
+  block.levelSizes[k] = localRows.size();
+
+  unsigned long numProducts = 0;
+  unsigned long levelProducts = 0;
+  unsigned long bandBegin = 0;
+  for (unsigned int j = k; j > 0; j--) {
+    unsigned long bandEnd = localRows.size();
+    for (unsigned long l = bandBegin; l < bandEnd; l++) {
+      int rowIndex = localRows[l];
+      levelProducts += rows[rowIndex + 1] - rows[rowIndex];
+      for (int e = rows[rowIndex]; e < rows[rowIndex + 1]; e++) {
+        if (localIndices.find(cols[e]) == localIndices.end()) {
+          localIndices[cols[e]] = localRows.size();
+          localRows.push_back(cols[e]);
+        }
+      }
+    }
+    numProducts += levelProducts;
+    sort(localRows.begin() + bandEnd, localRows.end());
+    for (unsigned long l = bandEnd; l < localRows.size(); l++) {
+      localIndices[localRows[l]] = l;
+    }
+    block.levelSizes[j - 1] = localRows.size();
+    bandBegin = bandEnd;
+  }
+  return numProducts;
+}
+
+// Level 0 is only read, so the local matrix has the rows of level 1.
+void MatrixPowers::buildLocalMatrix(PowersBlock &block) {
+  const int *rows = csrMatrix->rows;
+  const int *cols = csrMatrix->cols;
+  unordered_map<int, int> localIndices;
+  for (unsigned long l = 0; l < block.levelSizes[0]; l++) {
+    localIndices[block.localRows[l]] = l;
+  }
+  block.rows.push_back(0);
+  for (unsigned long l = 0; l < block.levelSizes[1]; l++) {
+    int rowIndex = block.localRows[l];
+    for (int e = rows[rowIndex]; e < rows[rowIndex + 1]; e++) {
+      block.cols.push_back(localIndices[cols[e]]);
+      block.vals.push_back(csrMatrix->vals[e]);
+    }
+    block.rows.push_back(block.cols.size());
+  }
+}
+
+///
+/// Code generation
+///
+void MatrixPowers::groupBands(PowersBlock &block) {
+  block.bandRowByNZs.resize(k);
+  for (unsigned int b = 0; b < k; b++) {
+    unsigned long bandBegin = b == 0 ? 0 : block.levelSizes[k - b + 1];
+    unsigned long bandEnd = block.levelSizes[k - b];
+    NZtoRowMap &rowByNZs = block.bandRowByNZs[b];
+    for (unsigned long l = bandBegin; l < bandEnd; l++) {
+      int rowLength = block.rows[l + 1] - block.rows[l];
+      if (rowLength > 0) {
+        rowByNZs[rowLength].addRowIndex(l);
+      }
+    }
+
+    block.bandRowsIndices.push_back(block.bandRows.size());
+    block.bandValsIndices.push_back(block.bandCols.size());
+    for (auto &rowByNZ : rowByNZs) {
+      for (int l : *(rowByNZ.second.getRowIndices())) {
+        block.bandRows.push_back(l);
+        for (int e = block.rows[l]; e < block.rows[l + 1]; e++) {
+          block.bandCols.push_back(block.cols[e]);
+          block.bandVals.push_back(block.vals[e]);
+        }
+      }
+    }
+  }
+}
+
+void MatrixPowers::emitCode(const KernelOptions &options) {
+  // The data of a block is in cache while its levels are computed, so the code does not prefetch.
+  KernelOptions bandOptions = options;
+  bandOptions.prefetchDistance = 0;
+  bandOptions.prefetchIndirect = false;
+  bandOptions.nonTemporal = false;
+
+  // A code holder per band of each block
+  vector<unsigned long> holderIndices(blocks.size());
+  for (unsigned int t = 0; t < blocks.size(); t++) {
+    holderIndices[t] = codeHolders.size();
+    for (unsigned long i = 0; i < blocks[t].size() * k; i++) {
+      codeHolders.push_back(new CodeHolder);
+      codeHolders.back()->init(rt.getCodeInfo());
+    }
+  }
+
+#pragma omp parallel for
+  for (unsigned int t = 0; t < blocks.size(); t++) {
+    unsigned long holderIndex = holderIndices[t];
+    for (auto &block : blocks[t]) {
+      groupBands(block);
+      for (unsigned int b = 0; b < k; b++) {
+        {
+          X86Assembler assembler(codeHolders[holderIndex]);
+          CSRbyNZCodeEmitter emitter(&assembler,
+                                     &block.bandRowByNZs[b],
+                                     block.bandValsIndices[b],
+                                     block.bandRowsIndices[b],
+                                     bandOptions);
+          emitter.emit();
+        }
+        codeHolders[holderIndex]->sync();
+        holderIndex++;
+      }
+    }
+  }
+
+  unsigned long holderIndex = 0;
+  for (auto &stripeBlocks : blocks) {
+    for (auto &block : stripeBlocks) {
+      block.bandFunctions.resize(k);
+      for (unsigned int b = 0; b < k; b++) {
+        MultByMFun fn;
+        asmjit::Error err = rt.add(&fn, codeHolders[holderIndex++]);
+        if (err) {
+          std::cerr << "Problem occurred while adding matrix powers function " << holderIndex - 1 << " to Runtime.\n";
+          std::cerr << err;
+          exit(1);
+        }
+        block.bandFunctions[b] = fn;
+      }
+    }
+  }
+  isGenerated = true;
+}
+
+///
+/// Matrix powers
+///
+void MatrixPowers::spmvPowers(double* __restrict v, double* __restrict W) {
+  const unsigned long n = csrMatrix->n;
+#pragma omp parallel for
+  for (unsigned int t = 0; t < blocks.size(); t++) {
+    // x holds the local rows of the previous level, y those of the current one.
+    double *x = workVectors[t].data();
+    double *y = x + workVectors[t].size() / 2;
+    for (auto &block : blocks[t]) {
+      const int *localRows = block.localRows.data();
+      for (unsigned long l = 0; l < block.levelSizes[0]; l++) {
+        x[l] = v[localRows[l]];
+      }
+
+      const unsigned long numBlockRows = block.rowIndexEnd - block.rowIndexBegin;
+      for (unsigned int j = 1; j <= k; j++) {
+        const unsigned long levelSize = block.levelSizes[j];
+        if (isGenerated) {
+          for (unsigned long l = 0; l < levelSize; l++) {
+            y[l] = 0.0;
+          }
+          for (unsigned int b = 0; b <= k - j; b++) {
+            block.bandFunctions[b](x, y, block.bandRows.data(), block.bandCols.data(), block.bandVals.data());
+          }
+        } else {
+          const int *rows = block.rows.data();
+          const int *cols = block.cols.data();
+          const double *vals = block.vals.data();
+          for (unsigned long l = 0; l < levelSize; l++) {
+            double sum = 0.0;
+            for (int e = rows[l]; e < rows[l + 1]; e++) {
+              sum += vals[e] * x[cols[e]];
+            }
+            y[l] = sum;
+          }
+        }
+
+        // The rows of the block come first among the local rows.
+        double *w = W + (j - 1) * n + block.rowIndexBegin;
+        for (unsigned long l = 0; l < numBlockRows; l++) {
+          w[l] = y[l];
+        }
+        swap(x, y);
+      }
+    }
+  }
+}
@@ -0,0 +1,87 @@
+#ifndef _MATRIX_POWERS_H_
+#define _MATRIX_POWERS_H_
+
+#include "method.h"
+#include <vector>
+
+namespace thundercat {
+  ///
+  /// A cache block of the matrix powers kernel: a range of rows of a stripe,
+  /// together with the ghost rows whose lower powers its rows depend on.
+  /// Level j (1..k) computes A^j·v on the local rows [0, levelSizes[j]), reading
+  /// the level j-1 values of the local rows [0, levelSizes[j-1]); level 0 is v.
+  /// The local rows are ordered so that each level is a prefix: first the rows of
+  /// the block, then the ghost rows in the order their levels are needed.
+  ///
+  struct PowersBlock {
+    unsigned long rowIndexBegin;
+    unsigned long rowIndexEnd;
+    // Matrix row of each local row
+    std::vector<int> localRows;
+    // Number of local rows of each level, for j = 0..k; non-increasing
+    std::vector<unsigned long> levelSizes;
+    // CSR matrix of the local rows [0, levelSizes[1]), with local column indices
+    std::vector<int> rows;
+    std::vector<int> cols;
+    std::vector<double> vals;
+
+    // Generated code: the local rows in bands, band b being the rows of level k - b
+    // that are not in level k - b + 1, so that level j runs the bands 0..k-j.
+    // Each band is grouped by row length as in CSRbyNZ, in the arrays below.
+    std::vector<NZtoRowMap> bandRowByNZs;
+    std::vector<unsigned long> bandRowsIndices;
+    std::vector<unsigned long> bandValsIndices;
+    std::vector<int> bandRows;
+    std::vector<int> bandCols;
+    std::vector<double> bandVals;
+    std::vector<MultByMFun> bandFunctions;
+  };
+
+  ///
+  /// Matrix powers kernel: computes A·v, A²·v, ..., A^k·v of a square matrix
+  /// with one pass over the matrix data instead of k. The rows of each stripe
+  /// are cut into blocks whose nonzeros fit in a cache-sized budget; all k levels
+  /// of a block are computed before moving to the next block, while its data is
+  /// still in cache. The ghost rows of a block are computed redundantly, so that
+  /// the blocks are independent of each other and need no synchronization.
+  /// The blocks are multiplied by a CSR loop, or by generated CSRbyNZ code.
+  ///
+  class MatrixPowers {
+  public:
+    MatrixPowers(Matrix *csrMatrix, unsigned int k, unsigned long blockSize);
+
+    ~MatrixPowers();
+
+    // Cuts the stripes into blocks and finds their ghost rows. Returns false, and
+    // keeps no blocks, if the ghost rows of a stripe would cost more than k SpMVs.
+    bool analyzeMatrix(std::vector<MatrixStripeInfo> *stripeInfos);
+
+    // Generates CSRbyNZ code for the bands of the blocks, to be used instead of the CSR loop
+    void emitCode(const KernelOptions &options);
+
+    // W + (j-1)·n = A^j·v, for j = 1..k
+    void spmvPowers(double* __restrict v, double* __restrict W);
+
+  private:
+    // Returns the number of multiplications of the k levels of the block
+    unsigned long findGhostRows(PowersBlock &block);
+
+    void buildLocalMatrix(PowersBlock &block);
+
+    void groupBands(PowersBlock &block);
+
+    Matrix *csrMatrix;
+    unsigned int k;
+    // Max size in bytes of the nonzeros of a block's own rows
+    unsigned long blockSize;
+    // Blocks of each stripe
+    std::vector<std::vector<PowersBlock> > blocks;
+    // Two work vectors per stripe, as large as the largest level 0 of its blocks
+    std::vector<std::vector<double> > workVectors;
+    bool isGenerated = false;
+    std::vector<asmjit::CodeHolder*> codeHolders;
+    asmjit::JitRuntime rt;
+  };
+}
+
+#endif
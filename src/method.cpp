@@ -1,15 +1,23 @@
 #include "profiler.h"
 #include "method.h"
+#include "emitterUtils.h"
+#include "matrixPowers.h"
 #include <iostream>
 #include <sstream>
 #include <stdio.h>
+#include <algorithm>
 
 using namespace thundercat;
 using namespace asmjit;
 using namespace std;
 
+extern bool __DEBUG__;
 extern bool DUMP_OBJECT;
 
+// The column-run format is used only if the runs are at least this long on average.
+// A run takes two ints, so shorter runs would make cols larger than in CSR.
+#define COLUMN_RUN_MIN_AVERAGE_LENGTH 2.0
+
 SpMVMethod::~SpMVMethod() {
 }
 
@@ -19,10 +27,18 @@ void SpMVMethod::init(Matrix *csrMatrix, unsigned int numThreads) {
   this->numPartitions = numThreads;
 }
 
+void SpMVMethod::setKernelOptions(const KernelOptions &options) {
+  this->kernelOptions = options;
+}
+
 bool SpMVMethod::isSpecializer() {
   return false;
 }
 
+std::vector<CodeHolder*> *SpMVMethod::getCodeHolders() {
+  return NULL;
+}
+
 void SpMVMethod::emitCode() {
   // By default, do nothing
 }
@@ -41,6 +57,347 @@ void SpMVMethod::processMatrix() {
   Profiler::recordTime("convertMatrix", [this]() {
     convertMatrix();
   });
+  if (kernelOptions.specializeTranspose) {
+    Profiler::recordTime("specializeTranspose", [this]() {
+      specializeTranspose();
+    });
+  }
+  if (kernelOptions.matrixPowers > 1 && supportsMatrixPowers()) {
+    Profiler::recordTime("buildMatrixPowers", [this]() {
+      buildMatrixPowers();
+    });
+  }
+  if (kernelOptions.sparseInput) {
+    Profiler::recordTime("buildCSC", [this]() {
+      cscMatrix = csrMatrix->transpose();
+    });
+  }
+}
+
+bool SpMVMethod::supportsMatrixPowers() {
+  return false;
+}
+
+void SpMVMethod::buildMatrixPowers() {
+  matrixPowers = new MatrixPowers(csrMatrix, kernelOptions.matrixPowers, kernelOptions.matrixPowersBlockSize);
+  if (!matrixPowers->analyzeMatrix(stripeInfos)) {
+    // spmvPowers calls spmv k times.
+    delete matrixPowers;
+    matrixPowers = NULL;
+    return;
+  }
+  if (isSpecializer())
+    matrixPowers->emitCode(kernelOptions);
+}
+
+void SpMVMethod::spmvPowers(double* __restrict v, double* __restrict W, unsigned int k) {
+  if (matrixPowers && k == kernelOptions.matrixPowers) {
+    matrixPowers->spmvPowers(v, W);
+    return;
+  }
+  
+  const unsigned long n = csrMatrix->n;
+#pragma omp parallel for
+  for (long i = 0; i < k * n; i++) {
+    W[i] = 0.0;
+  }
+  for (unsigned int j = 0; j < k; j++) {
+    spmv(j == 0 ? v : W + (j - 1) * n, W + j * n);
+  }
+}
+
+// The rows of the transpose are the columns of the matrix, so the threads
+// of the generated code write to disjoint parts of w and need no reduction.
+void SpMVMethod::specializeTranspose() {
+  KernelOptions transposeOptions = kernelOptions;
+  transposeOptions.specializeTranspose = false;
+  transposeOptions.numVectors = 1;
+  transposeOptions.alpha = 1.0;
+  transposeOptions.beta = 1.0;
+  transposeOptions.fusedOps = false;
+  transposeOptions.matrixPowers = 1;
+  transposeOptions.semiring = SEMIRING_PLUS_TIMES;
+  transposeOptions.sparseInput = false;
+  transposeMethod = new CSRbyNZ();
+  transposeMethod->setKernelOptions(transposeOptions);
+  transposeMethod->init(csrMatrix->transpose(), numPartitions);
+  transposeMethod->processMatrix();
+  transposeMethod->emitCode();
+}
+
+void SpMVMethod::spmvTranspose(double* __restrict v, double* __restrict w) {
+  if (transposeMethod) {
+    transposeMethod->spmv(v, w);
+    return;
+  }
+  
+  const int *rows = csrMatrix->rows;
+  const int *cols = csrMatrix->cols;
+  const double *vals = csrMatrix->vals;
+  const unsigned long m = csrMatrix->m;
+  const unsigned int numStripes = stripeInfos->size();
+  if (numStripes == 1) {
+    for (int i = 0; i < csrMatrix->n; i++) {
+      for (int k = rows[i]; k < rows[i + 1]; k++) {
+        w[cols[k]] += vals[k] * v[i];
+      }
+    }
+    return;
+  }
+  
+  if (transposeBuffers.size() != numStripes * m) {
+    transposeBuffers.assign(numStripes * m, 0.0);
+  }
+  double *buffers = transposeBuffers.data();
+#pragma omp parallel for
+  for (unsigned int t = 0; t < numStripes; t++) {
+    double *buffer = buffers + t * m;
+    for (int i = stripeInfos->at(t).rowIndexBegin; i < stripeInfos->at(t).rowIndexEnd; i++) {
+      for (int k = rows[i]; k < rows[i + 1]; k++) {
+        buffer[cols[k]] += vals[k] * v[i];
+      }
+    }
+  }
+  // The buffers are added in thread order, so the result does not depend on the scheduling.
+  // They are cleared for the next call on the way.
+#pragma omp parallel for
+  for (long col = 0; col < m; col++) {
+    double sum = 0.0;
+    for (unsigned int t = 0; t < numStripes; t++) {
+      sum += buffers[t * m + col];
+      buffers[t * m + col] = 0.0;
+    }
+    w[col] += sum;
+  }
+}
+
+void SpMVMethod::spmm(double* __restrict V, double* __restrict W, unsigned int k, bool rowMajor) {
+  // Strides between the entries of consecutive rows and of consecutive vectors
+  const unsigned long vRowStride = rowMajor ? k : 1;
+  const unsigned long vVectorStride = rowMajor ? 1 : csrMatrix->m;
+  const unsigned long wRowStride = rowMajor ? k : 1;
+  const unsigned long wVectorStride = rowMajor ? 1 : csrMatrix->n;
+  const int *rows = csrMatrix->rows;
+  const int *cols = csrMatrix->cols;
+  const double *vals = csrMatrix->vals;
+#pragma omp parallel for
+  for (unsigned int t = 0; t < stripeInfos->size(); t++) {
+    vector<double> sums(k);
+    for (int i = stripeInfos->at(t).rowIndexBegin; i < stripeInfos->at(t).rowIndexEnd; i++) {
+      fill(sums.begin(), sums.end(), 0.0);
+      for (int kk = rows[i]; kk < rows[i + 1]; kk++) {
+        const double val = vals[kk];
+        const double *vEntries = V + cols[kk] * vRowStride;
+        for (unsigned int j = 0; j < k; j++) {
+          sums[j] += val * vEntries[j * vVectorStride];
+        }
+      }
+      double *wEntries = W + i * wRowStride;
+      for (unsigned int j = 0; j < k; j++) {
+        wEntries[j * wVectorStride] += sums[j];
+      }
+    }
+  }
+}
+
+void SpMVMethod::spmvScaled(double* __restrict v, double* __restrict w, double alpha, double beta) {
+  if (alpha == 1.0 && beta == 1.0) {
+    spmv(v, w);
+    return;
+  }
+  
+  const int *rows = csrMatrix->rows;
+  const int *cols = csrMatrix->cols;
+  const double *vals = csrMatrix->vals;
+#pragma omp parallel for
+  for (unsigned int t = 0; t < stripeInfos->size(); t++) {
+    for (int i = stripeInfos->at(t).rowIndexBegin; i < stripeInfos->at(t).rowIndexEnd; i++) {
+      double sum = 0.0;
+      for (int k = rows[i]; k < rows[i + 1]; k++) {
+        sum += vals[k] * v[cols[k]];
+      }
+      if (alpha != 1.0)
+        sum *= alpha;
+      if (beta == 0.0)
+        w[i] = sum;
+      else if (beta == 1.0)
+        w[i] += sum;
+      else
+        w[i] = sum + beta * w[i];
+    }
+  }
+}
+
+bool SpMVMethod::hasScaledKernel(double alpha, double beta) {
+  return alpha == 1.0 && beta == 1.0;
+}
+
+void SpMVMethod::spmvDot(double* __restrict v, double* __restrict w, double *vDotW) {
+  spmv(v, w);
+  stripePartials.resize(stripeInfos->size());
+#pragma omp parallel for
+  for (unsigned int t = 0; t < stripeInfos->size(); t++) {
+    double partial = 0.0;
+    for (int i = stripeInfos->at(t).rowIndexBegin; i < stripeInfos->at(t).rowIndexEnd; i++) {
+      partial += v[i] * w[i];
+    }
+    stripePartials[t] = partial;
+  }
+  *vDotW = sumStripePartials();
+}
+
+void SpMVMethod::spmvAxpy(double* __restrict v, double* __restrict w, double a, double* __restrict y) {
+  spmv(v, w);
+#pragma omp parallel for
+  for (unsigned int t = 0; t < stripeInfos->size(); t++) {
+    for (int i = stripeInfos->at(t).rowIndexBegin; i < stripeInfos->at(t).rowIndexEnd; i++) {
+      y[i] += a * w[i];
+    }
+  }
+}
+
+void SpMVMethod::spmvSemiring(double* __restrict v, double* __restrict w, SemiringKind semiring) {
+  if (semiring == SEMIRING_PLUS_TIMES) {
+    spmv(v, w);
+    return;
+  }
+  
+  const int *rows = csrMatrix->rows;
+  const int *cols = csrMatrix->cols;
+  const double *vals = csrMatrix->vals;
+  dispatchSemiring(semiring, [&](auto semiringOps) {
+    typedef decltype(semiringOps) Semiring;
+#pragma omp parallel for
+    for (unsigned int t = 0; t < stripeInfos->size(); t++) {
+      for (int i = stripeInfos->at(t).rowIndexBegin; i < stripeInfos->at(t).rowIndexEnd; i++) {
+        double sum = Semiring::zero();
+        for (int k = rows[i]; k < rows[i + 1]; k++) {
+          sum = Semiring::addProduct(sum, vals[k], v[cols[k]]);
+        }
+        w[i] = Semiring::add(w[i], sum);
+      }
+    }
+  });
+}
+
+///
+/// SpMSpV
+///
+
+// The push reads the columns of the nonzeros of x, the pull the whole matrix.
+bool SpMVMethod::shouldPush(const int *indices, unsigned long numNonzeros) {
+  if (!cscMatrix)
+    return false;
+  const int *colStarts = cscMatrix->rows;
+  unsigned long pushedElements = 0;
+  for (unsigned long k = 0; k < numNonzeros; k++) {
+    pushedElements += colStarts[indices[k] + 1] - colStarts[indices[k]];
+  }
+  return pushedElements <= kernelOptions.pushThreshold * csrMatrix->nz;
+}
+
+// The row indices of a column of the CSC copy are sorted, so a stripe finds
+// its part of a column by binary search. The stripes write to disjoint rows of w.
+template <typename ValueFun>
+void SpMVMethod::spmspvPush(const int *indices, unsigned long numNonzeros, ValueFun value, double* __restrict w) {
+  const int *colStarts = cscMatrix->rows;
+  const int *rowIndices = cscMatrix->cols;
+  const double *vals = cscMatrix->vals;
+  const bool isSingleStripe = stripeInfos->size() == 1;
+#pragma omp parallel for
+  for (unsigned int t = 0; t < stripeInfos->size(); t++) {
+    const int rowIndexBegin = stripeInfos->at(t).rowIndexBegin;
+    const int rowIndexEnd = stripeInfos->at(t).rowIndexEnd;
+    for (unsigned long k = 0; k < numNonzeros; k++) {
+      const int col = indices[k];
+      const double x = value(k);
+      const int *begin = rowIndices + colStarts[col];
+      const int *end = rowIndices + colStarts[col + 1];
+      const int *row = isSingleStripe ? begin : lower_bound(begin, end, rowIndexBegin);
+      for (; row < end && *row < rowIndexEnd; row++) {
+        w[*row] += vals[row - rowIndices] * x;
+      }
+    }
+  }
+}
+
+void SpMVMethod::spmspv(const SparseVector &x, double* __restrict w) {
+  const int *indices = x.indices;
+  const double *values = x.values;
+  if (shouldPush(indices, x.numNonzeros)) {
+    spmspvPush(indices, x.numNonzeros, [values](unsigned long k) { return values[k]; }, w);
+    return;
+  }
+  
+  if (pulledInput.size() != csrMatrix->m)
+    pulledInput.assign(csrMatrix->m, 0.0);
+  for (unsigned long k = 0; k < x.numNonzeros; k++) {
+    pulledInput[indices[k]] = values[k];
+  }
+  spmv(pulledInput.data(), w);
+  for (unsigned long k = 0; k < x.numNonzeros; k++) {
+    pulledInput[indices[k]] = 0.0;
+  }
+}
+
+void SpMVMethod::spmspv(const unsigned long *bitmap, double* __restrict v, double* __restrict w) {
+  bitmapIndices.clear();
+  const unsigned long numWords = (csrMatrix->m + 63) / 64;
+  for (unsigned long word = 0; word < numWords; word++) {
+    for (unsigned long bits = bitmap[word]; bits != 0; bits &= bits - 1) {
+      bitmapIndices.push_back(word * 64 + __builtin_ctzl(bits));
+    }
+  }
+  
+  const int *indices = bitmapIndices.data();
+  if (shouldPush(indices, bitmapIndices.size())) {
+    spmspvPush(indices, bitmapIndices.size(), [indices, v](unsigned long k) { return v[indices[k]]; }, w);
+    return;
+  }
+  spmv(v, w);
+}
+
+///
+/// Masked SpMV
+///
+void SpMVMethod::spmvMasked(double* __restrict v, double* __restrict w, const RowMask &mask) {
+  const int *rows = csrMatrix->rows;
+  const int *cols = csrMatrix->cols;
+  const double *vals = csrMatrix->vals;
+  auto multiplyRow = [rows, cols, vals, v, w](int i) {
+    double sum = 0.0;
+    for (int k = rows[i]; k < rows[i + 1]; k++) {
+      sum += vals[k] * v[cols[k]];
+    }
+    w[i] += sum;
+  };
+  
+  if (!mask.bitmap) {
+    const int *activeRows = mask.rows;
+#pragma omp parallel for
+    for (long j = 0; j < mask.numRows; j++) {
+      multiplyRow(activeRows[j]);
+    }
+    return;
+  }
+  
+  // The words of the bitmap are scanned, so inactive rows cost a bit each.
+  const unsigned long *bitmap = mask.bitmap;
+  const long numWords = (csrMatrix->n + 63) / 64;
+#pragma omp parallel for
+  for (long word = 0; word < numWords; word++) {
+    for (unsigned long bits = bitmap[word]; bits != 0; bits &= bits - 1) {
+      multiplyRow(word * 64 + __builtin_ctzl(bits));
+    }
+  }
+}
+
+double SpMVMethod::sumStripePartials() {
+  double sum = 0.0;
+  for (double partial : stripePartials) {
+    sum += partial;
+  }
+  return sum;
 }
 
 void SpMVMethod::analyzeMatrix() {
@@ -54,13 +411,41 @@ void SpMVMethod::convertMatrix() {
 void Specializer::init(Matrix *csrMatrix, unsigned int numThreads) {
   SpMVMethod::init(csrMatrix, numThreads);
   
-  codeHolders.clear();
-  for (int i = 0; i < numThreads; i++) {
-    codeHolders.push_back(new CodeHolder);
-    codeHolders[i]->init(rt.getCodeInfo());
-  }
+  initCodeHolders(codeHolders, true);
+  functions.resize(codeHolders.size());
+  
+  initCodeHolders(spmmCodeHolders,
+                  kernelOptions.numVectors > 1 && kernelOptions.numVectors <= MAX_SPMM_VECTORS && supportsSpMM());
+  spmmFunctions.resize(spmmCodeHolders.size());
   
-  functions.resize(numThreads);
+  initCodeHolders(scaledCodeHolders, (kernelOptions.alpha != 1.0 || kernelOptions.beta != 1.0) && supportsScaling());
+  scaledFunctions.resize(scaledCodeHolders.size());
+  
+  initCodeHolders(dotCodeHolders, kernelOptions.fusedOps && supportsFusedOps());
+  dotFunctions.resize(dotCodeHolders.size());
+  initCodeHolders(axpyCodeHolders, kernelOptions.fusedOps && supportsFusedOps());
+  axpyFunctions.resize(axpyCodeHolders.size());
+  
+  initCodeHolders(semiringCodeHolders, kernelOptions.semiring != SEMIRING_PLUS_TIMES && supportsSemiring());
+  semiringFunctions.resize(semiringCodeHolders.size());
+  
+  emptyRows.clear();
+  if ((!scaledCodeHolders.empty() || !dotCodeHolders.empty()) && !visitsEmptyRows()) {
+    for (int rowIndex = 0; rowIndex < csrMatrix->n; ++rowIndex) {
+      if (csrMatrix->rows[rowIndex + 1] == csrMatrix->rows[rowIndex])
+        emptyRows.push_back(rowIndex);
+    }
+  }
+}
+
+void Specializer::initCodeHolders(std::vector<CodeHolder*> &holders, bool isGenerated) {
+  holders.clear();
+  if (!isGenerated)
+    return;
+  for (int i = 0; i < numPartitions; i++) {
+    holders.push_back(new CodeHolder);
+    holders[i]->init(rt.getCodeInfo());
+  }
 }
 
 bool Specializer::isSpecializer() {
@@ -73,21 +458,56 @@ void Specializer::emitCode() {
     emitMultByMFunction(i);
     codeHolders[i]->sync();
   }
+#pragma omp parallel for
+  for (unsigned int i = 0; i < spmmCodeHolders.size(); i++) {
+    emitSpMMFunction(i);
+    spmmCodeHolders[i]->sync();
+  }
+#pragma omp parallel for
+  for (unsigned int i = 0; i < scaledCodeHolders.size(); i++) {
+    emitScaledFunction(i);
+    scaledCodeHolders[i]->sync();
+  }
+#pragma omp parallel for
+  for (unsigned int i = 0; i < dotCodeHolders.size(); i++) {
+    emitDotFunction(i);
+    dotCodeHolders[i]->sync();
+  }
+#pragma omp parallel for
+  for (unsigned int i = 0; i < axpyCodeHolders.size(); i++) {
+    emitAxpyFunction(i);
+    axpyCodeHolders[i]->sync();
+  }
+#pragma omp parallel for
+  for (unsigned int i = 0; i < semiringCodeHolders.size(); i++) {
+    emitSemiringFunction(i);
+    semiringCodeHolders[i]->sync();
+  }
   
   Profiler::recordTime("setMultByMFunctions", [this]() {
-    for (unsigned int i = 0; i < codeHolders.size(); i++) {
-      MultByMFun fn;
-      asmjit::Error err = rt.add(&fn, codeHolders[i]);
-      if (err) {
-        std::cerr << "Problem occurred while adding function " << i << " to Runtime.\n";
-        std::cerr << err;
-        exit(1);
-      }
-      functions[i] = fn;
-    }
+    addFunctions(codeHolders, functions, "");
+    addFunctions(spmmCodeHolders, spmmFunctions, "SpMM ");
+    addFunctions(scaledCodeHolders, scaledFunctions, "scaled ");
+    addFunctions(dotCodeHolders, dotFunctions, "dot ");
+    addFunctions(axpyCodeHolders, axpyFunctions, "AXPY ");
+    addFunctions(semiringCodeHolders, semiringFunctions, "semiring ");
   });
 }
 
+template <typename Fun>
+void Specializer::addFunctions(std::vector<CodeHolder*> &holders, std::vector<Fun> &fns, const char *kind) {
+  for (unsigned int i = 0; i < holders.size(); i++) {
+    Fun fn;
+    asmjit::Error err = rt.add(&fn, holders[i]);
+    if (err) {
+      std::cerr << "Problem occurred while adding " << kind << "function " << i << " to Runtime.\n";
+      std::cerr << err;
+      exit(1);
+    }
+    fns[i] = fn;
+  }
+}
+
 std::vector<CodeHolder*> *Specializer::getCodeHolders() {
   return &codeHolders;
 }
@@ -99,6 +519,124 @@ void Specializer::spmv(double* __restrict v, double* __restrict w) {
   }
 }
 
+void Specializer::spmm(double* __restrict V, double* __restrict W, unsigned int k, bool rowMajor) {
+  if (!rowMajor || k != kernelOptions.numVectors || spmmFunctions.empty()) {
+    SpMVMethod::spmm(V, W, k, rowMajor);
+    return;
+  }
+#pragma omp parallel for
+  for (unsigned j = 0; j < spmmFunctions.size(); j++) {
+    spmmFunctions[j](V, W, matrix->rows, matrix->cols, matrix->vals);
+  }
+}
+
+void Specializer::spmvScaled(double* __restrict v, double* __restrict w, double alpha, double beta) {
+  if (alpha != kernelOptions.alpha || beta != kernelOptions.beta || scaledFunctions.empty()) {
+    SpMVMethod::spmvScaled(v, w, alpha, beta);
+    return;
+  }
+#pragma omp parallel for
+  for (unsigned j = 0; j < scaledFunctions.size(); j++) {
+    scaledFunctions[j](v, w, matrix->rows, matrix->cols, matrix->vals);
+  }
+  if (beta != 1.0) {
+#pragma omp parallel for
+    for (unsigned long j = 0; j < emptyRows.size(); j++) {
+      w[emptyRows[j]] = beta == 0.0 ? 0.0 : beta * w[emptyRows[j]];
+    }
+  }
+}
+
+bool Specializer::hasScaledKernel(double alpha, double beta) {
+  return SpMVMethod::hasScaledKernel(alpha, beta) ||
+         (alpha == kernelOptions.alpha && beta == kernelOptions.beta && !scaledFunctions.empty());
+}
+
+bool Specializer::supportsSpMM() {
+  return false;
+}
+
+void Specializer::emitSpMMFunction(unsigned int index) {
+  // Not supported by default; see supportsSpMM.
+}
+
+bool Specializer::supportsScaling() {
+  return false;
+}
+
+void Specializer::emitScaledFunction(unsigned int index) {
+  // Not supported by default; see supportsScaling.
+}
+
+bool Specializer::visitsEmptyRows() {
+  return false;
+}
+
+void Specializer::spmvDot(double* __restrict v, double* __restrict w, double *vDotW) {
+  if (dotFunctions.empty()) {
+    SpMVMethod::spmvDot(v, w, vDotW);
+    return;
+  }
+  stripePartials.resize(dotFunctions.size());
+#pragma omp parallel for
+  for (unsigned j = 0; j < dotFunctions.size(); j++) {
+    stripePartials[j] = dotFunctions[j](v, w, matrix->rows, matrix->cols, matrix->vals);
+  }
+  // Empty rows keep their value of w; they are summed last, in order.
+  double emptyRowsPartial = 0.0;
+  for (unsigned long j = 0; j < emptyRows.size(); j++) {
+    emptyRowsPartial += v[emptyRows[j]] * w[emptyRows[j]];
+  }
+  *vDotW = sumStripePartials() + emptyRowsPartial;
+}
+
+void Specializer::spmvAxpy(double* __restrict v, double* __restrict w, double a, double* __restrict y) {
+  if (axpyFunctions.empty()) {
+    SpMVMethod::spmvAxpy(v, w, a, y);
+    return;
+  }
+#pragma omp parallel for
+  for (unsigned j = 0; j < axpyFunctions.size(); j++) {
+    axpyFunctions[j](v, w, matrix->rows, matrix->cols, matrix->vals, y, a);
+  }
+#pragma omp parallel for
+  for (unsigned long j = 0; j < emptyRows.size(); j++) {
+    y[emptyRows[j]] += a * w[emptyRows[j]];
+  }
+}
+
+bool Specializer::supportsFusedOps() {
+  return false;
+}
+
+void Specializer::emitDotFunction(unsigned int index) {
+  // Not supported by default; see supportsFusedOps.
+}
+
+void Specializer::emitAxpyFunction(unsigned int index) {
+  // Not supported by default; see supportsFusedOps.
+}
+
+// The empty rows keep their value of w, since w ⊕ zero = w.
+void Specializer::spmvSemiring(double* __restrict v, double* __restrict w, SemiringKind semiring) {
+  if (semiring != kernelOptions.semiring || semiringFunctions.empty()) {
+    SpMVMethod::spmvSemiring(v, w, semiring);
+    return;
+  }
+#pragma omp parallel for
+  for (unsigned j = 0; j < semiringFunctions.size(); j++) {
+    semiringFunctions[j](v, w, matrix->rows, matrix->cols, matrix->vals);
+  }
+}
+
+bool Specializer::supportsSemiring() {
+  return false;
+}
+
+void Specializer::emitSemiringFunction(unsigned int index) {
+  // Not supported by default; see supportsSemiring.
+}
+
 ///
 /// LCSR Analyzer
 ///
@@ -128,3 +666,125 @@ void LCSRAnalyzer::analyzeMatrix(Matrix *csrMatrix,
     }
   }
 }
+
+Matrix *LCSRAnalyzer::convertMatrix(Matrix *csrMatrix,
+                                    std::vector<MatrixStripeInfo> *stripeInfos,
+                                    std::vector<NZtoRowMap> &rowByNZLists,
+                                    std::vector<LCSRInfo*> &lcsrInfos) {
+  // Empty rows are not listed; the unused tail of a stripe's rows is left zero.
+  int *rows = new int[csrMatrix->n]();
+  int *cols = new int[csrMatrix->nz];
+  double *vals = new double[csrMatrix->nz];
+  lcsrInfos.resize(rowByNZLists.size());
+  
+#pragma omp parallel for
+  for (int t = 0; t < rowByNZLists.size(); ++t) {
+    auto &rowByNZList = rowByNZLists.at(t);
+    int numLengths = rowByNZList.size();
+    int *length = new int[numLengths];
+    int *lenStart = new int[numLengths + 1];
+    int *lengthPtr = length;
+    int *lenStartPtr = lenStart;
+    *lenStartPtr = stripeInfos->at(t).rowIndexBegin;
+    int *rowsPtr = rows + stripeInfos->at(t).rowIndexBegin;
+    int *colsPtr = cols + stripeInfos->at(t).valIndexBegin;
+    double *valsPtr = vals + stripeInfos->at(t).valIndexBegin;
+    
+    for (auto &rowByNZ : rowByNZList) {
+      unsigned long rowLength = rowByNZ.first;
+      *lengthPtr++ = rowLength;
+      int index = *lenStartPtr + rowByNZ.second.getRowIndices()->size();
+      lenStartPtr++;
+      *lenStartPtr = index;
+      
+      for (int rowIndex : *(rowByNZ.second.getRowIndices())) {
+        *rowsPtr++ = rowIndex;
+        int k = csrMatrix->rows[rowIndex];
+        for (int i = 0; i < rowLength; i++, k++) {
+          *colsPtr++ = csrMatrix->cols[k];
+          *valsPtr++ = csrMatrix->vals[k];
+        }
+      }
+    }
+    lcsrInfos[t] = new LCSRInfo(numLengths, length, lenStart);
+  }
+  
+  return new Matrix(rows, cols, vals, csrMatrix->n, csrMatrix->m, csrMatrix->nz);
+}
+
+///
+/// Column-run Analyzer
+///
+bool ColumnRunAnalyzer::analyzeMatrix(Matrix *csrMatrix,
+                                      std::vector<MatrixStripeInfo> *stripeInfos,
+                                      std::vector<int> &numRowRuns,
+                                      std::vector<unsigned long> &maxRunLengths) {
+  numRowRuns.resize(csrMatrix->n);
+  maxRunLengths.resize(stripeInfos->size());
+  
+#pragma omp parallel for
+  for (int threadIndex = 0; threadIndex < stripeInfos->size(); ++threadIndex) {
+    auto &stripeInfo = stripeInfos->at(threadIndex);
+    unsigned long maxRunLength = 0;
+    for (unsigned long rowIndex = stripeInfo.rowIndexBegin; rowIndex < stripeInfo.rowIndexEnd; ++rowIndex) {
+      int rowStart = csrMatrix->rows[rowIndex];
+      int rowEnd = csrMatrix->rows[rowIndex+1];
+      int numRuns = 0;
+      int runStart = rowStart;
+      for (int k = rowStart; k < rowEnd; ++k) {
+        if (k + 1 == rowEnd || csrMatrix->cols[k + 1] != csrMatrix->cols[k] + 1) {
+          numRuns++;
+          maxRunLength = max(maxRunLength, (unsigned long)(k + 1 - runStart));
+          runStart = k + 1;
+        }
+      }
+      numRowRuns[rowIndex] = numRuns;
+    }
+    maxRunLengths[threadIndex] = maxRunLength;
+  }
+  
+  unsigned long numRuns = 0;
+  for (int rowRuns : numRowRuns) {
+    numRuns += rowRuns;
+  }
+  double averageRunLength = numRuns > 0 ? csrMatrix->nz / (double)numRuns : 0.0;
+  bool paysOff = averageRunLength >= COLUMN_RUN_MIN_AVERAGE_LENGTH;
+  if (!__DEBUG__ && !DUMP_OBJECT) {
+    cout << "Column runs: " << numRuns << " runs, average length " << averageRunLength;
+    if (!paysOff)
+      cout << ", too short; the CSR format is kept";
+    cout << "\n";
+  }
+  return paysOff;
+}
+
+Matrix *ColumnRunAnalyzer::convertMatrix(Matrix *csrMatrix,
+                                         std::vector<int> &numRowRuns) {
+  unsigned long n = csrMatrix->n;
+  int *rows = new int[n + 1];
+  rows[0] = 0;
+  for (unsigned long rowIndex = 0; rowIndex < n; ++rowIndex) {
+    rows[rowIndex + 1] = rows[rowIndex] + numRowRuns[rowIndex];
+  }
+  
+  unsigned long numRuns = rows[n];
+  int *cols = new int[2 * numRuns];
+#pragma omp parallel for
+  for (int rowIndex = 0; rowIndex < n; ++rowIndex) {
+    int *runs = cols + 2 * rows[rowIndex];
+    int rowStart = csrMatrix->rows[rowIndex];
+    int rowEnd = csrMatrix->rows[rowIndex+1];
+    int runStart = rowStart;
+    for (int k = rowStart; k < rowEnd; ++k) {
+      if (k + 1 == rowEnd || csrMatrix->cols[k + 1] != csrMatrix->cols[k] + 1) {
+        *runs++ = csrMatrix->cols[runStart];
+        *runs++ = k + 1 - runStart;
+        runStart = k + 1;
+      }
+    }
+  }
+  
+  Matrix *runMatrix = new Matrix(rows, cols, csrMatrix->vals, n, csrMatrix->m, csrMatrix->nz);
+  runMatrix->numCols = 2 * numRuns;
+  return runMatrix;
+}
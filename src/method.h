@@ -2,20 +2,223 @@
 #define _METHOD_H_
 
 #include "matrix.h"
+#include "denseBlockDetector.h"
 #include <unordered_map>
 #include <iostream>
+#include <bitset>
+#include <limits>
 #include "asmjit/asmjit.h"
 #ifdef OPENMP_EXISTS
 #include "omp.h"
 #endif
 
 namespace thundercat {
+  class MatrixPowers;
+  
   // multByM(v, w, rows, cols, vals)
   typedef void(*MultByMFun)(double*, double*, int*, int*, double*);
+  // multByM(v, w, rows, cols, vals) that returns the partial dot product of v and w over its rows
+  typedef double(*MultByMDotFun)(double*, double*, int*, int*, double*);
+  // multByM(v, w, rows, cols, vals, y, a) that also adds a·w to y for its rows
+  typedef void(*MultByMAxpyFun)(double*, double*, int*, int*, double*, double*, double);
+  
+  // Sparse input of spmspv: the indices of the nonzeros of a vector of m entries,
+  // in any order without duplicates, and their values
+  struct SparseVector {
+    unsigned long numNonzeros;
+    const int *indices;
+    const double *values;
+  };
+  
+  // Active rows of spmvMasked: either a bitmap of n bits, 64 per word, with the
+  // active rows set, or the list of the active rows, in any order without duplicates.
+  // The unused representation is NULL.
+  struct RowMask {
+    const unsigned long *bitmap;
+    const int *rows;
+    unsigned long numRows;
+  };
+  
+  // Semiring of spmvSemiring, w = w ⊕ (A ⊗ v). PLUS_TIMES is the usual w += A·v.
+  enum SemiringKind { SEMIRING_PLUS_TIMES, SEMIRING_MIN_PLUS, SEMIRING_MAX_TIMES, SEMIRING_OR_AND };
+  
+  ///
+  /// Knobs of the kernels. Defaults were picked empirically;
+  /// main exposes them as command-line flags so that they can be
+  /// tuned per matrix and per machine.
+  ///
+  struct KernelOptions {
+    // Max number of independent FP accumulators a row's sum is split into
+    unsigned int maxAccumulators = 4;
+    // Number of nonzeros ahead of the current one whose matrix data
+    // is prefetched by the generated code. 0 disables prefetching.
+    unsigned int prefetchDistance = 0;
+    // Also prefetch v[cols[k + prefetchDistance]] where v is accessed irregularly
+    bool prefetchIndirect = false;
+    // Read the matrix arrays through non-temporal prefetches (prefetchnta)
+    // so that streaming them does not evict v and w from the caches.
+    bool nonTemporal = false;
+    // Multiply adjacent columns of GenOSKI blocks with packed SIMD instructions
+    bool packedBlocks = false;
+    // GenOSKI and RowPattern merge rare patterns until each stripe has at most
+    // this many patterns (i.e. loops). 0 disables merging.
+    unsigned long mergeTargetLoopCount = 0;
+    // Max number of explicit zeros merging may add, relative to the nonzeros
+    double mergeFillBudget = 0.1;
+    // RowPattern computes runs of consecutive rows that have the same pattern
+    // together, loading their v elements with packed SIMD instructions
+    bool vectorizeRowRuns = false;
+    // RowPattern embeds the coefficients of the patterns whose rows all have
+    // the same values into the generated code, instead of reading them from vals
+    bool constantCoefficients = false;
+    // Max estimated size in bytes of the code Unfolding generates per stripe.
+    // The rows that do not fit run CSRbyNZ loops. 0 means no limit.
+    unsigned long unfoldingCodeBudget = 0;
+    // DIA stores the matrix diagonals densely only if they cover at least
+    // this fraction of the nonzeros; otherwise all nonzeros are kept in CSR.
+    double diaCoverageThreshold = 0.8;
+    // Min density of the tiles that make up the blocks extracted by DenseBlockSpMV
+    double denseBlockDensity = 0.9;
+    // Number of vectors the specializers generate SpMM code for (see SpMVMethod::spmm).
+    // The code works on row-major blocks. 1 generates SpMV code only.
+    unsigned int numVectors = 1;
+    // spmvTranspose builds the transpose once and multiplies it with generated
+    // CSRbyNZ code, instead of scattering into per-thread buffers.
+    // Pays off when the same matrix is applied many times.
+    bool specializeTranspose = false;
+    // The specializers that support it also generate code for w = alpha·A·v + beta·w
+    // with these values (see SpMVMethod::spmvScaled). alpha = beta = 1 generates none.
+    double alpha = 1.0;
+    double beta = 1.0;
+    // The specializers that support it also generate code for spmvDot and spmvAxpy,
+    // which applies the vector operation to each row of w right after its update.
+    bool fusedOps = false;
+    // Number of powers the methods that support it build a cache-blocked
+    // kernel for (see SpMVMethod::spmvPowers). 1 builds none.
+    unsigned int matrixPowers = 1;
+    // Max size in bytes of the nonzeros of the rows of a matrix powers block,
+    // ghost rows excluded; should leave room for the ghost rows in the L2 cache.
+    unsigned long matrixPowersBlockSize = 128 * 1024;
+    // The specializers that support it also generate code for spmvSemiring
+    // with this semiring. PLUS_TIMES generates none.
+    SemiringKind semiring = SEMIRING_PLUS_TIMES;
+    // processMatrix builds a CSC copy of the matrix, so that spmspv can push
+    // a sparse input instead of pulling it (see SpMVMethod::spmspv).
+    bool sparseInput = false;
+    // spmspv pushes the input if the columns of its nonzeros hold at most
+    // this fraction of the nonzeros of the matrix, and pulls it otherwise.
+    double pushThreshold = 0.1;
+    
+    // Distance to be used for the prefetches of the matrix arrays.
+    // Non-temporal mode needs prefetches to be effective;
+    // if no distance was given, it uses 64 nonzeros (i.e. 8 lines of vals).
+    unsigned int getPrefetchDistance() const {
+      if (prefetchDistance == 0 && nonTemporal)
+        return 64;
+      return prefetchDistance;
+    }
+  };
+  
+  ///
+  /// Updates of w in the C++ kernels. A kernel calls update(i, sum) once the
+  /// sum of row i is computed and adds the returned values into a partial sum
+  /// per stripe. The fused updates apply a vector operation to the row while
+  /// its new value is in a register, so that w is not streamed again.
+  ///
+  struct AddRowUpdate {
+    double *w;
+    
+    double operator()(int i, double sum) const {
+      w[i] += sum;
+      return 0.0;
+    }
+  };
+  
+  // Partial sum of x·w
+  struct DotRowUpdate {
+    double *w;
+    const double *x;
+    
+    double operator()(int i, double sum) const {
+      double wi = w[i] + sum;
+      w[i] = wi;
+      return x[i] * wi;
+    }
+  };
+  
+  // y += a·w
+  struct AxpyRowUpdate {
+    double *w;
+    double a;
+    double *y;
+    
+    double operator()(int i, double sum) const {
+      double wi = w[i] + sum;
+      w[i] = wi;
+      y[i] += a * wi;
+      return 0.0;
+    }
+  };
+  
+  ///
+  /// Semirings of the C++ kernels, which take one as a template parameter:
+  /// a row's sum starts at zero() and each nonzero is added by addProduct.
+  ///
+  struct PlusTimesSemiring {
+    static double zero() { return 0.0; }
+    static double add(double a, double b) { return a + b; }
+    static double addProduct(double sum, double val, double x) { return sum + val * x; }
+  };
+  
+  // Shortest paths: val is the length of an edge
+  struct MinPlusSemiring {
+    static double zero() { return std::numeric_limits<double>::infinity(); }
+    static double add(double a, double b) { return a < b ? a : b; }
+    static double addProduct(double sum, double val, double x) { return add(sum, val + x); }
+  };
+  
+  // Most reliable paths: val is the probability of an edge
+  struct MaxTimesSemiring {
+    static double zero() { return -std::numeric_limits<double>::infinity(); }
+    static double add(double a, double b) { return a > b ? a : b; }
+    static double addProduct(double sum, double val, double x) { return add(sum, val * x); }
+  };
+  
+  // Reachability: the matrix is taken as a graph, each stored element being a
+  // true edge whatever its value; v and w hold 0 (false) or 1 (true).
+  struct OrAndSemiring {
+    static double zero() { return 0.0; }
+    static double add(double a, double b) { return a != 0.0 || b != 0.0 ? 1.0 : 0.0; }
+    static double addProduct(double sum, double val, double x) { return add(sum, x); }
+  };
+  
+  // w = w ⊕ sum
+  template <typename Semiring>
+  struct SemiringRowUpdate {
+    double *w;
+    
+    double operator()(int i, double sum) const {
+      w[i] = Semiring::add(w[i], sum);
+      return 0.0;
+    }
+  };
+  
+  // Calls f with the semiring of the given kind, so that a kernel is instantiated per semiring
+  template <typename F>
+  void dispatchSemiring(SemiringKind semiring, F f) {
+    switch (semiring) {
+      case SEMIRING_MIN_PLUS: f(MinPlusSemiring()); break;
+      case SEMIRING_MAX_TIMES: f(MaxTimesSemiring()); break;
+      case SEMIRING_OR_AND: f(OrAndSemiring()); break;
+      default: f(PlusTimesSemiring()); break;
+    }
+  }
   
   class SpMVMethod {
   public:
     virtual void init(Matrix *csrMatrix, unsigned int numThreads);
+    
+    virtual void setKernelOptions(const KernelOptions &options) final;
 
     virtual ~SpMVMethod();
     
@@ -23,20 +226,110 @@ namespace thundercat {
     
     virtual void emitCode();
     
+    // Code holders of the spmv functions, once the matrix is processed; NULL if the method generates no code
+    virtual std::vector<asmjit::CodeHolder*> *getCodeHolders();
+    
     virtual Matrix* getMethodSpecificMatrix() final;
     
     virtual void processMatrix() final;
   
     virtual void spmv(double* __restrict v, double* __restrict w) = 0;
     
+    // W += A·V, where V and W are blocks of k vectors.
+    // Row-major blocks keep the k entries of a row together (V[col * k + j]),
+    // column-major blocks keep each vector together (V[j * m + col]).
+    // By default, a single pass over the CSR matrix applies each value to the k vectors.
+    virtual void spmm(double* __restrict V, double* __restrict W, unsigned int k, bool rowMajor);
+    
+    // w += Aᵀ·v, where v has n entries and w has m entries.
+    // By default, each thread scatters the products of its stripe into a private
+    // buffer, and the buffers are added to w in a parallel reduction over the columns.
+    virtual void spmvTranspose(double* __restrict v, double* __restrict w) final;
+    
+    // w = alpha·A·v + beta·w, so that w need not be cleared or scaled in a separate pass.
+    // By default, a single pass over the CSR matrix; beta = 0 stores into w without reading it.
+    virtual void spmvScaled(double* __restrict v, double* __restrict w, double alpha, double beta);
+    
+    // Whether spmvScaled runs a kernel of this method for alpha and beta, rather than the CSR loop
+    virtual bool hasScaledKernel(double alpha, double beta);
+    
+    // w += A·v, and *vDotW = v·w with the updated w; the matrix must be square.
+    // The rows of each stripe are added into a partial sum, and the partial sums
+    // are added in stripe order, so that the result does not depend on the scheduling.
+    // By default, the dot product is computed in a second pass after spmv.
+    virtual void spmvDot(double* __restrict v, double* __restrict w, double *vDotW);
+    
+    // w += A·v, then y += a·w with the updated w. By default in a second pass after spmv.
+    virtual void spmvAxpy(double* __restrict v, double* __restrict w, double a, double* __restrict y);
+    
+    // W + (j-1)·n = A^j·v for j = 1..k; the matrix must be square.
+    // If the method built the matrix powers kernel for k, it passes over the matrix
+    // once, block by block; otherwise, W is cleared and computed by k calls of spmv.
+    virtual void spmvPowers(double* __restrict v, double* __restrict W, unsigned int k) final;
+    
+    // w = w ⊕ (A ⊗ v) over the given semiring; the empty rows keep their value of w.
+    // By default, a single pass over the CSR matrix.
+    virtual void spmvSemiring(double* __restrict v, double* __restrict w, SemiringKind semiring);
+    
+    // w += A·x for a sparse x. If the method built the CSC copy and the columns of
+    // the nonzeros of x are short enough, x is pushed: each thread adds these columns
+    // into its own rows of w, at a cost proportional to their length. Otherwise
+    // x is pulled: it is expanded into a dense vector and multiplied by spmv.
+    virtual void spmspv(const SparseVector &x, double* __restrict w) final;
+    
+    // The same for a dense v whose nonzeros are the bits set in a bitmap of m bits,
+    // 64 per word; the pull multiplies v as it is, so its other entries must be zero.
+    virtual void spmspv(const unsigned long *bitmap, double* __restrict v, double* __restrict w) final;
+    
+    // w += A·v on the active rows of the mask; the other rows of w are left as they are.
+    // By default, a CSR loop over the active rows only, so that the cost scales with their number.
+    virtual void spmvMasked(double* __restrict v, double* __restrict w, const RowMask &mask);
+    
   protected:
     virtual void analyzeMatrix();
     virtual void convertMatrix();
     
+    // Methods whose kernels the matrix powers kernel has a back end for override this.
+    // The specializers get generated CSRbyNZ code, the others a CSR loop.
+    virtual bool supportsMatrixPowers();
+    
     std::vector<MatrixStripeInfo> *stripeInfos;
     Matrix *csrMatrix;
     Matrix *matrix;
     unsigned int numPartitions;
+    KernelOptions kernelOptions;
+    
+    // Partial sums of the stripes for spmvDot
+    std::vector<double> stripePartials;
+    
+    // Sum of stripePartials, in stripe order
+    double sumStripePartials();
+    
+  private:
+    void specializeTranspose();
+    
+    void buildMatrixPowers();
+    
+    // Whether pushing the given nonzeros of x is cheaper than pulling x
+    bool shouldPush(const int *indices, unsigned long numNonzeros);
+    
+    // Adds the columns of the given nonzeros of x, whose values are given by value(k)
+    // for the k-th nonzero, into the rows of w of each stripe.
+    template <typename ValueFun>
+    void spmspvPush(const int *indices, unsigned long numNonzeros, ValueFun value, double* __restrict w);
+    
+    // Private output buffers of the threads, m entries each
+    std::vector<double> transposeBuffers;
+    // Generated code for the transpose, if specialized
+    SpMVMethod *transposeMethod = NULL;
+    // Cache-blocked kernel of spmvPowers, if built
+    MatrixPowers *matrixPowers = NULL;
+    // CSC copy of the matrix for spmspv, i.e. the transpose in CSR, if built
+    Matrix *cscMatrix = NULL;
+    // Dense expansion of the input of a pulled spmspv; all zeros between calls
+    std::vector<double> pulledInput;
+    // Nonzeros of the bitmap of the last spmspv
+    std::vector<int> bitmapIndices;
   };
   
   ///
@@ -55,6 +348,20 @@ namespace thundercat {
   class PlainCSR: public SpMVMethod {
   public:
     virtual void spmv(double* __restrict v, double* __restrict w) final;
+    
+    virtual void spmvDot(double* __restrict v, double* __restrict w, double *vDotW) final;
+    
+    virtual void spmvAxpy(double* __restrict v, double* __restrict w, double a, double* __restrict y) final;
+    
+    virtual void spmvSemiring(double* __restrict v, double* __restrict w, SemiringKind semiring) final;
+    
+  protected:
+    virtual bool supportsMatrixPowers() final;
+    
+  private:
+    // The row loop, for any of the semirings and row updates above
+    template <typename Semiring, typename RowUpdate>
+    void spmvRows(double* __restrict v, RowUpdate update, double *partials);
   };
 
   class PlainCSR4: public SpMVMethod {
@@ -77,6 +384,77 @@ namespace thundercat {
     virtual void spmv(double* __restrict v, double* __restrict w) final;
   };
 
+  ///
+  /// DIA: the densest diagonals are stored as dense arrays,
+  /// the remaining nonzeros in CSR.
+  ///
+  class DIA: public SpMVMethod {
+  public:
+    virtual ~DIA();
+    
+    virtual void spmv(double* __restrict v, double* __restrict w) final;
+    
+  protected:
+    virtual void analyzeMatrix() final;
+    virtual void convertMatrix() final;
+    
+  private:
+    // Offsets (col - row) of the stored diagonals
+    std::vector<int> diagonalOffsets;
+    // diagonals[d * n + i] is the element at (i, i + diagonalOffsets[d]); zero if there is none.
+    double *diagonals = NULL;
+  };
+
+  ///
+  /// DCSR: doubly-compressed CSR, only the non-empty rows are stored.
+  /// rows holds the offsets of the non-empty rows (numNonEmptyRows + 1 entries)
+  /// followed by their row indices; cols and vals are the same as in CSR.
+  ///
+  class DCSR: public SpMVMethod {
+  public:
+    virtual void spmv(double* __restrict v, double* __restrict w) final;
+    
+  protected:
+    virtual void analyzeMatrix() final;
+    virtual void convertMatrix() final;
+    
+  private:
+    unsigned long numNonEmptyRows;
+    // Partitions of the non-empty rows with about the same number of nonzeros;
+    // partition t is [partitionBegins[t], partitionBegins[t+1]).
+    std::vector<unsigned long> partitionBegins;
+  };
+
+  ///
+  /// DenseBlockSpMV: dense sub-blocks of the matrix are multiplied
+  /// by a dense GEMV kernel, the rest of the matrix by the wrapped method.
+  ///
+  class DenseBlockSpMV: public SpMVMethod {
+  public:
+    DenseBlockSpMV(SpMVMethod *method);
+    
+    virtual ~DenseBlockSpMV();
+    
+    // Whether the wrapped method is a specializer, and its code holders
+    virtual bool isSpecializer() final;
+    
+    virtual void emitCode() final;
+    
+    virtual std::vector<asmjit::CodeHolder*> *getCodeHolders() final;
+    
+    virtual void spmv(double* __restrict v, double* __restrict w) final;
+    
+  protected:
+    virtual void analyzeMatrix() final;
+    virtual void convertMatrix() final;
+    
+  private:
+    SpMVMethod *method;
+    // Dense blocks of each stripe
+    std::vector<std::vector<DenseBlock> > denseBlocks;
+    double *denseVals = NULL;
+  };
+
   ///
   /// Duff's Device
   ///
@@ -120,6 +498,14 @@ namespace thundercat {
     virtual void analyzeMatrix(Matrix *csrMatrix,
                                std::vector<MatrixStripeInfo> *stripeInfos,
                                std::vector<NZtoRowMap> &rowByNZLists) final;
+
+    // rows holds the indices of the non-empty rows of each stripe grouped by length,
+    // starting at the first row index of the stripe; cols and vals are reordered accordingly.
+    // The LCSRInfo of a stripe gives the lengths and where their groups start in rows.
+    virtual Matrix *convertMatrix(Matrix *csrMatrix,
+                                  std::vector<MatrixStripeInfo> *stripeInfos,
+                                  std::vector<NZtoRowMap> &rowByNZLists,
+                                  std::vector<LCSRInfo*> &lcsrInfos) final;
   };
   
   ///
@@ -132,7 +518,7 @@ namespace thundercat {
     
   protected:
     std::vector<NZtoRowMap> rowByNZLists;
-    LCSRInfo *lcsrInfo;
+    std::vector<LCSRInfo*> lcsrInfos;
   };
 
   class DuffsDeviceLCSR4: public DuffsDeviceLCSR {
@@ -155,6 +541,25 @@ namespace thundercat {
     virtual void spmv(double* __restrict v, double* __restrict w) final;
   };
 
+  ///
+  /// Column-run utility: a row is stored as runs of consecutive columns.
+  /// rows holds the index of the first run of each row, cols holds a
+  /// (start column, run length) pair per run, vals is the same as in CSR.
+  ///
+  class ColumnRunAnalyzer {
+  public:
+    // Counts the runs of each row and the longest run of each stripe.
+    // Returns whether the run format pays off, i.e. whether the runs are
+    // long enough for the pairs to take less space than the column indices.
+    virtual bool analyzeMatrix(Matrix *csrMatrix,
+                               std::vector<MatrixStripeInfo> *stripeInfos,
+                               std::vector<int> &numRowRuns,
+                               std::vector<unsigned long> &maxRunLengths) final;
+
+    virtual Matrix *convertMatrix(Matrix *csrMatrix,
+                                  std::vector<int> &numRowRuns) final;
+  };
+
   ///
   /// Specializer
   ///
@@ -170,16 +575,87 @@ namespace thundercat {
 
     virtual void spmv(double* __restrict v, double* __restrict w) final;
     
+    // Runs the generated SpMM code if it was generated for k vectors in row-major blocks
+    virtual void spmm(double* __restrict V, double* __restrict W, unsigned int k, bool rowMajor) final;
+    
+    // Runs the generated scaled code if it was generated for these alpha and beta
+    virtual void spmvScaled(double* __restrict v, double* __restrict w, double alpha, double beta) final;
+    
+    virtual bool hasScaledKernel(double alpha, double beta) final;
+    
+    // Run the generated fused code if it was generated
+    virtual void spmvDot(double* __restrict v, double* __restrict w, double *vDotW) final;
+    
+    virtual void spmvAxpy(double* __restrict v, double* __restrict w, double a, double* __restrict y) final;
+    
+    // Runs the generated semiring code if it was generated for this semiring
+    virtual void spmvSemiring(double* __restrict v, double* __restrict w, SemiringKind semiring) final;
+    
   protected:
     virtual void emitMultByMFunction(unsigned int index) = 0;
     
+    // Specializers that can generate code for kernelOptions.numVectors vectors
+    // override these; the code has the MultByMFun signature, with V and W for v and w.
+    virtual bool supportsSpMM();
+    virtual void emitSpMMFunction(unsigned int index);
+    
+    // Specializers that can generate code for w = alpha·A·v + beta·w, with the alpha
+    // and beta of kernelOptions, override these; the code has the MultByMFun signature.
+    virtual bool supportsScaling();
+    virtual void emitScaledFunction(unsigned int index);
+    
+    // Whether the generated code updates the empty rows too.
+    // If not, spmvScaled scales their w by beta separately.
+    virtual bool visitsEmptyRows();
+    
+    // Specializers that can fuse the vector operations of spmvDot and spmvAxpy
+    // into the update of w override these; see MultByMDotFun and MultByMAxpyFun.
+    virtual bool supportsFusedOps();
+    virtual void emitDotFunction(unsigned int index);
+    virtual void emitAxpyFunction(unsigned int index);
+    
+    // Specializers that can generate code for spmvSemiring, with the semiring
+    // of kernelOptions, override these; the code has the MultByMFun signature.
+    virtual bool supportsSemiring();
+    virtual void emitSemiringFunction(unsigned int index);
+    
     std::vector<asmjit::CodeHolder*> codeHolders;
     
     std::vector<MultByMFun> functions;
     
+    std::vector<asmjit::CodeHolder*> spmmCodeHolders;
+    
+    std::vector<MultByMFun> spmmFunctions;
+    
+    std::vector<asmjit::CodeHolder*> scaledCodeHolders;
+    
+    std::vector<MultByMFun> scaledFunctions;
+    
+    std::vector<asmjit::CodeHolder*> dotCodeHolders;
+    
+    std::vector<MultByMDotFun> dotFunctions;
+    
+    std::vector<asmjit::CodeHolder*> axpyCodeHolders;
+    
+    std::vector<MultByMAxpyFun> axpyFunctions;
+    
+    std::vector<asmjit::CodeHolder*> semiringCodeHolders;
+    
+    std::vector<MultByMFun> semiringFunctions;
+    
   private:
     void emitConstData();
     
+    // Create a code holder per thread for a set of generated functions
+    void initCodeHolders(std::vector<asmjit::CodeHolder*> &holders, bool isGenerated);
+    
+    // Add the code of a set of generated functions to the runtime
+    template <typename Fun>
+    void addFunctions(std::vector<asmjit::CodeHolder*> &holders, std::vector<Fun> &fns, const char *kind);
+    
+    // Empty rows, if the code skips them; spmvScaled and the fused operations visit them separately
+    std::vector<int> emptyRows;
+    
     asmjit::JitRuntime rt;
   };
 
@@ -189,6 +665,16 @@ namespace thundercat {
   class CSRbyNZ: public Specializer {
   protected:
     virtual void emitMultByMFunction(unsigned int index);
+    virtual bool supportsSpMM();
+    virtual void emitSpMMFunction(unsigned int index) final;
+    virtual bool supportsScaling();
+    virtual void emitScaledFunction(unsigned int index) final;
+    virtual bool supportsFusedOps();
+    virtual void emitDotFunction(unsigned int index) final;
+    virtual void emitAxpyFunction(unsigned int index) final;
+    virtual bool supportsSemiring();
+    virtual void emitSemiringFunction(unsigned int index) final;
+    virtual bool supportsMatrixPowers();
     virtual void analyzeMatrix() final;
     virtual void convertMatrix();
 
@@ -202,27 +688,44 @@ namespace thundercat {
   class UnrollingWithGOTO: public CSRbyNZ {
   protected:
     virtual void emitMultByMFunction(unsigned int index) final;
+    virtual bool supportsSpMM() final;
+    virtual bool supportsScaling() final;
+    virtual bool supportsFusedOps() final;
+    virtual bool supportsSemiring() final;
     virtual void convertMatrix() final;
   };
   
   ///
   /// Gen OSKI
   ///
-  typedef std::map<unsigned long, std::pair<std::vector<std::pair<int, int> >, std::vector<double> > > GroupByBlockPatternMap;
+  // A block has at most 64 cells (e.g. 8x8); its pattern is keyed by the integer value of the bitset.
+  #define MAX_BLOCK_CELLS 64
+  typedef std::bitset<MAX_BLOCK_CELLS> BlockPattern;
+  typedef std::map<unsigned long long, std::pair<std::vector<std::pair<int, int> >, std::vector<double> > > GroupByBlockPatternMap;
   
   class GenOSKI: public Specializer {
   public:
     GenOSKI(unsigned int b_r, unsigned int b_c);
     
+    // The block size is selected automatically at analysis time
+    GenOSKI();
+    
   protected:
     virtual void emitMultByMFunction(unsigned int index) final;
+    virtual bool supportsSpMM() final;
+    virtual void emitSpMMFunction(unsigned int index) final;
     virtual void analyzeMatrix() final;
     virtual void convertMatrix() final;
 
   private:
+    void mergePatterns();
+    
     unsigned int b_r, b_c;
     std::vector<GroupByBlockPatternMap> groupByBlockPatternMaps;
     std::vector<unsigned int> numBlocks;
+    // Start of each stripe in the vals array; differs from the CSR
+    // index when merged patterns add explicit zeros
+    std::vector<unsigned long> valBaseIndices;
   };
 
   ///
@@ -230,15 +733,31 @@ namespace thundercat {
   ///
   // Map row patterns to row indices
   typedef std::map<std::vector<int>, std::vector<int> > RowPatternInfo;
+  // Map row patterns to the coefficients shared by all of their rows
+  typedef std::map<std::vector<int>, std::vector<double> > RowPatternCoefficients;
   
   class RowPattern: public Specializer {
   protected:
     virtual void emitMultByMFunction(unsigned int index) final;
+    virtual bool supportsSpMM() final;
+    virtual void emitSpMMFunction(unsigned int index) final;
+    virtual bool supportsScaling() final;
+    virtual void emitScaledFunction(unsigned int index) final;
+    virtual bool supportsFusedOps() final;
+    virtual void emitDotFunction(unsigned int index) final;
+    virtual void emitAxpyFunction(unsigned int index) final;
     virtual void analyzeMatrix() final;
     virtual void convertMatrix() final;
     
   private:
+    void mergePatterns();
+    void findConstantCoefficients();
+    
     std::vector<RowPatternInfo> patternInfos;
+    std::vector<RowPatternCoefficients> constantCoefficients;
+    // Start of each stripe in the vals array; differs from the CSR
+    // index when merged patterns add explicit zeros
+    std::vector<unsigned long> valBaseIndices;
   };
   
 
@@ -248,14 +767,28 @@ namespace thundercat {
   class Unfolding: public Specializer {
   protected:
     virtual void emitMultByMFunction(unsigned int index) final;
+    virtual bool supportsSpMM() final;
+    virtual void emitSpMMFunction(unsigned int index) final;
     virtual void analyzeMatrix() final;
     virtual void convertMatrix() final;
 
   private:
     std::vector<std::map<double, unsigned long> > valToIndexMaps;
     std::vector<std::vector<double> > distinctValueLists;
+    // Whether each row of a stripe is unfolded, indexed from the first row of the stripe
+    std::vector<std::vector<bool> > unfoldedRows;
+    // Rows that do not fit the code budget, grouped by length as in CSRbyNZ
+    std::vector<NZtoRowMap> fallbackRowByNZLists;
+    std::vector<unsigned long> fallbackRowBaseIndices;
+    std::vector<unsigned long> fallbackValBaseIndices;
+    // Index in vals of the values of the unfolded rows of each stripe, unless there are few distinct values
+    std::vector<unsigned long> unfoldedValBaseIndices;
+    unsigned long numUnfoldingVals;
     
     bool hasFewDistinctValues();
+    void selectUnfoldedRows();
+    // Emits the SpMV code, or the SpMM code if numVectors > 1
+    void emitFunction(asmjit::CodeHolder *codeHolder, unsigned int index, unsigned int numVectors);
   };
 
   ///
@@ -283,6 +816,48 @@ namespace thundercat {
   private:
     std::vector<unsigned long> maxRowLengths;
   };
+
+  ///
+  /// LCSR: the LCSR format with a generated loop whose bounds,
+  /// i.e. the row lengths, are read from a table instead of being unrolled
+  ///
+  class LCSR: public Specializer {
+  protected:
+    virtual void emitMultByMFunction(unsigned int index) final;
+    virtual bool supportsScaling() final;
+    virtual void emitScaledFunction(unsigned int index) final;
+    virtual bool supportsFusedOps() final;
+    virtual void emitDotFunction(unsigned int index) final;
+    virtual void emitAxpyFunction(unsigned int index) final;
+    virtual void analyzeMatrix() final;
+    virtual void convertMatrix() final;
+    
+  private:
+    std::vector<NZtoRowMap> rowByNZLists;
+    std::vector<LCSRInfo*> lcsrInfos;
+  };
+
+  ///
+  /// ColumnRun: the column-run format, with a loop that reads the
+  /// v elements of each run with packed loads
+  ///
+  class ColumnRun: public Specializer {
+  protected:
+    virtual void emitMultByMFunction(unsigned int index) final;
+    virtual bool supportsScaling() final;
+    virtual void emitScaledFunction(unsigned int index) final;
+    virtual bool supportsFusedOps() final;
+    virtual void emitDotFunction(unsigned int index) final;
+    virtual void emitAxpyFunction(unsigned int index) final;
+    virtual bool visitsEmptyRows() final;
+    virtual void analyzeMatrix() final;
+    virtual void convertMatrix() final;
+    
+  private:
+    bool useRuns;
+    std::vector<int> numRowRuns;
+    std::vector<unsigned long> maxRunLengths;
+  };
 }
 
 #endif
@@ -0,0 +1,148 @@
+#include "patternMerger.h"
+#include <algorithm>
+#include <iterator>
+#include <iostream>
+
+using namespace thundercat;
+using namespace std;
+
+// Number of cells in the union of two sorted patterns
+static unsigned long unionSize(const vector<int> &cells1, const vector<int> &cells2) {
+  unsigned long size = 0;
+  auto it1 = cells1.begin(), it2 = cells2.begin();
+  while (it1 != cells1.end() && it2 != cells2.end()) {
+    if (*it1 < *it2) {
+      it1++;
+    } else if (*it2 < *it1) {
+      it2++;
+    } else {
+      it1++;
+      it2++;
+    }
+    size++;
+  }
+  return size + (cells1.end() - it1) + (cells2.end() - it2);
+}
+
+bool PatternMerger::fitsAll(const Entry &entry, const vector<int> &cells) {
+  for (auto &fits : entry.fits)
+    if (!fits(cells))
+      return false;
+  return true;
+}
+
+PatternMerger::PatternMerger(unsigned long targetLoopCount, double fillBudget) {
+  this->targetLoopCount = targetLoopCount;
+  this->fillBudget = fillBudget;
+}
+
+void PatternMerger::addPattern(const vector<int> &cells, unsigned long popularity, PatternFitsFun fits) {
+  Entry entry;
+  entry.cells = cells;
+  entry.popularity = popularity;
+  entry.fits.push_back(fits);
+  entry.alive = true;
+  entry.stuck = false;
+  entry.mergedInto = -1;
+  entries.push_back(entry);
+  
+  stats.numLoopsBefore++;
+  stats.unrolledElementsBefore += cells.size();
+}
+
+// Greedy: the pattern that covers the fewest elements is merged with
+// the pattern that results in the least fill, until the target is met.
+vector<vector<int> > PatternMerger::merge(unsigned long numNonzeros) {
+  unsigned long numAlive = entries.size();
+  unsigned long remainingBudget = (unsigned long)(fillBudget * numNonzeros);
+  
+  while (numAlive > targetLoopCount) {
+    int rarest = -1;
+    for (int i = 0; i < entries.size(); i++) {
+      Entry &entry = entries[i];
+      if (!entry.alive || entry.stuck)
+        continue;
+      if (rarest == -1 ||
+          entry.popularity * entry.cells.size() < entries[rarest].popularity * entries[rarest].cells.size())
+        rarest = i;
+    }
+    if (rarest == -1)
+      break;
+    
+    Entry &source = entries[rarest];
+    int bestTarget = -1;
+    unsigned long bestCost = 0;
+    for (int i = 0; i < entries.size(); i++) {
+      Entry &target = entries[i];
+      if (i == rarest || !target.alive)
+        continue;
+      unsigned long mergedSize = unionSize(source.cells, target.cells);
+      unsigned long cost = (mergedSize - source.cells.size()) * source.popularity +
+                           (mergedSize - target.cells.size()) * target.popularity;
+      if (bestTarget != -1 && cost >= bestCost)
+        continue;
+      vector<int> cellsUnion;
+      set_union(source.cells.begin(), source.cells.end(),
+                target.cells.begin(), target.cells.end(),
+                back_inserter(cellsUnion));
+      if (fitsAll(source, cellsUnion) && fitsAll(target, cellsUnion)) {
+        bestTarget = i;
+        bestCost = cost;
+      }
+    }
+    
+    if (bestTarget == -1 || bestCost > remainingBudget) {
+      source.stuck = true;
+      continue;
+    }
+    
+    Entry &target = entries[bestTarget];
+    vector<int> cellsUnion;
+    set_union(source.cells.begin(), source.cells.end(),
+              target.cells.begin(), target.cells.end(),
+              back_inserter(cellsUnion));
+    target.cells.swap(cellsUnion);
+    target.popularity += source.popularity;
+    target.fits.insert(target.fits.end(), source.fits.begin(), source.fits.end());
+    target.stuck = false;
+    source.alive = false;
+    source.mergedInto = bestTarget;
+    remainingBudget -= bestCost;
+    stats.numFillElements += bestCost;
+    numAlive--;
+  }
+  
+  vector<vector<int> > mergedPatterns;
+  for (int i = 0; i < entries.size(); i++) {
+    int j = i;
+    while (!entries[j].alive)
+      j = entries[j].mergedInto;
+    mergedPatterns.push_back(entries[j].cells);
+  }
+  
+  for (auto &entry : entries) {
+    if (entry.alive) {
+      stats.numLoopsAfter++;
+      stats.unrolledElementsAfter += entry.cells.size();
+    }
+  }
+  return mergedPatterns;
+}
+
+PatternMergeStats &PatternMerger::getStats() {
+  return stats;
+}
+
+void PatternMerger::printReport(const vector<PatternMergeStats> &stats) {
+  PatternMergeStats total;
+  for (auto &stripeStats : stats) {
+    total.numLoopsBefore += stripeStats.numLoopsBefore;
+    total.numLoopsAfter += stripeStats.numLoopsAfter;
+    total.unrolledElementsBefore += stripeStats.unrolledElementsBefore;
+    total.unrolledElementsAfter += stripeStats.unrolledElementsAfter;
+    total.numFillElements += stripeStats.numFillElements;
+  }
+  cout << "Pattern merging: loops " << total.numLoopsBefore << " -> " << total.numLoopsAfter
+       << ", unrolled elements " << total.unrolledElementsBefore << " -> " << total.unrolledElementsAfter
+       << ", fill " << total.numFillElements * sizeof(double) << " bytes\n";
+}
@@ -0,0 +1,67 @@
+#ifndef _PATTERN_MERGER_H_
+#define _PATTERN_MERGER_H_
+
+#include <vector>
+#include <functional>
+
+namespace thundercat {
+  struct PatternMergeStats {
+    // Each pattern is a loop in the generated code
+    unsigned long numLoopsBefore = 0;
+    unsigned long numLoopsAfter = 0;
+    // Multiply-adds unrolled in the loop bodies, summed over all loops
+    unsigned long unrolledElementsBefore = 0;
+    unsigned long unrolledElementsAfter = 0;
+    // Explicit zeros added to the matrix values
+    unsigned long numFillElements = 0;
+  };
+  
+  // Tells whether all rows (or blocks) of a pattern can hold the given cells,
+  // i.e. whether the cells stay inside the matrix and the rows of the stripe.
+  typedef std::function<bool(const std::vector<int> &cells)> PatternFitsFun;
+  
+  ///
+  /// Folds rare patterns into covering patterns to reduce the number of
+  /// generated loops. Elements that a merged pattern has but a row (or block)
+  /// does not are stored as explicit zeros. Merging stops when the target loop
+  /// count is reached or the fill budget is exhausted.
+  /// A pattern is given as the sorted list of its cells (column offsets for
+  /// RowPattern, cell positions for GenOSKI blocks), with its popularity,
+  /// i.e. the number of rows or blocks that have it.
+  ///
+  class PatternMerger {
+  public:
+    // fillBudget is the max number of explicit zeros, relative to the number of nonzeros.
+    PatternMerger(unsigned long targetLoopCount, double fillBudget);
+    
+    void addPattern(const std::vector<int> &cells, unsigned long popularity, PatternFitsFun fits);
+    
+    // Returns, for each pattern in the order they were added,
+    // the pattern it is merged into (the pattern itself if it is not merged).
+    std::vector<std::vector<int> > merge(unsigned long numNonzeros);
+    
+    PatternMergeStats &getStats();
+    
+    static void printReport(const std::vector<PatternMergeStats> &stats);
+    
+  private:
+    struct Entry {
+      std::vector<int> cells;
+      unsigned long popularity;
+      // Constraints of all the patterns merged into this entry
+      std::vector<PatternFitsFun> fits;
+      bool alive;
+      bool stuck;
+      int mergedInto;
+    };
+    
+    static bool fitsAll(const Entry &entry, const std::vector<int> &cells);
+    
+    std::vector<Entry> entries;
+    unsigned long targetLoopCount;
+    double fillBudget;
+    PatternMergeStats stats;
+  };
+}
+
+#endif
@@ -1,20 +1,59 @@
 #include "method.h"
+#include "streamPrefetcher.h"
 
 using namespace thundercat;
 using namespace std;
 
 void PlainCSR::spmv(double* __restrict v, double* __restrict w) {
+  spmvRows<PlusTimesSemiring>(v, AddRowUpdate{w}, NULL);
+}
+
+void PlainCSR::spmvDot(double* __restrict v, double* __restrict w, double *vDotW) {
+  stripePartials.resize(stripeInfos->size());
+  spmvRows<PlusTimesSemiring>(v, DotRowUpdate{w, v}, stripePartials.data());
+  *vDotW = sumStripePartials();
+}
+
+void PlainCSR::spmvAxpy(double* __restrict v, double* __restrict w, double a, double* __restrict y) {
+  spmvRows<PlusTimesSemiring>(v, AxpyRowUpdate{w, a, y}, NULL);
+}
+
+void PlainCSR::spmvSemiring(double* __restrict v, double* __restrict w, SemiringKind semiring) {
+  dispatchSemiring(semiring, [&](auto semiringOps) {
+    typedef decltype(semiringOps) Semiring;
+    spmvRows<Semiring>(v, SemiringRowUpdate<Semiring>{w}, NULL);
+  });
+}
+
+bool PlainCSR::supportsMatrixPowers() {
+  return true;
+}
+
+template <typename Semiring, typename RowUpdate>
+void PlainCSR::spmvRows(double* __restrict v, RowUpdate update, double *partials) {
+  const bool nonTemporal = kernelOptions.nonTemporal;
+  const unsigned int prefetchDistance = kernelOptions.getPrefetchDistance();
 #pragma omp parallel for
   for (unsigned int t = 0; t < stripeInfos->size(); t++) {
     int rowIndexBegin = stripeInfos->at(t).rowIndexBegin;
     int rowIndexEnd = stripeInfos->at(t).rowIndexEnd;
+    int valIndexBegin = stripeInfos->at(t).valIndexBegin;
+    StreamPrefetcher<double> valsPrefetcher(matrix->vals + valIndexBegin, prefetchDistance);
+    StreamPrefetcher<int> colsPrefetcher(matrix->cols + valIndexBegin, prefetchDistance);
+    double partial = 0.0;
     for (int i = rowIndexBegin; i < rowIndexEnd; i++) {
-      double ww = 0.0;
+      if (nonTemporal) {
+        valsPrefetcher.advance(matrix->vals + matrix->rows[i]);
+        colsPrefetcher.advance(matrix->cols + matrix->rows[i]);
+      }
+      double ww = Semiring::zero();
       for (int k = matrix->rows[i]; k < matrix->rows[i + 1]; k++) {
-        ww += matrix->vals[k] * v[matrix->cols[k]];
+        ww = Semiring::addProduct(ww, matrix->vals[k], v[matrix->cols[k]]);
       }
-      w[i] += ww;
+      partial += update(i, ww);
     }
+    if (partials)
+      partials[t] = partial;
   }
 }
 
@@ -4,10 +4,15 @@
 #include <chrono>
 using namespace thundercat;
 
+bool Profiler::enabled = true;
 int Profiler::timingLevel = 0;
 std::vector<TimingInfo> Profiler::timingInfos;
 
 void Profiler::recordTime(std::string description, std::function<void()> codeBlock) {
+  if (!enabled) {
+    codeBlock();
+    return;
+  }
   timingLevel++;
   auto start = std::chrono::high_resolution_clock::now();
   codeBlock();
@@ -21,6 +26,14 @@ void Profiler::recordTime(std::string description, std::function<void()> codeBlo
   timingLevel--;
 }
 
+void Profiler::disable() {
+  enabled = false;
+}
+
+void Profiler::enable() {
+  enabled = true;
+}
+
 void Profiler::print(unsigned int numIters) {
   for (auto &info : timingInfos) {
     std::cout << info.level << " ";
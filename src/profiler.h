@@ -17,7 +17,11 @@ namespace thundercat {
   public:
     static void recordTime(std::string description, std::function<void()> codeBlock);
     static void print(unsigned int numIters);
+    // While disabled, code blocks are run without being recorded
+    static void disable();
+    static void enable();
   private:
+    static bool enabled;
     static int timingLevel;
     static std::vector<TimingInfo> timingInfos;
   };
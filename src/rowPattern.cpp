@@ -1,11 +1,55 @@
 #include "method.h"
+#include "emitterUtils.h"
+#include "patternMerger.h"
 #include <iostream>
+#include <algorithm>
 
 using namespace thundercat;
 using namespace std;
 using namespace asmjit;
 using namespace x86;
 
+extern bool __DEBUG__;
+extern bool DUMP_OBJECT;
+
+// Number of consecutive rows computed together by a vectorized loop;
+// two SSE registers hold their v elements for an offset of the pattern.
+#define ROW_RUN_LENGTH 4
+// A vectorized loop keeps its accumulator pairs in %xmm0..%xmm11,
+// followed by 4 temporaries.
+#define MAX_ROW_RUN_ACCUMULATOR_PAIRS 6
+
+// Split the rows of a pattern (in ascending order) into runs of ROW_RUN_LENGTH
+// consecutive rows, given by their first row, and the remaining single rows.
+static void splitRowRuns(const vector<int> &rowIndices, bool vectorize,
+                         vector<int> &runStarts, vector<int> &singleRows) {
+  unsigned long i = 0;
+  while (i < rowIndices.size()) {
+    if (vectorize && i + ROW_RUN_LENGTH <= rowIndices.size() &&
+        rowIndices[i + ROW_RUN_LENGTH - 1] == rowIndices[i] + ROW_RUN_LENGTH - 1) {
+      runStarts.push_back(rowIndices[i]);
+      i += ROW_RUN_LENGTH;
+    } else {
+      singleRows.push_back(rowIndices[i]);
+      i++;
+    }
+  }
+}
+
+// Values of a row for the cells of the pattern; the cells that the row does not have are zero
+static vector<double> getRowVals(Matrix *csrMatrix, int rowIndex, const vector<int> &pattern) {
+  vector<double> rowVals;
+  int k = csrMatrix->rows[rowIndex];
+  for (int offset : pattern) {
+    if (k < csrMatrix->rows[rowIndex+1] && csrMatrix->cols[k] - rowIndex == offset) {
+      rowVals.push_back(csrMatrix->vals[k++]);
+    } else {
+      rowVals.push_back(0.0);
+    }
+  }
+  return rowVals;
+}
+
 ///
 /// Analysis
 ///
@@ -29,31 +73,144 @@ void RowPattern::analyzeMatrix() {
       }
     }
   }
+  
+  if (kernelOptions.mergeTargetLoopCount > 0)
+    mergePatterns();
+  
+  constantCoefficients.clear();
+  constantCoefficients.resize(stripeInfos->size());
+  if (kernelOptions.constantCoefficients)
+    findConstantCoefficients();
+}
+
+void RowPattern::findConstantCoefficients() {
+  vector<unsigned long> numConstantRows(stripeInfos->size(), 0);
+  
+#pragma omp parallel for
+  for (int threadIndex = 0; threadIndex < stripeInfos->size(); ++threadIndex) {
+    for (auto &info : patternInfos[threadIndex]) {
+      // A single row does not read fewer values by having its own constants
+      if (info.second.size() < 2)
+        continue;
+      vector<double> coefficients = getRowVals(csrMatrix, info.second[0], info.first);
+      bool isConstant = true;
+      for (unsigned long i = 1; isConstant && i < info.second.size(); ++i) {
+        isConstant = getRowVals(csrMatrix, info.second[i], info.first) == coefficients;
+      }
+      if (isConstant) {
+        constantCoefficients[threadIndex][info.first] = coefficients;
+        numConstantRows[threadIndex] += info.second.size();
+      }
+    }
+  }
+  
+  if (!__DEBUG__ && !DUMP_OBJECT) {
+    unsigned long numPatterns = 0, numRows = 0;
+    for (unsigned int t = 0; t < stripeInfos->size(); ++t) {
+      numPatterns += constantCoefficients[t].size();
+      numRows += numConstantRows[t];
+    }
+    cout << "Constant coefficients: " << numPatterns << " patterns, " << numRows << " rows\n";
+  }
+}
+
+void RowPattern::mergePatterns() {
+  vector<PatternMergeStats> stats(stripeInfos->size());
+  
+#pragma omp parallel for
+  for (int threadIndex = 0; threadIndex < stripeInfos->size(); ++threadIndex) {
+    auto &stripeInfo = stripeInfos->at(threadIndex);
+    RowPatternInfo &patternInfo = patternInfos[threadIndex];
+    PatternMerger merger(kernelOptions.mergeTargetLoopCount, kernelOptions.mergeFillBudget);
+    for (auto &info : patternInfo) {
+      // Rows are in ascending order; a merged pattern must not
+      // read v out of bounds for the first and the last row.
+      int minOffset = -info.second.front();
+      int maxOffset = csrMatrix->m - 1 - info.second.back();
+      merger.addPattern(info.first, info.second.size(), [minOffset, maxOffset](const vector<int> &cells) {
+        return cells.front() >= minOffset && cells.back() <= maxOffset;
+      });
+    }
+    vector<vector<int> > mergedPatterns = merger.merge(stripeInfo.valIndexEnd - stripeInfo.valIndexBegin);
+    
+    RowPatternInfo mergedPatternInfo;
+    unsigned int i = 0;
+    for (auto &info : patternInfo) {
+      vector<int> &rows = mergedPatternInfo[mergedPatterns[i++]];
+      rows.insert(rows.end(), info.second.begin(), info.second.end());
+    }
+    for (auto &info : mergedPatternInfo) {
+      sort(info.second.begin(), info.second.end());
+    }
+    patternInfo.swap(mergedPatternInfo);
+    stats[threadIndex] = merger.getStats();
+  }
+  
+  if (!__DEBUG__ && !DUMP_OBJECT)
+    PatternMerger::printReport(stats);
 }
 
 ///
 /// RowPattern
 ///
 void RowPattern::convertMatrix() {
-  double *vals = new double[csrMatrix->nz];
+  // Merged patterns store explicit zeros, so the stripes
+  // may not start at their CSR indices in the vals array.
+  unsigned long numVals = 0;
+  valBaseIndices.clear();
+  for (unsigned int t = 0; t < patternInfos.size(); ++t) {
+    valBaseIndices.push_back(numVals);
+    for (auto &stencilInfo : patternInfos[t]) {
+      // Rows with constant coefficients do not have values in the vals array
+      if (constantCoefficients[t].count(stencilInfo.first) == 0)
+        numVals += stencilInfo.first.size() * stencilInfo.second.size();
+    }
+  }
+  
+  double *vals = new double[numVals];
   int *rows = new int[csrMatrix->n];
   
 #pragma omp parallel for
   for (unsigned int t = 0; t < stripeInfos->size(); ++t) {
     auto &stencils = patternInfos.at(t);
-    double *valPtr = vals + stripeInfos->at(t).valIndexBegin;
+    double *valPtr = vals + valBaseIndices[t];
     int *rowPtr = rows + stripeInfos->at(t).rowIndexBegin;
     
     for (auto &stencilInfo : stencils) {
+      const vector<int> &stencil = stencilInfo.first;
+      vector<int> runStarts, singleRows;
+      splitRowRuns(stencilInfo.second, kernelOptions.vectorizeRowRuns, runStarts, singleRows);
+      
+      bool hasVals = constantCoefficients[t].count(stencil) == 0;
+      
+      // Runs come first; their values are interleaved
+      // so that the rows of a run are contiguous for each offset.
+      for (auto runStart : runStarts) {
+        if (hasVals) {
+          vector<vector<double> > runVals;
+          for (int r = 0; r < ROW_RUN_LENGTH; r++) {
+            runVals.push_back(getRowVals(csrMatrix, runStart + r, stencil));
+          }
+          for (unsigned long i = 0; i < stencil.size(); i++) {
+            for (int r = 0; r < ROW_RUN_LENGTH; r++) {
+              *valPtr++ = runVals[r][i];
+            }
+          }
+        }
+        *rowPtr++ = runStart;
+      }
+      
       // build vals array
-      for (auto rowIndex: stencilInfo.second) {
-        for (int k = csrMatrix->rows[rowIndex]; k < csrMatrix->rows[rowIndex+1]; ++k) {
-          *valPtr++ = csrMatrix->vals[k];
+      if (hasVals) {
+        for (auto rowIndex: singleRows) {
+          for (double val : getRowVals(csrMatrix, rowIndex, stencil)) {
+            *valPtr++ = val;
+          }
         }
       }
       // build rows array
-      if (stencilInfo.second.size() > 1) {
-        for (auto rowIndex: stencilInfo.second) {
+      if (singleRows.size() > 1) {
+        for (auto rowIndex: singleRows) {
           *rowPtr++ = rowIndex;
         }
       }
@@ -63,7 +220,7 @@ void RowPattern::convertMatrix() {
   matrix = new Matrix(rows, NULL, vals, csrMatrix->n, csrMatrix->m, csrMatrix->nz);
   matrix->numRows = csrMatrix->n;
   matrix->numCols = 0;
-  matrix->numVals = csrMatrix->nz;
+  matrix->numVals = numVals;
 }
 
 ///
@@ -74,27 +231,68 @@ class RowPatternCodeEmitter {
 public:
   RowPatternCodeEmitter(X86Assembler *assembler,
                         RowPatternInfo *patternInfo,
+                        RowPatternCoefficients *coefficients,
                         unsigned long baseValsIndex,
-                        unsigned long baseRowsIndex) {
+                        unsigned long baseRowsIndex,
+                        const KernelOptions &options) {
     this->assembler = assembler;
     this->patternInfo = patternInfo;
+    this->coefficients = coefficients;
     this->baseValsIndex = baseValsIndex;
     this->baseRowsIndex = baseRowsIndex;
+    this->options = options;
+    this->fusedOp = NO_FUSED_OP;
   }
   
   void emit();
   
+  // SpMM code for options.numVectors vectors in row-major blocks
+  void emitSpMM();
+  
+  // Makes emit generate w = alpha·A·v + beta·w instead of w += A·v
+  void setOutputScaling(double alpha, double beta) {
+    scaling.alpha = alpha;
+    scaling.beta = beta;
+    scaling.constants = assembler->newLabel();
+  }
+  
+  // Makes emit generate the code of spmvDot or spmvAxpy (see MultByMDotFun and MultByMAxpyFun)
+  void setFusedOp(FusedOp fusedOp) {
+    this->fusedOp = fusedOp;
+  }
+  
 private:
   X86Assembler *assembler;
   RowPatternInfo *patternInfo;
+  RowPatternCoefficients *coefficients;
   unsigned long baseValsIndex;
   unsigned long baseRowsIndex;
+  KernelOptions options;
+  OutputScaling scaling;
+  FusedOp fusedOp;
+  // Labels of the constant coefficients, to be emitted after the code
+  vector<pair<Label, vector<double>*> > constantPools;
   
   void emitHeader();
   
   void emitFooter();
   
-  void emitSingleLoop(const vector<int> &pattern, const vector<int> &rowIndices);
+  void emitConstantPools();
+  
+  // If constants is not NULL, coefficients are read from that constant pool instead of vals
+  void emitSingleLoop(const vector<int> &pattern, const vector<int> &rowIndices, const Label *constants);
+  
+  void emitRowRunLoop(const vector<int> &pattern, const vector<int> &runStarts, const Label *constants);
+  
+  // The SpMM counterparts of the loops above
+  void emitSpMMSingleLoop(const vector<int> &pattern, const vector<int> &rowIndices, const Label *constants);
+  
+  void emitSpMMRowRunLoop(const vector<int> &pattern, const vector<int> &runStarts, const Label *constants);
+  
+  // Products of a row of the pattern. The k entries of row r of V start at
+  // byte offset r*k*8 from rowBase; coefficient i of the row is at valIndex + i * valStride.
+  void emitSpMMRow(const vector<int> &pattern, const Label *constants,
+                   int rowBase, unsigned long valIndex, unsigned long valStride, bool indexed);
 };
 
 void RowPattern::emitMultByMFunction(unsigned int index) {
@@ -102,8 +300,73 @@ void RowPattern::emitMultByMFunction(unsigned int index) {
   RowPatternInfo &patternInfo = patternInfos.at(index);
   RowPatternCodeEmitter emitter(&assembler,
                                 &patternInfo,
-                                stripeInfos->at(index).valIndexBegin,
-                                stripeInfos->at(index).rowIndexBegin);
+                                &constantCoefficients.at(index),
+                                valBaseIndices[index],
+                                stripeInfos->at(index).rowIndexBegin,
+                                kernelOptions);
+  emitter.emit();
+}
+
+bool RowPattern::supportsSpMM() {
+  return true;
+}
+
+void RowPattern::emitSpMMFunction(unsigned int index) {
+  X86Assembler assembler(spmmCodeHolders[index]);
+  RowPatternInfo &patternInfo = patternInfos.at(index);
+  RowPatternCodeEmitter emitter(&assembler,
+                                &patternInfo,
+                                &constantCoefficients.at(index),
+                                valBaseIndices[index],
+                                stripeInfos->at(index).rowIndexBegin,
+                                kernelOptions);
+  emitter.emitSpMM();
+}
+
+bool RowPattern::supportsScaling() {
+  return true;
+}
+
+void RowPattern::emitScaledFunction(unsigned int index) {
+  X86Assembler assembler(scaledCodeHolders[index]);
+  RowPatternInfo &patternInfo = patternInfos.at(index);
+  RowPatternCodeEmitter emitter(&assembler,
+                                &patternInfo,
+                                &constantCoefficients.at(index),
+                                valBaseIndices[index],
+                                stripeInfos->at(index).rowIndexBegin,
+                                kernelOptions);
+  emitter.setOutputScaling(kernelOptions.alpha, kernelOptions.beta);
+  emitter.emit();
+}
+
+bool RowPattern::supportsFusedOps() {
+  return true;
+}
+
+void RowPattern::emitDotFunction(unsigned int index) {
+  X86Assembler assembler(dotCodeHolders[index]);
+  RowPatternInfo &patternInfo = patternInfos.at(index);
+  RowPatternCodeEmitter emitter(&assembler,
+                                &patternInfo,
+                                &constantCoefficients.at(index),
+                                valBaseIndices[index],
+                                stripeInfos->at(index).rowIndexBegin,
+                                kernelOptions);
+  emitter.setFusedOp(FUSED_DOT);
+  emitter.emit();
+}
+
+void RowPattern::emitAxpyFunction(unsigned int index) {
+  X86Assembler assembler(axpyCodeHolders[index]);
+  RowPatternInfo &patternInfo = patternInfos.at(index);
+  RowPatternCodeEmitter emitter(&assembler,
+                                &patternInfo,
+                                &constantCoefficients.at(index),
+                                valBaseIndices[index],
+                                stripeInfos->at(index).rowIndexBegin,
+                                kernelOptions);
+  emitter.setFusedOp(FUSED_AXPY);
   emitter.emit();
 }
 
@@ -111,10 +374,46 @@ void RowPatternCodeEmitter::emit() {
   emitHeader();
   
   for (auto &info : *patternInfo) {
-    emitSingleLoop(info.first, info.second);
+    vector<int> runStarts, singleRows;
+    splitRowRuns(info.second, options.vectorizeRowRuns, runStarts, singleRows);
+    Label constantsLabel;
+    const Label *constants = NULL;
+    auto coefficientsIt = coefficients->find(info.first);
+    if (coefficientsIt != coefficients->end()) {
+      constantsLabel = assembler->newLabel();
+      constantPools.push_back(make_pair(constantsLabel, &coefficientsIt->second));
+      constants = &constantsLabel;
+    }
+    emitRowRunLoop(info.first, runStarts, constants);
+    emitSingleLoop(info.first, singleRows, constants);
+  }
+  
+  emitFooter();
+  emitConstantPools();
+  emitScalingConstants(assembler, scaling);
+}
+
+// Visits the groups in the same order as emit, so that the same matrix arrays are used
+void RowPatternCodeEmitter::emitSpMM() {
+  emitHeader();
+  
+  for (auto &info : *patternInfo) {
+    vector<int> runStarts, singleRows;
+    splitRowRuns(info.second, options.vectorizeRowRuns, runStarts, singleRows);
+    Label constantsLabel;
+    const Label *constants = NULL;
+    auto coefficientsIt = coefficients->find(info.first);
+    if (coefficientsIt != coefficients->end()) {
+      constantsLabel = assembler->newLabel();
+      constantPools.push_back(make_pair(constantsLabel, &coefficientsIt->second));
+      constants = &constantsLabel;
+    }
+    emitSpMMRowRunLoop(info.first, runStarts, constants);
+    emitSpMMSingleLoop(info.first, singleRows, constants);
   }
   
   emitFooter();
+  emitConstantPools();
 }
 
 void RowPatternCodeEmitter::emitHeader() {
@@ -125,6 +424,8 @@ void RowPatternCodeEmitter::emitHeader() {
   assembler->lea(r8, ptr(rdx, sizeof(int) * baseRowsIndex)); // using %r8 for rows
   assembler->push(r11);
   assembler->push(rdx);
+  // y, the 6th argument, stays in %r9.
+  emitFusedOpInit(assembler, fusedOp);
 }
 
 void RowPatternCodeEmitter::emitFooter() {
@@ -132,11 +433,26 @@ void RowPatternCodeEmitter::emitFooter() {
   assembler->pop(r11);
   assembler->pop(r8);
   assembler->pop(rbx);
+  emitFusedOpResult(assembler, fusedOp);
   assembler->ret();
 }
 
+// Each coefficient is stored twice in a 16-byte aligned slot,
+// so that both the scalar and the packed instructions can use it as a memory operand.
+void RowPatternCodeEmitter::emitConstantPools() {
+  for (auto &constantPool : constantPools) {
+    assembler->align(kAlignData, 16);
+    assembler->bind(constantPool.first);
+    for (double coefficient : *constantPool.second) {
+      assembler->embed(&coefficient, sizeof(double));
+      assembler->embed(&coefficient, sizeof(double));
+    }
+  }
+}
+
 void RowPatternCodeEmitter::emitSingleLoop(const vector<int> &pattern,
-                                           const vector<int> &rowIndices) {
+                                           const vector<int> &rowIndices,
+                                           const Label *constants) {
   unsigned long popularity = rowIndices.size();
   unsigned long patternSize = pattern.size();
   if(patternSize == 0 || popularity == 0) return;
@@ -144,10 +460,7 @@ void RowPatternCodeEmitter::emitSingleLoop(const vector<int> &pattern,
   int row = rowIndices[0];
   Label loopStart;
   
-  if (popularity == 1) {
-    //  movsd  "8*(row+stencil[0])"(%rdi), %xmm1
-    assembler->movsd(xmm1, ptr(rdi, 8 * (row + pattern[0])));
-  } else {
+  if (popularity > 1) {
     //  xorl %r11d, %r11d
     assembler->xor_(r11d, r11d);
     //  .align 4, 0x90
@@ -157,43 +470,58 @@ void RowPatternCodeEmitter::emitSingleLoop(const vector<int> &pattern,
     
     //  movslq (%r11,%r8), %rdx
     assembler->movsxd(rdx, ptr(r11, r8));
-    //  movsd "8*(stencil[0])"(%rdi,%rdx,8), %xmm1
-    assembler->movsd(xmm1, ptr(rdi, rdx, 3, 8 * pattern[0]));
   }
   
-  //  mulsd (%RBX), %xmm1
-  assembler->mulsd(xmm1, ptr(rbx));
+  // Products are spread round-robin over independent accumulators,
+  // the result ends up in %xmm0.
+  unsigned int numAccumulators = numAccumulatorsForRow(patternSize, options.maxAccumulators);
+  X86Xmm temp = xmm(numAccumulators);
   
-  for(int i = 1; i < patternSize; ++i) {
+  for(int i = 0; i < patternSize; ++i) {
+    X86Xmm acc = xmm(i % numAccumulators);
+    // The first product of an accumulator initializes it.
+    X86Xmm dest = i < numAccumulators ? acc : temp;
+    if (!constants && options.getPrefetchDistance() > 0 && startsCacheLine(i, sizeof(double))) {
+      //  prefetch{t0|nta} "8*(i+distance)"(%RBX)
+      emitPrefetch(assembler, ptr(rbx, 8 * (i + options.getPrefetchDistance())), options.nonTemporal);
+    }
     if (popularity == 1) {
-      //  movsd "8*(row+stencil[i])"(%rdi), %xmm0
-      assembler->movsd(xmm0, ptr(rdi, 8 * (row + pattern[i])));
+      //  movsd "8*(row+stencil[i])"(%rdi), %xmm"dest"
+      assembler->movsd(dest, ptr(rdi, 8 * (row + pattern[i])));
     } else {
-      //  movsd "8*(stencil[i])"(%rdi,%rdx,8), %xmm0
-      assembler->movsd(xmm0, ptr(rdi, rdx, 3, 8 * pattern[i]));
+      //  movsd "8*(stencil[i])"(%rdi,%rdx,8), %xmm"dest"
+      assembler->movsd(dest, ptr(rdi, rdx, 3, 8 * pattern[i]));
+    }
+    if (constants) {
+      //  mulsd "16*(i)"(CONSTANTS), %xmm"dest"
+      assembler->mulsd(dest, ptr(*constants, 16 * i));
+    } else {
+      //  mulsd "8*(i)"(%RBX), %xmm"dest"
+      assembler->mulsd(dest, ptr(rbx, 8 * i));
+    }
+    if (i >= numAccumulators) {
+      //  addsd %xmm"temp", %xmm"acc"
+      assembler->addsd(acc, temp);
     }
-    //  mulsd "8*(i)"(%RBX), %xmm0
-    assembler->mulsd(xmm0, ptr(rbx, 8 * i));
-    //  addsd %xmm0, %xmm1
-    assembler->addsd(xmm1, xmm0);
   }
+  emitAccumulatorReduce(assembler, numAccumulators);
   
   if (popularity > 1) {
-    //  addsd (%rsi,%rdx,8), %xmm1
-    assembler->addsd(xmm1, ptr(rsi, rdx, 3, 0));
+    //  addsd (%rsi,%rdx,8), %xmm0 ; movsd %xmm0, (%rsi,%rdx,8)
+    emitRowUpdate(assembler, scaling, ptr(rsi, rdx, 3, 0), xmm0, xmm1,
+                  fusedOp, ptr(fusedOp == FUSED_DOT ? rdi : r9, rdx, 3, 0));
     //  addq $"sizeof(int)", %r11
     assembler->add(r11, (int)sizeof(int));
-    //  movsd %xmm1, (%rsi,%rdx,8)
-    assembler->movsd(ptr(rsi, rdx, 3, 0), xmm1);
   }
-  //  leaq "sizeof(double)*stencilSize"(%RBX), %RBX
-  assembler->lea(rbx, ptr(rbx, (sizeof(double) * patternSize)));
+  if (!constants) {
+    //  leaq "sizeof(double)*stencilSize"(%RBX), %RBX
+    assembler->lea(rbx, ptr(rbx, (sizeof(double) * patternSize)));
+  }
   
   if (popularity == 1) {
-    //  addsd "sizeof(double)*row"(%rsi), %xmm1
-    assembler->addsd(xmm1, ptr(rsi, sizeof(double) * row));
-    //  movsd %xmm1, "sizeof(double)*row"(%rsi)
-    assembler->movsd(ptr(rsi, sizeof(double) * row), xmm1);
+    //  addsd "sizeof(double)*row"(%rsi), %xmm0 ; movsd %xmm0, "sizeof(double)*row"(%rsi)
+    emitRowUpdate(assembler, scaling, ptr(rsi, sizeof(double) * row), xmm0, xmm1,
+                  fusedOp, ptr(fusedOp == FUSED_DOT ? rdi : r9, sizeof(double) * row));
   } else {
     //  cmpl $"popularity*sizeof(int)", %r11d
     assembler->cmp(r11d, (int)(popularity * sizeof(int)));
@@ -205,3 +533,217 @@ void RowPatternCodeEmitter::emitSingleLoop(const vector<int> &pattern,
 }
 
 
+
+// Computes ROW_RUN_LENGTH consecutive rows per iteration. For each offset of
+// the pattern, the v elements of the rows are contiguous, so they are loaded
+// with two movupd's, multiplied with the interleaved vals, and accumulated into
+// a pair of registers holding the partial sums of the rows.
+void RowPatternCodeEmitter::emitRowRunLoop(const vector<int> &pattern,
+                                           const vector<int> &runStarts,
+                                           const Label *constants) {
+  unsigned long numRuns = runStarts.size();
+  unsigned long patternSize = pattern.size();
+  if(patternSize == 0 || numRuns == 0) return;
+  
+  // Accumulator pairs are %xmm(2p) and %xmm(2p+1), followed by 4 temporaries.
+  // A fused operation keeps its value in %xmm15, so one pair fewer is available.
+  unsigned int maxPairs = fusedOp == NO_FUSED_OP ? MAX_ROW_RUN_ACCUMULATOR_PAIRS : MAX_ROW_RUN_ACCUMULATOR_PAIRS - 1;
+  unsigned int numPairs = numAccumulatorsForRow(patternSize, min(options.maxAccumulators / 2, maxPairs));
+  X86Xmm vLow = xmm(2 * numPairs);
+  X86Xmm vHigh = xmm(2 * numPairs + 1);
+  X86Xmm valsLow = xmm(2 * numPairs + 2);
+  X86Xmm valsHigh = xmm(2 * numPairs + 3);
+  
+  //  xorl %r11d, %r11d
+  assembler->xor_(r11d, r11d);
+  //  .align 4, 0x90
+  assembler->align(kAlignCode, 16);
+  Label loopStart = assembler->newLabel();
+  assembler->bind(loopStart);
+  
+  //  movslq (%r11,%r8), %rdx
+  assembler->movsxd(rdx, ptr(r11, r8));
+  
+  for (int i = 0; i < patternSize; ++i) {
+    unsigned int pair = i % numPairs;
+    // The first products of a pair initialize it.
+    X86Xmm low = i < numPairs ? xmm(2 * pair) : vLow;
+    X86Xmm high = i < numPairs ? xmm(2 * pair + 1) : vHigh;
+    unsigned long valIndex = i * ROW_RUN_LENGTH;
+    if (!constants && options.getPrefetchDistance() > 0 && startsCacheLine(valIndex, sizeof(double))) {
+      //  prefetch{t0|nta} "8*(valIndex+distance)"(%RBX)
+      emitPrefetch(assembler, ptr(rbx, 8 * (valIndex + options.getPrefetchDistance())), options.nonTemporal);
+    }
+    //  movupd "8*(stencil[i])"(%rdi,%rdx,8), %xmm"low"
+    assembler->movupd(low, ptr(rdi, rdx, 3, 8 * pattern[i]));
+    //  movupd "8*(stencil[i]+2)"(%rdi,%rdx,8), %xmm"high"
+    assembler->movupd(high, ptr(rdi, rdx, 3, 8 * (pattern[i] + 2)));
+    if (constants) {
+      //  mulpd "16*(i)"(CONSTANTS), %xmm"low"
+      assembler->mulpd(low, ptr(*constants, 16 * i));
+      //  mulpd "16*(i)"(CONSTANTS), %xmm"high"
+      assembler->mulpd(high, ptr(*constants, 16 * i));
+    } else {
+      //  movupd "8*(valIndex)"(%RBX), %xmm"valsLow"
+      assembler->movupd(valsLow, ptr(rbx, 8 * valIndex));
+      //  mulpd %xmm"valsLow", %xmm"low"
+      assembler->mulpd(low, valsLow);
+      //  movupd "8*(valIndex+2)"(%RBX), %xmm"valsHigh"
+      assembler->movupd(valsHigh, ptr(rbx, 8 * (valIndex + 2)));
+      //  mulpd %xmm"valsHigh", %xmm"high"
+      assembler->mulpd(high, valsHigh);
+    }
+    if (i >= numPairs) {
+      //  addpd %xmm"vLow", %xmm"2*pair"
+      assembler->addpd(xmm(2 * pair), vLow);
+      //  addpd %xmm"vHigh", %xmm"2*pair+1"
+      assembler->addpd(xmm(2 * pair + 1), vHigh);
+    }
+  }
+  for (unsigned int inc = 1; inc < numPairs; inc *= 2) {
+    for (unsigned int p = 0; p + inc < numPairs; p += inc * 2) {
+      //  addpd %xmm"2*(p+inc)", %xmm"2*p"
+      assembler->addpd(xmm(2 * p), xmm(2 * (p + inc)));
+      //  addpd %xmm"2*(p+inc)+1", %xmm"2*p+1"
+      assembler->addpd(xmm(2 * p + 1), xmm(2 * (p + inc) + 1));
+    }
+  }
+  
+  //  movupd (%rsi,%rdx,8), %xmm"vLow" ; addpd %xmm"vLow", %xmm0 ; movupd %xmm0, (%rsi,%rdx,8)
+  emitPackedRowUpdate(assembler, scaling, ptr(rsi, rdx, 3), xmm0, vLow,
+                      fusedOp, ptr(fusedOp == FUSED_DOT ? rdi : r9, rdx, 3));
+  //  movupd 16(%rsi,%rdx,8), %xmm"vHigh" ; addpd %xmm"vHigh", %xmm1 ; movupd %xmm1, 16(%rsi,%rdx,8)
+  emitPackedRowUpdate(assembler, scaling, ptr(rsi, rdx, 3, 16), xmm1, vHigh,
+                      fusedOp, ptr(fusedOp == FUSED_DOT ? rdi : r9, rdx, 3, 16));
+  
+  if (!constants) {
+    //  leaq "sizeof(double)*ROW_RUN_LENGTH*stencilSize"(%RBX), %RBX
+    assembler->lea(rbx, ptr(rbx, (sizeof(double) * ROW_RUN_LENGTH * patternSize)));
+  }
+  //  addq $"sizeof(int)", %r11
+  assembler->add(r11, (int)sizeof(int));
+  //  cmpl $"numRuns*sizeof(int)", %r11d
+  assembler->cmp(r11d, (int)(numRuns * sizeof(int)));
+  //  jne LBB_"runStart"
+  assembler->jne(loopStart);
+  //  leaq "sizeof(int)*numRuns"(%r8), %r8
+  assembler->lea(r8, ptr(r8, sizeof(int) * numRuns));
+}
+
+// With popularity 1, the row is known and its entries are at fixed offsets;
+// otherwise %rdx holds the byte offset row*k*8 of the current row.
+void RowPatternCodeEmitter::emitSpMMRow(const vector<int> &pattern, const Label *constants,
+                                        int rowBase, unsigned long valIndex,
+                                        unsigned long valStride, bool indexed) {
+  unsigned int numVectors = options.numVectors;
+  int rowBlockSize = numVectors * sizeof(double);
+  X86Xmm value = spmmValueRegister(numVectors);
+  
+  for (int i = 0; i < pattern.size(); ++i) {
+    if (constants) {
+      //  movddup "16*(i)"(CONSTANTS), %xmm"value"
+      assembler->movddup(value, ptr(*constants, 16 * i));
+    } else {
+      //  movddup "8*(valIndex+i*valStride)"(%RBX), %xmm"value"
+      assembler->movddup(value, ptr(rbx, 8 * (valIndex + i * valStride)));
+    }
+    int entriesOffset = rowBlockSize * (rowBase + pattern[i]);
+    if (indexed) {
+      emitMultiVectorProduct(assembler, [entriesOffset](int offset) { return ptr(rdi, rdx, 0, entriesOffset + offset); },
+                             numVectors, i == 0);
+    } else {
+      emitMultiVectorProduct(assembler, [entriesOffset](int offset) { return ptr(rdi, entriesOffset + offset); },
+                             numVectors, i == 0);
+    }
+  }
+  
+  int entriesOffset = rowBlockSize * rowBase;
+  if (indexed) {
+    emitMultiVectorUpdate(assembler, [entriesOffset](int offset) { return ptr(rsi, rdx, 0, entriesOffset + offset); },
+                          numVectors);
+  } else {
+    emitMultiVectorUpdate(assembler, [entriesOffset](int offset) { return ptr(rsi, entriesOffset + offset); },
+                          numVectors);
+  }
+}
+
+void RowPatternCodeEmitter::emitSpMMSingleLoop(const vector<int> &pattern,
+                                               const vector<int> &rowIndices,
+                                               const Label *constants) {
+  unsigned long popularity = rowIndices.size();
+  unsigned long patternSize = pattern.size();
+  if(patternSize == 0 || popularity == 0) return;
+  
+  if (popularity == 1) {
+    emitSpMMRow(pattern, constants, rowIndices[0], 0, 1, false);
+    if (!constants) {
+      //  leaq "sizeof(double)*stencilSize"(%RBX), %RBX
+      assembler->lea(rbx, ptr(rbx, (sizeof(double) * patternSize)));
+    }
+    return;
+  }
+  
+  //  xorl %r11d, %r11d
+  assembler->xor_(r11d, r11d);
+  //  .align 4, 0x90
+  assembler->align(kAlignCode, 16);
+  Label loopStart = assembler->newLabel();
+  assembler->bind(loopStart);
+  
+  //  movslq (%r11,%r8), %rdx
+  assembler->movsxd(rdx, ptr(r11, r8));
+  //  imulq $"k*8", %rdx
+  assembler->imul(rdx, (int)(options.numVectors * sizeof(double)));
+  emitSpMMRow(pattern, constants, 0, 0, 1, true);
+  
+  if (!constants) {
+    //  leaq "sizeof(double)*stencilSize"(%RBX), %RBX
+    assembler->lea(rbx, ptr(rbx, (sizeof(double) * patternSize)));
+  }
+  //  addq $"sizeof(int)", %r11
+  assembler->add(r11, (int)sizeof(int));
+  //  cmpl $"popularity*sizeof(int)", %r11d
+  assembler->cmp(r11d, (int)(popularity * sizeof(int)));
+  //  jne LBB_"row"
+  assembler->jne(loopStart);
+  //  leaq "sizeof(int)*popularity"(%r8), %r8
+  assembler->lea(r8, ptr(r8, sizeof(int) * popularity));
+}
+
+// The vals of a run are interleaved by pattern offset,
+// so coefficient i of row r of the run is at i*ROW_RUN_LENGTH + r.
+void RowPatternCodeEmitter::emitSpMMRowRunLoop(const vector<int> &pattern,
+                                               const vector<int> &runStarts,
+                                               const Label *constants) {
+  unsigned long numRuns = runStarts.size();
+  unsigned long patternSize = pattern.size();
+  if(patternSize == 0 || numRuns == 0) return;
+  
+  //  xorl %r11d, %r11d
+  assembler->xor_(r11d, r11d);
+  //  .align 4, 0x90
+  assembler->align(kAlignCode, 16);
+  Label loopStart = assembler->newLabel();
+  assembler->bind(loopStart);
+  
+  //  movslq (%r11,%r8), %rdx
+  assembler->movsxd(rdx, ptr(r11, r8));
+  //  imulq $"k*8", %rdx
+  assembler->imul(rdx, (int)(options.numVectors * sizeof(double)));
+  for (int r = 0; r < ROW_RUN_LENGTH; ++r) {
+    emitSpMMRow(pattern, constants, r, r, ROW_RUN_LENGTH, true);
+  }
+  
+  if (!constants) {
+    //  leaq "sizeof(double)*ROW_RUN_LENGTH*stencilSize"(%RBX), %RBX
+    assembler->lea(rbx, ptr(rbx, (sizeof(double) * ROW_RUN_LENGTH * patternSize)));
+  }
+  //  addq $"sizeof(int)", %r11
+  assembler->add(r11, (int)sizeof(int));
+  //  cmpl $"numRuns*sizeof(int)", %r11d
+  assembler->cmp(r11d, (int)(numRuns * sizeof(int)));
+  //  jne LBB_"runStart"
+  assembler->jne(loopStart);
+  //  leaq "sizeof(int)*numRuns"(%r8), %r8
+  assembler->lea(r8, ptr(r8, sizeof(int) * numRuns));
+}
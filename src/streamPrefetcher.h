@@ -0,0 +1,36 @@
+#ifndef _STREAM_PREFETCHER_H_
+#define _STREAM_PREFETCHER_H_
+
+#include <xmmintrin.h>
+
+namespace thundercat {
+  ///
+  /// Issues non-temporal prefetches for an array that is read sequentially,
+  /// staying a fixed number of elements ahead of the reader.
+  /// Used by the C++ kernels for the matrix arrays, which are
+  /// read once per SpMV and should not evict v from the caches.
+  ///
+  template <typename T>
+  class StreamPrefetcher {
+  public:
+    StreamPrefetcher(const T *stream, unsigned int distance) {
+      this->frontier = stream;
+      this->distance = distance;
+    }
+    
+    // Prefetch everything up to "position + distance" that has not been prefetched yet
+    inline void advance(const T *position) {
+      const T *target = position + distance;
+      while (frontier < target) {
+        _mm_prefetch((const char *)frontier, _MM_HINT_NTA);
+        frontier += 64 / sizeof(T);
+      }
+    }
+    
+  private:
+    const T *frontier;
+    unsigned int distance;
+  };
+}
+
+#endif
@@ -0,0 +1,384 @@
+#include "triangularSolver.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <iostream>
+
+using namespace thundercat;
+using namespace asmjit;
+using namespace x86;
+using namespace std;
+
+///
+/// TriangularSolveCodeEmitter:
+/// Helper class to avoid having to pass several parameters.
+/// Emits the levels of a thread, with the rows of a level in CSRbyNZ-style loops.
+/// x is in %rdi, b in %rsi, rows in %rdx, cols in %rcx, vals in %r8, progress in %r9.
+///
+class TriangularSolveCodeEmitter {
+public:
+  TriangularSolveCodeEmitter(X86Assembler *assembler,
+                             std::vector<ThreadLevel> *levels,
+                             unsigned int threadIndex,
+                             const KernelOptions &options) {
+    this->assembler = assembler;
+    this->levels = levels;
+    this->threadIndex = threadIndex;
+    this->options = options;
+  }
+
+  void emit();
+
+private:
+  X86Assembler *assembler;
+  std::vector<ThreadLevel> *levels;
+  unsigned int threadIndex;
+  KernelOptions options;
+
+  void emitWait(const LevelWait &wait);
+
+  void emitRowsLoop(unsigned long numRows, unsigned long rowLength);
+};
+
+TriangularSolver::TriangularSolver(Matrix *csrMatrix, bool isLower, unsigned int numThreads) {
+  this->csrMatrix = csrMatrix;
+  this->isLower = isLower;
+#ifdef OPENMP_EXISTS
+  this->numThreads = numThreads;
+#else
+  // The threads wait for each other, so they cannot run one after the other.
+  this->numThreads = 1;
+#endif
+  progress = new ThreadProgress[this->numThreads];
+}
+
+TriangularSolver::~TriangularSolver() {
+  delete[] progress;
+  for (auto holder : codeHolders) {
+    delete holder;
+  }
+}
+
+unsigned int TriangularSolver::getNumLevels() {
+  return numLevels;
+}
+
+///
+/// Analysis
+///
+void TriangularSolver::analyzeMatrix() {
+  const long n = csrMatrix->n;
+  const int *matrixRows = csrMatrix->rows;
+  const int *matrixCols = csrMatrix->cols;
+  const double *matrixVals = csrMatrix->vals;
+  auto isOffDiagonal = [this](long rowIndex, int col) {
+    return isLower ? col < rowIndex : col > rowIndex;
+  };
+
+  // The level of a row is one more than the highest level of the rows it depends on.
+  vector<int> rowLevels(n);
+  vector<double> inverseDiagonal(n, 1.0);
+  vector<int> rowLengths(n, 0);
+  for (long s = 0; s < n; s++) {
+    long rowIndex = isLower ? s : n - 1 - s;
+    int level = 0;
+    for (int e = matrixRows[rowIndex]; e < matrixRows[rowIndex + 1]; e++) {
+      int col = matrixCols[e];
+      if (col == rowIndex) {
+        if (matrixVals[e] == 0.0) {
+          std::cerr << "Zero on the diagonal of row " << rowIndex << " of the triangle.\n";
+          exit(1);
+        }
+        inverseDiagonal[rowIndex] = 1.0 / matrixVals[e];
+      } else if (isOffDiagonal(rowIndex, col)) {
+        level = max(level, rowLevels[col] + 1);
+        rowLengths[rowIndex]++;
+      }
+    }
+    rowLevels[rowIndex] = level;
+    numLevels = max(numLevels, (unsigned int)level + 1);
+  }
+
+  vector<vector<int> > levelRows(numLevels);
+  for (long rowIndex = 0; rowIndex < n; rowIndex++) {
+    levelRows[rowLevels[rowIndex]].push_back(rowIndex);
+  }
+
+  // Each level is cut into contiguous parts of about the same number of nonzeros.
+  vector<unsigned int> rowThreads(n);
+  threadLevels.assign(numThreads, vector<ThreadLevel>(numLevels));
+  for (unsigned int level = 0; level < numLevels; level++) {
+    unsigned long levelElements = 0;
+    for (int rowIndex : levelRows[level]) {
+      levelElements += rowLengths[rowIndex] + 1;
+    }
+    unsigned long elements = 0;
+    for (int rowIndex : levelRows[level]) {
+      unsigned int t = min((unsigned long)numThreads - 1, elements * numThreads / levelElements);
+      elements += rowLengths[rowIndex] + 1;
+      rowThreads[rowIndex] = t;
+      threadLevels[t][level].rowsByLength[rowLengths[rowIndex]].addRowIndex(rowIndex);
+    }
+  }
+
+  // A thread waits for the level of another thread only if no earlier wait covers it.
+#pragma omp parallel for
+  for (unsigned int t = 0; t < numThreads; t++) {
+    vector<int> waitedLevels(numThreads, 0);
+    vector<int> neededLevels(numThreads, 0);
+    for (unsigned int level = 0; level < numLevels; level++) {
+      ThreadLevel &threadLevel = threadLevels[t][level];
+      for (auto &rowsOfLength : threadLevel.rowsByLength) {
+        for (int rowIndex : *(rowsOfLength.second.getRowIndices())) {
+          for (int e = matrixRows[rowIndex]; e < matrixRows[rowIndex + 1]; e++) {
+            int col = matrixCols[e];
+            if (isOffDiagonal(rowIndex, col) && rowThreads[col] != t) {
+              neededLevels[rowThreads[col]] = max(neededLevels[rowThreads[col]], rowLevels[col] + 1);
+            }
+          }
+        }
+      }
+      for (unsigned int other = 0; other < numThreads; other++) {
+        if (neededLevels[other] > waitedLevels[other]) {
+          threadLevel.waits.push_back(LevelWait{other, neededLevels[other]});
+          waitedLevels[other] = neededLevels[other];
+        }
+      }
+    }
+  }
+  for (unsigned int t = 0; t < numThreads; t++) {
+    for (auto &threadLevel : threadLevels[t]) {
+      for (auto &wait : threadLevel.waits) {
+        threadLevels[wait.thread][wait.numLevelsDone - 1].isWaitedFor = true;
+      }
+    }
+  }
+
+  rows.resize(numThreads);
+  cols.resize(numThreads);
+  vals.resize(numThreads);
+#pragma omp parallel for
+  for (unsigned int t = 0; t < numThreads; t++) {
+    for (auto &threadLevel : threadLevels[t]) {
+      for (auto &rowsOfLength : threadLevel.rowsByLength) {
+        for (int rowIndex : *(rowsOfLength.second.getRowIndices())) {
+          rows[t].push_back(rowIndex);
+          for (int e = matrixRows[rowIndex]; e < matrixRows[rowIndex + 1]; e++) {
+            if (isOffDiagonal(rowIndex, matrixCols[e])) {
+              cols[t].push_back(matrixCols[e]);
+              vals[t].push_back(matrixVals[e]);
+            }
+          }
+          vals[t].push_back(inverseDiagonal[rowIndex]);
+        }
+      }
+    }
+  }
+}
+
+///
+/// Solve
+///
+void TriangularSolver::solve(const double* __restrict b, double* __restrict x) {
+  for (unsigned int t = 0; t < numThreads; t++) {
+    progress[t].numLevelsDone.store(0, std::memory_order_relaxed);
+  }
+  // The threads wait for each other, so they must all run at once. If OpenMP
+  // gives fewer threads, none of them starts, and the levels are solved serially.
+  bool hasAllThreads = true;
+#pragma omp parallel for schedule(static, 1) num_threads(numThreads) reduction(&&:hasAllThreads)
+  for (unsigned int t = 0; t < numThreads; t++) {
+#ifdef OPENMP_EXISTS
+    if (omp_get_num_threads() != (int)numThreads) {
+      hasAllThreads = false;
+      continue;
+    }
+#endif
+    if (functions.empty())
+      solveThread(t, b, x);
+    else
+      functions[t](x, b, rows[t].data(), cols[t].data(), vals[t].data(), progress);
+  }
+  if (!hasAllThreads)
+    solveSerial(b, x);
+}
+
+void TriangularSolver::solveThread(unsigned int t, const double* __restrict b, double* __restrict x) {
+  const int *rowsPtr = rows[t].data();
+  const int *colsPtr = cols[t].data();
+  const double *valsPtr = vals[t].data();
+  for (unsigned int level = 0; level < numLevels; level++) {
+    ThreadLevel &threadLevel = threadLevels[t][level];
+    for (auto &wait : threadLevel.waits) {
+      while (progress[wait.thread].numLevelsDone.load(std::memory_order_acquire) < wait.numLevelsDone) {
+        _mm_pause();
+      }
+    }
+    solveLevel(threadLevel, b, x, rowsPtr, colsPtr, valsPtr);
+    if (threadLevel.isWaitedFor)
+      progress[t].numLevelsDone.store(level + 1, std::memory_order_release);
+  }
+}
+
+void TriangularSolver::solveSerial(const double* __restrict b, double* __restrict x) {
+  std::vector<const int*> rowsPtrs(numThreads);
+  std::vector<const int*> colsPtrs(numThreads);
+  std::vector<const double*> valsPtrs(numThreads);
+  for (unsigned int t = 0; t < numThreads; t++) {
+    rowsPtrs[t] = rows[t].data();
+    colsPtrs[t] = cols[t].data();
+    valsPtrs[t] = vals[t].data();
+  }
+  // A level depends only on lower levels, so no waits are needed.
+  for (unsigned int level = 0; level < numLevels; level++) {
+    for (unsigned int t = 0; t < numThreads; t++) {
+      solveLevel(threadLevels[t][level], b, x, rowsPtrs[t], colsPtrs[t], valsPtrs[t]);
+    }
+  }
+}
+
+void TriangularSolver::solveLevel(ThreadLevel &threadLevel, const double* __restrict b, double* __restrict x,
+                                  const int *&rowsPtr, const int *&colsPtr, const double *&valsPtr) {
+  for (auto &rowsOfLength : threadLevel.rowsByLength) {
+    const unsigned long rowLength = rowsOfLength.first;
+    const unsigned long numRows = rowsOfLength.second.getRowIndices()->size();
+    for (unsigned long r = 0; r < numRows; r++) {
+      const int rowIndex = *rowsPtr++;
+      double sum = 0.0;
+      for (unsigned long e = 0; e < rowLength; e++) {
+        sum += valsPtr[e] * x[colsPtr[e]];
+      }
+      x[rowIndex] = (b[rowIndex] - sum) * valsPtr[rowLength];
+      colsPtr += rowLength;
+      valsPtr += rowLength + 1;
+    }
+  }
+}
+
+///
+/// Code generation
+///
+void TriangularSolver::emitCode(const KernelOptions &options) {
+  for (unsigned int t = 0; t < numThreads; t++) {
+    codeHolders.push_back(new CodeHolder);
+    codeHolders[t]->init(rt.getCodeInfo());
+  }
+
+#pragma omp parallel for
+  for (unsigned int t = 0; t < numThreads; t++) {
+    {
+      X86Assembler assembler(codeHolders[t]);
+      TriangularSolveCodeEmitter emitter(&assembler, &threadLevels[t], t, options);
+      emitter.emit();
+    }
+    codeHolders[t]->sync();
+  }
+
+  functions.resize(numThreads);
+  for (unsigned int t = 0; t < numThreads; t++) {
+    TriangularSolveFun fn;
+    asmjit::Error err = rt.add(&fn, codeHolders[t]);
+    if (err) {
+      std::cerr << "Problem occurred while adding triangular solve function " << t << " to Runtime.\n";
+      std::cerr << err;
+      exit(1);
+    }
+    functions[t] = fn;
+  }
+}
+
+void TriangularSolveCodeEmitter::emit() {
+  assembler->push(rbx);
+
+  for (unsigned int level = 0; level < levels->size(); level++) {
+    ThreadLevel &threadLevel = levels->at(level);
+    for (auto &wait : threadLevel.waits) {
+      emitWait(wait);
+    }
+    for (auto &rowsOfLength : threadLevel.rowsByLength) {
+      emitRowsLoop(rowsOfLength.second.getRowIndices()->size(), rowsOfLength.first);
+    }
+    if (threadLevel.isWaitedFor) {
+      // Stores are not reordered with older stores on x86, so x is visible before the progress.
+      //movl $"level+1", "threadIndex*64"(%r9)
+      assembler->mov(dword_ptr(r9, threadIndex * sizeof(ThreadProgress)), level + 1);
+    }
+  }
+
+  assembler->pop(rbx);
+  assembler->ret();
+}
+
+void TriangularSolveCodeEmitter::emitWait(const LevelWait &wait) {
+  Label spin = assembler->newLabel();
+  Label ready = assembler->newLabel();
+  assembler->bind(spin);
+  //cmpl $numLevelsDone, "thread*64"(%r9)
+  assembler->cmp(dword_ptr(r9, wait.thread * sizeof(ThreadProgress)), wait.numLevelsDone);
+  //jge ready
+  assembler->jge(ready);
+  //pause
+  assembler->pause();
+  //jmp spin
+  assembler->jmp(spin);
+  assembler->bind(ready);
+}
+
+// x[i] = (b[i] - sum) / diagonal, where the sum of the off-diagonal products
+// is split over accumulators as in CSRbyNZ. %rcx and %r8 move forward by row.
+void TriangularSolveCodeEmitter::emitRowsLoop(unsigned long numRows, unsigned long rowLength) {
+  assembler->xor_(ebx, ebx);
+
+  assembler->align(kAlignCode, 16);
+  Label loopBegin = assembler->newLabel();
+  assembler->bind(loopBegin);
+
+  unsigned int numAccumulators = rowLength == 0 ? 0 : numAccumulatorsForRow(rowLength, options.maxAccumulators);
+  X86Xmm temp = xmm(MAX_ACCUMULATORS);
+  for (int i = 0; i < rowLength; i++) {
+    X86Xmm acc = xmm(i % numAccumulators);
+    //movslq "i*4"(%rcx), %rax
+    assembler->movsxd(rax, ptr(rcx, i * sizeof(int)));
+    if (i < numAccumulators) {
+      //movsd "i*8"(%r8), %xmm"acc"
+      assembler->movsd(acc, ptr(r8, i * sizeof(double)));
+      //mulsd (%rdi,%rax,8), %xmm"acc"
+      assembler->mulsd(acc, ptr(rdi, rax, 3));
+    } else {
+      //movsd "i*8"(%r8), %xmm"temp"
+      assembler->movsd(temp, ptr(r8, i * sizeof(double)));
+      //mulsd (%rdi,%rax,8), %xmm"temp"
+      assembler->mulsd(temp, ptr(rdi, rax, 3));
+      //addsd %xmm"temp", %xmm"acc"
+      assembler->addsd(acc, temp);
+    }
+  }
+  if (numAccumulators > 0)
+    emitAccumulatorReduce(assembler, numAccumulators);
+
+  //movslq (%rdx,%rbx,4), %rax
+  assembler->movsxd(rax, ptr(rdx, rbx, 2));
+  //movsd (%rsi,%rax,8), %xmm"temp"
+  assembler->movsd(temp, ptr(rsi, rax, 3));
+  if (numAccumulators > 0) {
+    //subsd %xmm0, %xmm"temp"
+    assembler->subsd(temp, xmm0);
+  }
+  // The inverse of the diagonal follows the off-diagonal values.
+  //mulsd "rowLength*8"(%r8), %xmm"temp"
+  assembler->mulsd(temp, ptr(r8, rowLength * sizeof(double)));
+  //movsd %xmm"temp", (%rdi,%rax,8)
+  assembler->movsd(ptr(rdi, rax, 3), temp);
+  //addq $rowLength*4, %rcx
+  assembler->add(rcx, (unsigned int)(rowLength * sizeof(int)));
+  //addq $(rowLength+1)*8, %r8
+  assembler->add(r8, (unsigned int)((rowLength + 1) * sizeof(double)));
+  //addq $1, %rbx
+  assembler->inc(rbx);
+  //cmpl numRows, %ebx
+  assembler->cmp(ebx, (unsigned int)numRows);
+  //jne .LBB0_1
+  assembler->jne(loopBegin);
+
+  //addq $numRows*4, %rdx
+  assembler->add(rdx, (unsigned int)(numRows * sizeof(int)));
+}
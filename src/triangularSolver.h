@@ -0,0 +1,91 @@
+#ifndef _TRIANGULAR_SOLVER_H_
+#define _TRIANGULAR_SOLVER_H_
+
+#include "method.h"
+#include "emitterUtils.h"
+#include <atomic>
+#include <vector>
+
+namespace thundercat {
+  // Progress of a thread in a triangular solve: the number of its levels that are done.
+  // The flags are a cache line apart, so that the threads spinning on one
+  // do not slow down the other threads.
+  struct ThreadProgress {
+    std::atomic<int> numLevelsDone;
+    char padding[CACHE_LINE_SIZE - sizeof(std::atomic<int>)];
+  };
+
+  // solve(x, b, rows, cols, vals, progress) of a thread
+  typedef void(*TriangularSolveFun)(double*, const double*, int*, int*, double*, ThreadProgress*);
+
+  // Before starting a level, a thread waits until the given thread has done the given number of levels.
+  struct LevelWait {
+    unsigned int thread;
+    int numLevelsDone;
+  };
+
+  // Rows of a level assigned to a thread, grouped by their number of off-diagonal elements
+  struct ThreadLevel {
+    std::vector<LevelWait> waits;
+    NZtoRowMap rowsByLength;
+    // Whether another thread waits for this level; if not, the progress is not published.
+    bool isWaitedFor = false;
+  };
+
+  ///
+  /// Sparse triangular solve, T·x = b, where T is the lower or upper triangle of
+  /// a square matrix, diagonal included. A missing diagonal element is taken as 1,
+  /// as for the L factor of an incomplete LU factorization.
+  /// The rows are put into level sets: the rows of a level depend only on rows of
+  /// lower levels, so that they can be solved in parallel. Each level is split
+  /// among the threads by number of nonzeros. Instead of a barrier after each level,
+  /// a thread publishes its progress and waits only for the threads that computed
+  /// the rows it depends on; waits implied by earlier ones are dropped at analysis time.
+  /// All threads must run concurrently; if OpenMP gives fewer threads, the levels
+  /// are solved one after the other on a single thread.
+  ///
+  class TriangularSolver {
+  public:
+    TriangularSolver(Matrix *csrMatrix, bool isLower, unsigned int numThreads);
+
+    ~TriangularSolver();
+
+    // Finds the levels, the rows of each thread and their waits, and reorders the matrix data
+    void analyzeMatrix();
+
+    // Generates the code of each thread, the way CSRbyNZ does, to be used instead of the C++ loop
+    void emitCode(const KernelOptions &options);
+
+    void solve(const double* __restrict b, double* __restrict x);
+
+    unsigned int getNumLevels();
+
+  private:
+    void solveThread(unsigned int t, const double* __restrict b, double* __restrict x);
+
+    // Solves the levels in order, each level thread by thread, without waits
+    void solveSerial(const double* __restrict b, double* __restrict x);
+
+    // Solves the rows of a level of a thread, advancing the thread's data pointers
+    void solveLevel(ThreadLevel &threadLevel, const double* __restrict b, double* __restrict x,
+                    const int *&rowsPtr, const int *&colsPtr, const double *&valsPtr);
+
+    Matrix *csrMatrix;
+    bool isLower;
+    unsigned int numThreads;
+    unsigned int numLevels = 0;
+    // Levels of each thread; a thread has all levels, possibly with no rows.
+    std::vector<std::vector<ThreadLevel> > threadLevels;
+    // Rows of each thread in schedule order; cols holds the columns of their off-diagonal
+    // elements, vals their values followed by the inverse of the row's diagonal.
+    std::vector<std::vector<int> > rows;
+    std::vector<std::vector<int> > cols;
+    std::vector<std::vector<double> > vals;
+    ThreadProgress *progress;
+    std::vector<TriangularSolveFun> functions;
+    std::vector<asmjit::CodeHolder*> codeHolders;
+    asmjit::JitRuntime rt;
+  };
+}
+
+#endif
@@ -1,5 +1,8 @@
 #include "method.h"
+#include "csrByNZCodeEmitter.h"
 #include <iostream>
+#include <algorithm>
+#include <climits>
 
 using namespace thundercat;
 using namespace std;
@@ -9,6 +12,16 @@ using namespace x86;
 #define DISTINCT_VALUE_COUNT_LIMIT 5000
 #define REGISTER_LIMIT 7
 #define LIMIT_TO_DO_LEAQ 120
+// Estimated sizes of the generated code, used to fit the code budget
+#define UNFOLDED_BYTES_PER_ROW 12
+#define UNFOLDED_BYTES_PER_NONZERO 17
+#define UNFOLDED_BYTES_PER_NONZERO_WITH_DISTINCT_VALUES 9
+#define UNFOLDED_BYTES_PER_DISTINCT_VALUE 12
+// cols starts with a mask of 2 unsigned longs used to negate FP values
+#define NEGATION_MASK_INTS (2 * sizeof(unsigned long) / sizeof(int))
+
+extern bool __DEBUG__;
+extern bool DUMP_OBJECT;
 
 ///
 /// Analysis
@@ -40,6 +53,90 @@ void Unfolding::analyzeMatrix() {
       }
     }
   }
+  
+  selectUnfoldedRows();
+}
+
+// Rows are unfolded in priority order until the code budget of the stripe
+// is used up: short rows first, and among those, the rows whose set of values
+// is repeated by most rows. The remaining rows run CSRbyNZ loops.
+void Unfolding::selectUnfoldedRows() {
+  unfoldedRows.clear();
+  unfoldedRows.resize(stripeInfos->size());
+  fallbackRowByNZLists.clear();
+  fallbackRowByNZLists.resize(stripeInfos->size());
+  bool withDistinctValues = hasFewDistinctValues();
+  vector<unsigned long> numUnfoldedRows(stripeInfos->size(), 0);
+  vector<unsigned long> codeSizes(stripeInfos->size(), 0);
+  
+#pragma omp parallel for
+  for (int threadIndex = 0; threadIndex < stripeInfos->size(); ++threadIndex) {
+    auto &stripeInfo = stripeInfos->at(threadIndex);
+    vector<bool> &unfolded = unfoldedRows[threadIndex];
+    unsigned long numRows = stripeInfo.rowIndexEnd - stripeInfo.rowIndexBegin;
+    unfolded.resize(numRows, true);
+    
+    vector<unsigned long> rowCodeSizes(numRows, 0);
+    vector<vector<double> > valueSets(numRows);
+    map<vector<double>, unsigned long> valueSetCounts;
+    for (unsigned long i = 0; i < numRows; ++i) {
+      int rowStart = csrMatrix->rows[stripeInfo.rowIndexBegin + i];
+      int rowEnd = csrMatrix->rows[stripeInfo.rowIndexBegin + i + 1];
+      if (rowStart == rowEnd)
+        continue;
+      set<double> distinctValues(csrMatrix->vals + rowStart, csrMatrix->vals + rowEnd);
+      valueSets[i].assign(distinctValues.begin(), distinctValues.end());
+      valueSetCounts[valueSets[i]]++;
+      if (withDistinctValues) {
+        rowCodeSizes[i] = UNFOLDED_BYTES_PER_ROW + (rowEnd - rowStart) * UNFOLDED_BYTES_PER_NONZERO_WITH_DISTINCT_VALUES +
+                          distinctValues.size() * UNFOLDED_BYTES_PER_DISTINCT_VALUE;
+      } else {
+        rowCodeSizes[i] = UNFOLDED_BYTES_PER_ROW + (rowEnd - rowStart) * UNFOLDED_BYTES_PER_NONZERO;
+      }
+    }
+    
+    if (kernelOptions.unfoldingCodeBudget > 0) {
+      vector<unsigned long> rowsByPriority;
+      for (unsigned long i = 0; i < numRows; ++i) {
+        if (rowCodeSizes[i] > 0)
+          rowsByPriority.push_back(i);
+      }
+      stable_sort(rowsByPriority.begin(), rowsByPriority.end(), [&](unsigned long i, unsigned long j) {
+        if (rowCodeSizes[i] != rowCodeSizes[j])
+          return rowCodeSizes[i] < rowCodeSizes[j];
+        return valueSetCounts[valueSets[i]] > valueSetCounts[valueSets[j]];
+      });
+      
+      unsigned long codeSize = 0;
+      for (unsigned long i : rowsByPriority) {
+        if (codeSize + rowCodeSizes[i] > kernelOptions.unfoldingCodeBudget)
+          unfolded[i] = false;
+        else
+          codeSize += rowCodeSizes[i];
+      }
+    }
+    
+    for (unsigned long i = 0; i < numRows; ++i) {
+      if (unfolded[i]) {
+        numUnfoldedRows[threadIndex]++;
+        codeSizes[threadIndex] += rowCodeSizes[i];
+      } else {
+        int rowIndex = stripeInfo.rowIndexBegin + i;
+        int rowLength = csrMatrix->rows[rowIndex + 1] - csrMatrix->rows[rowIndex];
+        fallbackRowByNZLists[threadIndex][rowLength].addRowIndex(rowIndex);
+      }
+    }
+  }
+  
+  if (kernelOptions.unfoldingCodeBudget > 0 && !__DEBUG__ && !DUMP_OBJECT) {
+    unsigned long numTotalUnfoldedRows = 0, maxCodeSize = 0;
+    for (unsigned int t = 0; t < stripeInfos->size(); ++t) {
+      numTotalUnfoldedRows += numUnfoldedRows[t];
+      maxCodeSize = max(maxCodeSize, codeSizes[t]);
+    }
+    cout << "Unfolding: " << numTotalUnfoldedRows << " of " << csrMatrix->n << " rows unfolded, "
+         << "estimated code size " << maxCodeSize << " bytes per stripe at most\n";
+  }
 }
 
 bool Unfolding::hasFewDistinctValues() {
@@ -55,33 +152,110 @@ bool Unfolding::hasFewDistinctValues() {
 /// Unfolding
 ///
 void Unfolding::convertMatrix() {
+  // Rows that do not fit the code budget are laid out as in CSRbyNZ:
+  // their cols follow the negation mask and their vals follow the values of Unfolding.
+  unsigned long numFallbackRows = 0;
+  unsigned long numFallbackVals = 0;
+  fallbackRowBaseIndices.clear();
+  fallbackValBaseIndices.clear();
+  for (auto &rowByNZList : fallbackRowByNZLists) {
+    fallbackRowBaseIndices.push_back(numFallbackRows);
+    fallbackValBaseIndices.push_back(numFallbackVals);
+    for (auto &rowByNZ : rowByNZList) {
+      unsigned long numRows = rowByNZ.second.getRowIndices()->size();
+      numFallbackRows += numRows;
+      numFallbackVals += numRows * rowByNZ.first;
+    }
+  }
+  unsigned int numPaddingCols = numFallbackRows > 0 ? kernelOptions.getPrefetchDistance() : 0;
+  unsigned long numCols = NEGATION_MASK_INTS + numFallbackVals + numPaddingCols;
+  
   // The hack below is used when negating
   // FP values
-  unsigned long *cols = new unsigned long[2];   // Yes, this is unsigned long!
+  unsigned long *cols = new unsigned long[(numCols + 1) / 2];   // Yes, this is unsigned long!
   cols[0] = 0x8000000000000000;
   cols[1] = 0x0000000000000000;
+  int *fallbackCols = (int*)cols + NEGATION_MASK_INTS;
+  for (unsigned int i = 0; i < numPaddingCols; i++) {
+    fallbackCols[numFallbackVals + i] = 0;
+  }
   
   double *values = NULL;
-  unsigned long numVals = 0;
+  numUnfoldingVals = 0;
   if (hasFewDistinctValues()) {
     for (auto &partitionValues : distinctValueLists) {
-      numVals += partitionValues.size();
+      numUnfoldingVals += partitionValues.size();
     }
-    values = new double[numVals];
+    values = new double[numUnfoldingVals + numFallbackVals];
     double *valPtr = values;
     for (auto &partitionValues : distinctValueLists) {
       memcpy(valPtr, partitionValues.data(), partitionValues.size() * sizeof(double));
       valPtr += partitionValues.size();
     }
+  } else if (numFallbackVals > 0) {
+    // Only the values of the unfolded rows are kept, in row order, followed by those of the fallback rows.
+    numUnfoldingVals = csrMatrix->nz - numFallbackVals;
+    values = new double[numUnfoldingVals + numFallbackVals];
+    unfoldedValBaseIndices.clear();
+    unsigned long numStripeVals = 0;
+    for (int t = 0; t < stripeInfos->size(); ++t) {
+      auto &stripeInfo = stripeInfos->at(t);
+      unsigned long stripeFallbackVals = (t + 1 < stripeInfos->size() ? fallbackValBaseIndices[t + 1] : numFallbackVals) -
+                                         fallbackValBaseIndices[t];
+      unfoldedValBaseIndices.push_back(numStripeVals);
+      numStripeVals += stripeInfo.valIndexEnd - stripeInfo.valIndexBegin - stripeFallbackVals;
+    }
+    
+#pragma omp parallel for
+    for (int t = 0; t < stripeInfos->size(); ++t) {
+      auto &stripeInfo = stripeInfos->at(t);
+      double *valPtr = values + unfoldedValBaseIndices[t];
+      for (int rowIndex = stripeInfo.rowIndexBegin; rowIndex < stripeInfo.rowIndexEnd; ++rowIndex) {
+        if (!unfoldedRows[t][rowIndex - stripeInfo.rowIndexBegin])
+          continue;
+        int rowLength = csrMatrix->rows[rowIndex + 1] - csrMatrix->rows[rowIndex];
+        memcpy(valPtr, csrMatrix->vals + csrMatrix->rows[rowIndex], rowLength * sizeof(double));
+        valPtr += rowLength;
+      }
+    }
   } else {
     values = csrMatrix->vals;
-    numVals = csrMatrix->nz;
+    numUnfoldingVals = csrMatrix->nz;
+    unfoldedValBaseIndices.clear();
+    for (auto &stripeInfo : *stripeInfos) {
+      unfoldedValBaseIndices.push_back(stripeInfo.valIndexBegin);
+    }
   }
   
-  matrix = new Matrix(NULL, (int*)cols, values, csrMatrix->n, csrMatrix->m, csrMatrix->nz);
-  matrix->numRows = 0;
-  matrix->numCols = 2 * sizeof(unsigned long) / sizeof(int);
-  matrix->numVals = numVals;
+  int *rows = NULL;
+  if (numFallbackRows > 0) {
+    rows = new int[numFallbackRows];
+    double *fallbackVals = values + numUnfoldingVals;
+    
+#pragma omp parallel for
+    for (int t = 0; t < fallbackRowByNZLists.size(); ++t) {
+      int *rowsPtr = rows + fallbackRowBaseIndices[t];
+      int *colsPtr = fallbackCols + fallbackValBaseIndices[t];
+      double *valsPtr = fallbackVals + fallbackValBaseIndices[t];
+      
+      for (auto &rowByNZ : fallbackRowByNZLists[t]) {
+        unsigned long rowLength = rowByNZ.first;
+        for (int rowIndex : *(rowByNZ.second.getRowIndices())) {
+          *rowsPtr++ = rowIndex;
+          int k = csrMatrix->rows[rowIndex];
+          for (int i = 0; i < rowLength; i++, k++) {
+            *colsPtr++ = csrMatrix->cols[k];
+            *valsPtr++ = csrMatrix->vals[k];
+          }
+        }
+      }
+    }
+  }
+  
+  matrix = new Matrix(rows, (int*)cols, values, csrMatrix->n, csrMatrix->m, csrMatrix->nz);
+  matrix->numRows = numFallbackRows;
+  matrix->numCols = numCols;
+  matrix->numVals = numUnfoldingVals + numFallbackVals;
 }
 
 ///
@@ -97,22 +271,61 @@ public:
     this->csrMatrix = csrMatrix;
     this->stripeInfo = stripeInfo;
     this->numWPointerShiftings = 0;
+    this->numValsPointerShiftings = 0;
+    this->unfoldedRows = NULL;
+    this->fallbackEmitter = NULL;
+    this->valsBegin = stripeInfo->valIndexBegin;
+    this->numSkippedVals = 0;
+    this->numVectors = 1;
   }
 
   virtual void emit();
   
+  // SpMM code for numVectors vectors in row-major blocks. Each value of an
+  // unfolded row is broadcast and applied to the k entries of the row of V.
+  void emitSpMM(unsigned int numVectors);
+  
+  // Only the given rows are unfolded; the others are handled by the fallback emitter,
+  // whose cols and vals start at the given offsets of the arrays.
+  void setFallback(vector<bool> *unfoldedRows,
+                   CSRbyNZCodeEmitter *fallbackEmitter,
+                   unsigned long fallbackColsOffset,
+                   unsigned long fallbackValsOffset);
+  
+  // The values of the unfolded rows are in row order, without those of the
+  // fallback rows, starting at the given index of vals.
+  void setValsBegin(unsigned long valsBegin);
+  
 protected:
   X86Assembler *assembler;
   Matrix *csrMatrix;
   MatrixStripeInfo *stripeInfo;
   unsigned long numWPointerShiftings;
+  unsigned long numValsPointerShiftings;
+  vector<bool> *unfoldedRows;
+  CSRbyNZCodeEmitter *fallbackEmitter;
+  unsigned long fallbackColsOffset;
+  unsigned long fallbackValsOffset;
+  unsigned long valsBegin;
+  // Values of the fallback rows of the stripe skipped so far
+  unsigned long numSkippedVals;
+  // Number of vectors of the SpMM code, 1 for the SpMV code
+  unsigned int numVectors;
   
   void emitRow(int rowIndex);
+  void emitSpMMRow(int rowIndex);
   virtual void emitPartialRow(vector<vector<int> > &partitions, unsigned partitionIndex, bool haveToAccumulateResult);
   void emitRowConclusion(int rowIndex, bool hadToSplitRow);
   void emitRegisterReduce(vector<bool> &signs);
 
   virtual void partitionRowElements(int rowIndex, vector<vector<int> > &partitions);
+  
+  // The value of the element, relative to %rdx
+  virtual unsigned long getValOffset(int elementIndex);
+  
+  // The entries of a row of a row-major vector block, whose byte offset may be
+  // too large for a displacement; %rax is then used as the index.
+  RowEntriesFun getRowEntries(X86Gp base, unsigned long byteOffset);
 
   virtual void emitHeader();
   virtual void emitValsPointerAdjustment();
@@ -143,6 +356,7 @@ protected:
   virtual void emitValsPointerAdjustment();
   virtual void emitPartialRow(vector<vector<int> > &partitions, unsigned partitionIndex, bool haveToAccumulateResult);
   virtual void partitionRowElements(int rowIndex, vector<vector<int> > &partitions);
+  virtual unsigned long getValOffset(int elementIndex);
 };
 
 
@@ -150,11 +364,35 @@ protected:
 ///
 ///
 void Unfolding::emitMultByMFunction(unsigned int index) {
-  X86Assembler assembler(codeHolders[index]);
+  emitFunction(codeHolders[index], index, 1);
+}
+
+bool Unfolding::supportsSpMM() {
+  return true;
+}
+
+void Unfolding::emitSpMMFunction(unsigned int index) {
+  emitFunction(spmmCodeHolders[index], index, kernelOptions.numVectors);
+}
+
+// The SpMM code unfolds the same rows as the SpMV code, since they share the matrix arrays.
+void Unfolding::emitFunction(CodeHolder *codeHolder, unsigned int index, unsigned int numVectors) {
+  X86Assembler assembler(codeHolder);
   auto &stripeInfo = stripeInfos->at(index);
+  NZtoRowMap &fallbackRowByNZs = fallbackRowByNZLists.at(index);
+  CSRbyNZCodeEmitter fallbackEmitter(&assembler,
+                                     &fallbackRowByNZs,
+                                     fallbackValBaseIndices[index],
+                                     fallbackRowBaseIndices[index],
+                                     kernelOptions);
   if (!hasFewDistinctValues()) {
     UnfoldingCodeEmitter emitter(&assembler, csrMatrix, &stripeInfo);
-    emitter.emit();
+    emitter.setFallback(&unfoldedRows.at(index), &fallbackEmitter, NEGATION_MASK_INTS, numUnfoldingVals);
+    emitter.setValsBegin(unfoldedValBaseIndices[index]);
+    if (numVectors > 1)
+      emitter.emitSpMM(numVectors);
+    else
+      emitter.emit();
   } else {
     unsigned long baseValsIndex = 0;
     for (unsigned i = 0; i < index; i++) {
@@ -166,20 +404,60 @@ void Unfolding::emitMultByMFunction(unsigned int index) {
                                                    &stripeInfo,
                                                    &(valToIndexMaps[index]),
                                                    baseValsIndex);
-    emitter.emit();
+    emitter.setFallback(&unfoldedRows.at(index), &fallbackEmitter, NEGATION_MASK_INTS, numUnfoldingVals);
+    if (numVectors > 1)
+      emitter.emitSpMM(numVectors);
+    else
+      emitter.emit();
   }
 }
 
+void UnfoldingCodeEmitter::setFallback(vector<bool> *unfoldedRows,
+                                       CSRbyNZCodeEmitter *fallbackEmitter,
+                                       unsigned long fallbackColsOffset,
+                                       unsigned long fallbackValsOffset) {
+  this->unfoldedRows = unfoldedRows;
+  this->fallbackEmitter = fallbackEmitter;
+  this->fallbackColsOffset = fallbackColsOffset;
+  this->fallbackValsOffset = fallbackValsOffset;
+}
+
+void UnfoldingCodeEmitter::setValsBegin(unsigned long valsBegin) {
+  this->valsBegin = valsBegin;
+}
+
 void UnfoldingCodeEmitter::emit() {
   emitHeader();
 
   for (int row = stripeInfo->rowIndexBegin; row < stripeInfo->rowIndexEnd; ++row) {
+    if (unfoldedRows && !unfoldedRows->at(row - stripeInfo->rowIndexBegin)) {
+      numSkippedVals += csrMatrix->rows[row + 1] - csrMatrix->rows[row];
+      continue;
+    }
     emitRow(row);
   }
   
   emitFooter();
 }
 
+void UnfoldingCodeEmitter::emitSpMM(unsigned int numVectors) {
+  this->numVectors = numVectors;
+  // The rows of W are addressed from the start of W, so %rsi is not shifted.
+  assembler->push(rdx);
+  assembler->push(rsi);
+  emitValsPointerAdjustment();
+  
+  for (int row = stripeInfo->rowIndexBegin; row < stripeInfo->rowIndexEnd; ++row) {
+    if (unfoldedRows && !unfoldedRows->at(row - stripeInfo->rowIndexBegin)) {
+      numSkippedVals += csrMatrix->rows[row + 1] - csrMatrix->rows[row];
+      continue;
+    }
+    emitSpMMRow(row);
+  }
+  
+  emitFooter();
+}
+
 void UnfoldingCodeEmitter::emitHeader() {
   // rows is in %rdx, cols is in %rcx, vals is in %r8
   assembler->push(rdx);
@@ -195,7 +473,7 @@ void UnfoldingCodeEmitter::emitHeader() {
 void UnfoldingCodeEmitter::emitValsPointerAdjustment() {
   // Create a copy of vals pointer (R8) in RDX.
   //  leaq "offset"(%r8), %rdx
-  assembler->lea(rdx, ptr(r8, (stripeInfo->valIndexBegin * sizeof(double)) / LIMIT_TO_DO_LEAQ * LIMIT_TO_DO_LEAQ));
+  assembler->lea(rdx, ptr(r8, (valsBegin * sizeof(double)) / LIMIT_TO_DO_LEAQ * LIMIT_TO_DO_LEAQ));
 }
 
 void UnfoldingWithDistinctValuesCodeEmitter::emitValsPointerAdjustment() {
@@ -207,7 +485,24 @@ void UnfoldingWithDistinctValuesCodeEmitter::emitValsPointerAdjustment() {
 void UnfoldingCodeEmitter::emitFooter() {
   assembler->pop(rsi);
   assembler->pop(rdx);
-  assembler->ret();
+  
+  bool hasFallbackRows = unfoldedRows &&
+                         find(unfoldedRows->begin(), unfoldedRows->end(), false) != unfoldedRows->end();
+  if (hasFallbackRows) {
+    // The remaining rows run the CSRbyNZ loops, which return from the function.
+    //  leaq "fallbackColsOffset*4"(%rcx), %rcx
+    assembler->lea(rcx, ptr(rcx, (int)(fallbackColsOffset * sizeof(int))));
+    // The values of the fallback rows may be more than 2GB into vals.
+    //  movabsq $"fallbackValsOffset*8", %rax ; addq %rax, %r8
+    assembler->mov(rax, (uint64_t)(fallbackValsOffset * sizeof(double)));
+    assembler->add(r8, rax);
+    if (numVectors > 1)
+      fallbackEmitter->emitSpMM();
+    else
+      fallbackEmitter->emit();
+  } else {
+    assembler->ret();
+  }
 }
 
 void UnfoldingCodeEmitter::emitRow(int rowIndex) {
@@ -232,6 +527,30 @@ void UnfoldingCodeEmitter::emitRow(int rowIndex) {
   emitRowConclusion(rowIndex, haveToUseAccumulator);
 }
 
+void UnfoldingCodeEmitter::emitSpMMRow(int rowIndex) {
+  int rowLength = csrMatrix->rows[rowIndex+1] - csrMatrix->rows[rowIndex];
+  if (rowLength == 0) return;
+  
+  unsigned long rowBlockSize = numVectors * sizeof(double);
+  X86Xmm value = spmmValueRegister(numVectors);
+  for (int k = csrMatrix->rows[rowIndex]; k < csrMatrix->rows[rowIndex+1]; ++k) {
+    //  movddup "valOffset"(%rdx), %xmm"value"
+    assembler->movddup(value, ptr(rdx, getValOffset(k)));
+    emitMultiVectorProduct(assembler, getRowEntries(rdi, csrMatrix->cols[k] * rowBlockSize),
+                           numVectors, k == csrMatrix->rows[rowIndex]);
+  }
+  emitMultiVectorUpdate(assembler, getRowEntries(rsi, rowIndex * rowBlockSize), numVectors);
+}
+
+RowEntriesFun UnfoldingCodeEmitter::getRowEntries(X86Gp base, unsigned long byteOffset) {
+  if (byteOffset + numVectors * sizeof(double) <= INT_MAX) {
+    return [base, byteOffset](int offset) { return ptr(base, (int)byteOffset + offset); };
+  }
+  //  movabsq $"byteOffset", %rax
+  assembler->mov(rax, (uint64_t)byteOffset);
+  return [base](int offset) { return ptr(base, rax, 0, offset); };
+}
+
 static void splitElements(pair<int, int> range, vector<vector<int> > &partitions, unsigned int chunkSize) {
   int length = (range.second - range.first);
   unsigned long numPartitions = length / chunkSize;
@@ -311,12 +630,23 @@ void UnfoldingCodeEmitter::emitPartialRow(vector<vector<int> > &partitions,
   }
 }
 
+unsigned long UnfoldingCodeEmitter::getValOffset(int elementIndex) {
+  return getValIndexAndShiftValsPointer(elementIndex);
+}
+
+unsigned long UnfoldingWithDistinctValuesCodeEmitter::getValOffset(int elementIndex) {
+  return sizeof(double) * valToIndexMap->at(csrMatrix->vals[elementIndex]);
+}
+
 unsigned long UnfoldingCodeEmitter::getValIndexAndShiftValsPointer(int elementIndex) {
-  unsigned long valIndex = sizeof(double) * elementIndex;
-  valIndex -= ((stripeInfo->valIndexBegin * sizeof(double)) / LIMIT_TO_DO_LEAQ * LIMIT_TO_DO_LEAQ);
-  if (valIndex % LIMIT_TO_DO_LEAQ == 0 && valIndex != 0) {
-    //  leaq "LIMIT_TO_DO_LEAQ"(%rdx), %rdx
-    assembler->lea(rdx, ptr(rdx, LIMIT_TO_DO_LEAQ));
+  unsigned long valIndex = sizeof(double) * (valsBegin + elementIndex - stripeInfo->valIndexBegin - numSkippedVals);
+  valIndex -= ((valsBegin * sizeof(double)) / LIMIT_TO_DO_LEAQ * LIMIT_TO_DO_LEAQ);
+  // Rows that are not unfolded are skipped, so the pointer may have to move several steps
+  unsigned long numRequiredShiftings = valIndex / LIMIT_TO_DO_LEAQ;
+  if (numRequiredShiftings > numValsPointerShiftings) {
+    //  leaq "k*LIMIT_TO_DO_LEAQ"(%rdx), %rdx
+    assembler->lea(rdx, ptr(rdx, (int)((numRequiredShiftings - numValsPointerShiftings) * LIMIT_TO_DO_LEAQ)));
+    numValsPointerShiftings = numRequiredShiftings;
   }
   valIndex = valIndex % LIMIT_TO_DO_LEAQ;
   return valIndex;
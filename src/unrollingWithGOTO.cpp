@@ -51,6 +51,24 @@ void UnrollingWithGOTO::convertMatrix() {
   matrix->numVals = csrMatrix->nz;
 }
 
+// The generated code jumps back by byte counts stored in rows,
+// which are computed for the SpMV code only, with the plain update of w.
+bool UnrollingWithGOTO::supportsSpMM() {
+  return false;
+}
+
+bool UnrollingWithGOTO::supportsScaling() {
+  return false;
+}
+
+bool UnrollingWithGOTO::supportsFusedOps() {
+  return false;
+}
+
+bool UnrollingWithGOTO::supportsSemiring() {
+  return false;
+}
+
 ///
 /// UnrollingWithGOTOCodeEmitter:
 /// Helper class to avoid having to pass several parameters
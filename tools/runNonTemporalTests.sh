@@ -0,0 +1,62 @@
+#!/bin/bash
+
+if [ "$#" -lt 1 ]; then
+  echo "Usage: $0 '<thundercat parameters>'" >&2
+  exit 1
+fi
+
+if [ -z ${MATRICES+x} ]; then
+    echo "Set MATRICES variable to the matrices folder."
+    exit 1
+fi
+
+source /opt/intel/bin/compilervars.sh intel64
+
+methodName=$1
+methodParam1=$2
+methodParam2=$3
+
+# Non-temporal reads of the matrix pay off when v fits in the last level cache
+# but the matrix does not. Only such matrices are benchmarked.
+llcSize=`getconf LEVEL3_CACHE_SIZE`
+if [ -z "$llcSize" ] || [ "$llcSize" -eq 0 ]; then
+    echo "Could not determine the last level cache size."
+    exit 1
+fi
+
+echo "Running non-temporal test " $methodName $methodParam1 $methodParam2 "(LLC is $llcSize bytes)"
+
+currentTime=`date +%Y.%m.%d_%H.%M`
+fileName=../data/$HOSTNAME.nontemporal."$methodName""$methodParam1""$methodParam2".$currentTime.csv
+mkdir -p ../data
+rm -f $fileName
+
+while read line
+do
+    IFS=' ' read -r -a info <<< "$line"
+    groupName=${info[0]}
+    matrixName=${info[1]}
+
+    # Size line of the .mtx file: <numRows> <numCols> <numNonzeros>
+    read n m nz <<< `grep -v "^%" $MATRICES/$groupName/$matrixName/$matrixName.mtx | head -n 1`
+    vectorSize=$((m * 8))
+    matrixSize=$((nz * 12))
+    if [ $vectorSize -ge $llcSize ] || [ $matrixSize -le $llcSize ]; then
+        continue
+    fi
+
+    echo -n "$groupName"/"$matrixName "
+
+    cd ..
+    temporalTimes=""
+    nonTemporalTimes=""
+    for i in 1 2 3; do
+        temporalTimes="$temporalTimes "`./build/thundercat $MATRICES/$groupName/$matrixName/$matrixName $methodName $methodParam1 $methodParam2 | grep "perIteration" | awk '{print $2}'`
+        nonTemporalTimes="$nonTemporalTimes "`./build/thundercat $MATRICES/$groupName/$matrixName/$matrixName $methodName $methodParam1 $methodParam2 -nontemporal | grep "perIteration" | awk '{print $2}'`
+    done
+    cd tools
+
+    echo $groupName" "$matrixName" "`./findMinTiming.py $temporalTimes`" "`./findMinTiming.py $nonTemporalTimes` >> $fileName
+done < matrixNames.txt
+
+echo " "
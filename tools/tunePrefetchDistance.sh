@@ -0,0 +1,76 @@
+#!/bin/bash
+
+if [ "$#" -lt 1 ]; then
+  echo "Usage: $0 '<thundercat parameters>'" >&2
+  exit 1
+fi
+
+if [ -z ${MATRICES+x} ]; then
+    echo "Set MATRICES variable to the matrices folder."
+    exit 1
+fi
+
+source /opt/intel/bin/compilervars.sh intel64
+
+methodName=$1
+methodParam1=$2
+methodParam2=$3
+
+# Candidate prefetch distances, in nonzeros. 0 means no prefetching.
+distances=(0 16 32 64 128 256 512)
+# Each distance is tried without and with indirect prefetching of v.
+indirectFlags=("" "-prefetch_indirect")
+
+echo "Tuning prefetch distance for " $methodName $methodParam1 $methodParam2
+
+while read line
+do
+    IFS=' ' read -r -a info <<< "$line"
+    groupName=${info[0]}
+    matrixName=${info[1]}
+
+    echo -n "$groupName"/"$matrixName "
+
+    cd ..
+    folderName=data/"$groupName"/"$matrixName"/"$methodName""$methodParam1""$methodParam2"
+    mkdir -p "$folderName"
+    rm -f "$folderName"/prefetch*.txt
+
+    for indirectFlag in "${indirectFlags[@]}"; do
+        for distance in "${distances[@]}"; do
+            runTimes=""
+            for i in 1 2 3; do
+                runTimes="$runTimes "`./build/thundercat $MATRICES/$groupName/$matrixName/$matrixName $methodName $methodParam1 $methodParam2 -prefetch_distance $distance $indirectFlag | grep "perIteration" | awk '{print $2}'`
+            done
+            echo `./tools/findMinTiming.py $runTimes` >> "$folderName"/prefetch"$indirectFlag".txt
+        done
+    done
+    cd tools
+
+done < matrixNames.txt
+
+echo " "
+
+# For each matrix, report the best distance and its runtime
+# with and without indirect prefetching.
+findBestDistances() {
+    currentTime=`date +%Y.%m.%d_%H.%M`
+    local fileName=../data/$HOSTNAME.prefetch."$methodName""$methodParam1""$methodParam2".$currentTime.csv
+    rm -f $fileName
+    while read line
+    do
+        IFS=' ' read -r -a info <<< "$line"
+        groupName=${info[0]}
+        matrixName=${info[1]}
+
+        echo -n $groupName" "$matrixName >> $fileName
+        for indirectFlag in "${indirectFlags[@]}"; do
+            runTimes=`cat ../data/"$groupName"/"$matrixName"/"$methodName""$methodParam1""$methodParam2"/prefetch"$indirectFlag".txt`
+            bestIndex=`./findIndexOfMin.py $runTimes`
+            echo -n " "${distances[$((bestIndex - 1))]}" "`./findMinTiming.py $runTimes` >> $fileName
+        done
+        echo "" >> $fileName
+    done < matrixNames.txt
+}
+
+findBestDistances